@@ -0,0 +1,63 @@
+//! Minimal benchmark harness.
+//!
+//! Every sample runs the routine once on a freshly set up input and only the
+//! routine is timed. The fastest, median and slowest sample are reported.
+//! A benchmark only runs if its name contains the filter given on the command
+//! line, e.g. `cargo bench --features test -- plugins/`.
+
+use std::time::{Duration, Instant};
+
+/// Prevent the compiler from optimizing the given value away.
+pub fn black_box<T>(value: T) -> T {
+    unsafe {
+        let copy = std::ptr::read_volatile(&value);
+        std::mem::forget(value);
+        copy
+    }
+}
+
+/// Runs benchmarks matching the command line filter.
+pub struct Bench {
+    filter: Option<String>,
+}
+
+impl Bench {
+    /// Take the filter from the command line, ignoring the flags passed by cargo.
+    pub fn from_args() -> Self {
+        Self {
+            filter: std::env::args().skip(1).find(|arg| !arg.starts_with('-')),
+        }
+    }
+
+    /// Time the routine on a freshly set up input per sample.
+    pub fn run<I, O, S, R>(&self, name: &str, samples: usize, mut setup: S, mut routine: R)
+    where
+        S: FnMut() -> I,
+        R: FnMut(I) -> O,
+    {
+        if let Some(filter) = &self.filter {
+            if !name.contains(filter.as_str()) {
+                return;
+            }
+        }
+
+        let mut durations: Vec<Duration> = Vec::with_capacity(samples);
+        for _ in 0..samples {
+            let input = setup();
+            let started = Instant::now();
+            let output = black_box(routine(black_box(input)));
+            durations.push(started.elapsed());
+            drop(output);
+        }
+        durations.sort();
+
+        println!(
+            "{:<45} min {:>12?}  median {:>12?}  max {:>12?}  ({} samples)",
+            name,
+            durations[0],
+            durations[durations.len() / 2],
+            durations[durations.len() - 1],
+            samples
+        );
+    }
+}
@@ -0,0 +1,129 @@
+//! Synthetic production-sized graphs shared by the benchmarks.
+//!
+//! Every architecture carries the same release train, with each release
+//! pointing to the next `EDGES_PER_RELEASE` releases of its architecture.
+
+// Not every benchmark uses every helper.
+#![allow(dead_code)]
+
+pub mod harness;
+
+use cincinnati::testing::{TestGraphBuilder, TestMetadata};
+use cincinnati::{Graph, MapImpl};
+use std::path::Path;
+
+/// Prefix of the metadata keys used by the OpenShift plugins.
+pub static KEY_PREFIX: &str = "io.openshift.upgrades.graph";
+
+/// Architectures of the synthetic releases.
+pub static ARCHES: &[&str] = &["amd64", "arm64", "ppc64le", "s390x"];
+
+/// Releases per architecture.
+pub static RELEASES_PER_ARCH: usize = 2_500;
+
+/// Outgoing edges per release, if there are enough newer releases.
+pub static EDGES_PER_RELEASE: usize = 10;
+
+/// Version of the `i`th release of the given architecture.
+pub fn version(i: usize, arch: &str) -> String {
+    format!("4.8.{}+{}", i, arch)
+}
+
+/// Build the synthetic graph.
+///
+/// All releases are in the candidate and fast channels, every other one is also
+/// in the stable channel. Every tenth release removes the edge from its
+/// predecessor and every hundredth one removes the edges from the ten releases
+/// before it by regex, which gives the edge-add-remove plugin work to do.
+pub fn graph() -> Graph {
+    let key = |suffix: &str| format!("{}.{}", KEY_PREFIX, suffix);
+
+    let mut metadata: TestMetadata = Vec::with_capacity(ARCHES.len() * RELEASES_PER_ARCH);
+    let mut edges = Vec::with_capacity(ARCHES.len() * RELEASES_PER_ARCH * EDGES_PER_RELEASE);
+
+    for (a, arch) in ARCHES.iter().enumerate() {
+        let offset = a * RELEASES_PER_ARCH;
+
+        for i in 0..RELEASES_PER_ARCH {
+            let channels = if i % 2 == 0 {
+                "candidate-4.8,fast-4.8,stable-4.8"
+            } else {
+                "candidate-4.8,fast-4.8"
+            };
+
+            let mut release: MapImpl<String, String> = MapImpl::new();
+            release.insert("version_suffix".to_string(), format!("+{}", arch));
+            release.insert(key("release.arch"), arch.to_string());
+            release.insert(key("release.channels"), channels.to_string());
+            if i > 0 && i % 10 == 0 {
+                release.insert(key("previous.remove"), version(i - 1, arch));
+            }
+            if i > 0 && i % 100 == 0 {
+                release.insert(
+                    key("previous.remove_regex"),
+                    format!(r"^4\.8\.{}[0-9]\+{}$", i / 10 - 1, arch),
+                );
+            }
+            metadata.push((i, release));
+
+            for j in (i + 1)..RELEASES_PER_ARCH.min(i + 1 + EDGES_PER_RELEASE) {
+                edges.push((offset + i, offset + j));
+            }
+        }
+    }
+
+    TestGraphBuilder::new()
+        .with_image("quay.io/openshift-release-dev/ocp-release")
+        .with_version_template("4.8.{{i}}")
+        .enable_payload_suffix(true)
+        .with_metadata(metadata)
+        .with_edges(Some(edges))
+        .build()
+}
+
+/// Write secondary metadata matching the synthetic graph to the given directory.
+///
+/// There is one channel file per channel and one blocked edge for every fiftieth release.
+pub fn write_secondary_metadata(dir: &Path) -> std::io::Result<()> {
+    std::fs::write(dir.join("version"), "1.0.0")?;
+
+    std::fs::create_dir_all(dir.join("raw"))?;
+    let raw: std::collections::BTreeMap<String, std::collections::BTreeMap<&str, String>> = (1
+        ..RELEASES_PER_ARCH)
+        .step_by(25)
+        .map(|i| {
+            let mut metadata = std::collections::BTreeMap::new();
+            metadata.insert(
+                "io.openshift.upgrades.graph.previous.add",
+                format!("4.8.{}", i - 1),
+            );
+            (format!("4.8.{}", i), metadata)
+        })
+        .collect();
+    std::fs::write(
+        dir.join("raw/metadata.json"),
+        serde_json::to_vec(&raw).expect("serializing raw metadata"),
+    )?;
+
+    std::fs::create_dir_all(dir.join("channels"))?;
+    for (name, step) in &[("candidate-4.8", 1), ("fast-4.8", 1), ("stable-4.8", 2)] {
+        let versions: String = (0..RELEASES_PER_ARCH)
+            .step_by(*step)
+            .map(|i| format!("- 4.8.{}\n", i))
+            .collect();
+        std::fs::write(
+            dir.join("channels").join(format!("{}.yaml", name)),
+            format!("name: {}\nversions:\n{}", name, versions),
+        )?;
+    }
+
+    std::fs::create_dir_all(dir.join("blocked-edges"))?;
+    for i in (50..RELEASES_PER_ARCH).step_by(50) {
+        std::fs::write(
+            dir.join("blocked-edges").join(format!("4.8.{}.yaml", i)),
+            format!("to: 4.8.{}\nfrom: 4\\.8\\.{}\n", i, i - 1),
+        )?;
+    }
+
+    Ok(())
+}
@@ -0,0 +1,79 @@
+//! Benchmarks for the graph core.
+
+mod common;
+
+use cincinnati::{Graph, ReleaseId};
+use common::harness::{black_box, Bench};
+
+fn serialization(bench: &Bench) {
+    let graph = common::graph();
+    let json = serde_json::to_vec(&graph).expect("serializing graph");
+
+    bench.run(
+        "graph/serialize",
+        20,
+        || (),
+        |_| serde_json::to_vec(black_box(&graph)).unwrap(),
+    );
+    bench.run(
+        "graph/deserialize",
+        20,
+        || (),
+        |_| serde_json::from_slice::<Graph>(black_box(&json)).unwrap(),
+    );
+}
+
+fn lookups(bench: &Bench) {
+    let graph = common::graph();
+    let versions: Vec<String> = common::ARCHES
+        .iter()
+        .flat_map(|arch| {
+            (0..common::RELEASES_PER_ARCH)
+                .step_by(10)
+                .map(move |i| common::version(i, arch))
+        })
+        .collect();
+
+    bench.run(
+        "graph/find_by_version",
+        100,
+        || (),
+        |_| {
+            versions
+                .iter()
+                .filter_map(|version| graph.find_by_version(black_box(version)))
+                .count()
+        },
+    );
+}
+
+fn removal(bench: &Bench) {
+    let graph = common::graph();
+    // Every tenth release, spread over all architectures.
+    let to_remove: Vec<ReleaseId> = common::ARCHES
+        .iter()
+        .flat_map(|arch| {
+            (0..common::RELEASES_PER_ARCH)
+                .step_by(10)
+                .map(move |i| common::version(i, arch))
+        })
+        .filter_map(|version| graph.find_by_version(&version))
+        .collect();
+
+    bench.run(
+        "graph/remove_releases",
+        20,
+        || (graph.clone(), to_remove.clone()),
+        |(mut graph, to_remove)| {
+            graph.remove_releases(to_remove);
+            graph
+        },
+    );
+}
+
+fn main() {
+    let bench = Bench::from_args();
+    serialization(&bench);
+    lookups(&bench);
+    removal(&bench);
+}
@@ -0,0 +1,117 @@
+//! Benchmarks for the plugins on the hot paths of the graph-builder and policy-engine.
+
+#[macro_use]
+extern crate cincinnati;
+
+mod common;
+
+use cincinnati::plugins::prelude::*;
+use cincinnati::plugins::{InternalIO, Plugin, PluginIO, PluginRunner};
+use cincinnati::Graph;
+use common::harness::Bench;
+use std::collections::HashMap;
+use std::convert::TryInto;
+
+fn parameters() -> HashMap<String, String> {
+    [("channel", "stable-4.8"), ("arch", "amd64")]
+        .iter()
+        .map(|(k, v)| (k.to_string(), v.to_string()))
+        .collect()
+}
+
+/// Run a single plugin on the given graph.
+fn run(runtime: &tokio::runtime::Runtime, plugin: &BoxedPlugin, graph: Graph) -> Graph {
+    let io = PluginIO::InternalIO(InternalIO {
+        graph,
+        parameters: parameters(),
+    });
+    let io: InternalIO = runtime
+        .block_on(plugin.run(io))
+        .and_then(TryInto::try_into)
+        .expect("running plugin");
+    io.graph
+}
+
+fn bench_plugin(bench: &Bench, name: &str, plugin: BoxedPlugin) {
+    let runtime = commons::testing::init_runtime().expect("creating runtime");
+    let graph = common::graph();
+
+    bench.run(
+        &format!("plugins/{}", name),
+        20,
+        || graph.clone(),
+        |graph| run(&runtime, &plugin, graph),
+    );
+}
+
+fn build(settings: Fallible<Box<dyn PluginSettings>>) -> BoxedPlugin {
+    settings
+        .and_then(|settings| settings.build_plugin(None))
+        .expect("building plugin")
+}
+
+fn channel_filter(bench: &Bench) {
+    let plugin = build(plugin_config!(("name", ChannelFilterPlugin::PLUGIN_NAME)));
+    bench_plugin(bench, ChannelFilterPlugin::PLUGIN_NAME, plugin);
+}
+
+fn arch_filter(bench: &Bench) {
+    let plugin = build(plugin_config!(("name", ArchFilterPlugin::PLUGIN_NAME)));
+    bench_plugin(bench, ArchFilterPlugin::PLUGIN_NAME, plugin);
+}
+
+fn edge_add_remove(bench: &Bench) {
+    let plugin = build(plugin_config!(("name", EdgeAddRemovePlugin::PLUGIN_NAME)));
+    bench_plugin(bench, EdgeAddRemovePlugin::PLUGIN_NAME, plugin);
+}
+
+fn secondary_metadata_parse(bench: &Bench) {
+    let name = "openshift-secondary-metadata-parse";
+    let data_dir = tempfile::tempdir().expect("creating data directory");
+    common::write_secondary_metadata(data_dir.path()).expect("writing secondary metadata");
+    let data_directory = data_dir.path().to_string_lossy().to_string();
+
+    let plugin = build(plugin_config!(
+        ("name", name),
+        ("data_directory", data_directory.as_str())
+    ));
+    bench_plugin(bench, name, plugin);
+}
+
+/// The plugin chain of the policy-engine, with the graph taking the place of the upstream fetch.
+fn policy_engine_chain(bench: &Bench) {
+    let mut runner = PluginRunner::try_new().expect("creating plugin runner");
+    let plugins: &'static [BoxedPlugin] = Box::leak(
+        vec![
+            build(plugin_config!(("name", ChannelFilterPlugin::PLUGIN_NAME))),
+            build(plugin_config!(("name", ArchFilterPlugin::PLUGIN_NAME))),
+        ]
+        .into_boxed_slice(),
+    );
+    let graph = common::graph();
+
+    bench.run(
+        "plugins/process/policy-engine",
+        20,
+        || {
+            PluginIO::InternalIO(InternalIO {
+                graph: graph.clone(),
+                parameters: parameters(),
+            })
+        },
+        |io| {
+            runner
+                .process_blocking(plugins.iter(), io, None)
+                .expect("processing plugins")
+        },
+    );
+}
+
+fn main() {
+    let bench = Bench::from_args();
+    channel_filter(&bench);
+    arch_filter(&bench);
+    edge_add_remove(&bench);
+    secondary_metadata_parse(&bench);
+    policy_engine_chain(&bench);
+}
@@ -0,0 +1,336 @@
+//! Differences between generations of a graph.
+//!
+//! A delta describes the nodes and edges of a graph in terms of the ones of
+//! an older generation of the same graph. Runs of nodes and edges which are
+//! unchanged are referenced by their position in the base graph, and only
+//! the changed ones are transferred. Applying a delta reproduces the newer
+//! graph exactly, including the order of its nodes and edges, so that its
+//! serialization doesn't depend on how it was obtained.
+
+use crate::{ConcreteRelease, Empty, Graph, Release};
+use commons::prelude_errors::*;
+use daggy::Dag;
+use std::collections::HashMap;
+use std::sync::Arc;
+
+/// Media type of a graph delta.
+pub const CONTENT_TYPE: &str = "application/vnd.cincinnati.graph-delta+json";
+
+/// Response header which carries the generation of the served graph.
+pub const GENERATION_HEADER: &str = "cincinnati-graph-generation";
+
+/// Query parameter for the generation of the client's graph.
+pub const SINCE_PARAM: &str = "since";
+
+/// A section of the nodes or edges of the newer graph.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub enum Chunk<T> {
+    /// Unchanged items, at the given position of the base graph.
+    Copy { start: usize, len: usize },
+    /// Items which are not in the base graph.
+    Insert(Vec<T>),
+}
+
+/// Changes from one generation of a graph to another.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct GraphDelta {
+    /// Generation of the graph this delta applies to.
+    pub base: u64,
+    /// Generation of the graph which results from applying this delta.
+    pub generation: u64,
+    /// Nodes of the newer graph.
+    pub nodes: Vec<Chunk<ConcreteRelease>>,
+    /// Edges of the newer graph, by source and target index into its nodes.
+    pub edges: Vec<Chunk<(usize, usize)>>,
+}
+
+impl GraphDelta {
+    /// Compute the delta which turns `base` into `graph`.
+    ///
+    /// Fails if either graph contains abstract releases.
+    pub fn between(
+        base: &Graph,
+        base_generation: u64,
+        graph: &Graph,
+        generation: u64,
+    ) -> Fallible<Self> {
+        let base_nodes = base.dag.raw_nodes();
+        let nodes = graph.dag.raw_nodes();
+
+        let mut node_chunks = Vec::new();
+        for node in nodes {
+            let release = concrete(&node.weight)?;
+            let position = base
+                .versions
+                .get(&release.version)
+                .map(|index| index.index())
+                .filter(|index| base_nodes[*index].weight == node.weight);
+            push(&mut node_chunks, position, || release.clone());
+        }
+
+        let base_edges: HashMap<(&str, &str), usize> = base
+            .dag
+            .raw_edges()
+            .iter()
+            .enumerate()
+            .map(|(position, edge)| {
+                (
+                    (
+                        base_nodes[edge.source().index()].weight.version(),
+                        base_nodes[edge.target().index()].weight.version(),
+                    ),
+                    position,
+                )
+            })
+            .collect();
+
+        let mut edge_chunks = Vec::new();
+        for edge in graph.dag.raw_edges() {
+            let (source, target) = (edge.source().index(), edge.target().index());
+            let position = base_edges
+                .get(&(
+                    nodes[source].weight.version(),
+                    nodes[target].weight.version(),
+                ))
+                .copied();
+            push(&mut edge_chunks, position, || (source, target));
+        }
+
+        Ok(Self {
+            base: base_generation,
+            generation,
+            nodes: node_chunks,
+            edges: edge_chunks,
+        })
+    }
+
+    /// Apply this delta to the graph of its base generation.
+    ///
+    /// This applies the same validation as deserializing a graph.
+    pub fn apply(self, mut base: Graph) -> Fallible<Graph> {
+        let (base_nodes, base_edges) = base.take_dag().into_graph().into_nodes_edges();
+        let base_versions = base.versions;
+        let mut base_nodes: Vec<Option<Release>> = base_nodes
+            .into_iter()
+            .map(|node| Some(node.weight))
+            .collect();
+
+        let mut graph = Graph {
+            dag: Arc::new(Dag::with_capacity(base_nodes.len(), base_edges.len())),
+            versions: Arc::new(HashMap::with_capacity(base_nodes.len())),
+            metadata_index: Default::default(),
+        };
+
+        // Position of the base nodes in the new graph, by version.
+        let mut positions: Vec<Option<usize>> = vec![None; base_nodes.len()];
+
+        for chunk in self.nodes {
+            let releases: Vec<Release> = match chunk {
+                Chunk::Copy { start, len } => {
+                    let range = checked_range(start, len, base_nodes.len())?;
+                    range
+                        .map(|index| {
+                            base_nodes[index]
+                                .take()
+                                .ok_or_else(|| format_err!("base node {} copied twice", index))
+                        })
+                        .collect::<Fallible<_>>()?
+                }
+                Chunk::Insert(releases) => releases.into_iter().map(Release::Concrete).collect(),
+            };
+
+            for release in releases {
+                ensure!(
+                    !release.version().is_empty(),
+                    "found node with empty version"
+                );
+                ensure!(
+                    !graph.versions.contains_key(release.version()),
+                    "found duplicate version '{}'",
+                    release.version()
+                );
+                if let Some(index) = base_versions.get(release.version()) {
+                    positions[index.index()] = Some(graph.dag.node_count());
+                }
+                graph.insert_node(release);
+            }
+        }
+
+        let node_count = graph.dag.node_count();
+        let mut edges = Vec::with_capacity(base_edges.len());
+        for chunk in self.edges {
+            match chunk {
+                Chunk::Copy { start, len } => {
+                    for edge in &base_edges[checked_range(start, len, base_edges.len())?] {
+                        let source = positions[edge.source().index()];
+                        let target = positions[edge.target().index()];
+                        match (source, target) {
+                            (Some(source), Some(target)) => edges.push((source, target)),
+                            _ => bail!("copied edge references a removed node"),
+                        }
+                    }
+                }
+                Chunk::Insert(inserted) => {
+                    if let Some((source, target)) = inserted
+                        .iter()
+                        .find(|(source, target)| *source >= node_count || *target >= node_count)
+                    {
+                        bail!("edge references missing node ({}, {})", source, target);
+                    }
+                    edges.extend(inserted);
+                }
+            }
+        }
+
+        graph
+            .dag_mut()
+            .add_edges(edges.into_iter().map(|(source, target)| {
+                (
+                    daggy::NodeIndex::new(source),
+                    daggy::NodeIndex::new(target),
+                    Empty {},
+                )
+            }))
+            .map_err(|_| format_err!("edges would form a cycle"))?;
+
+        Ok(graph)
+    }
+}
+
+fn concrete(release: &Release) -> Fallible<&ConcreteRelease> {
+    match release {
+        Release::Concrete(release) => Ok(release),
+        Release::Abstract(release) => bail!("cannot diff abstract release '{}'", release.version),
+    }
+}
+
+/// Append an item to the chunks, either by its position in the base graph or by value.
+fn push<T, F>(chunks: &mut Vec<Chunk<T>>, position: Option<usize>, item: F)
+where
+    F: FnOnce() -> T,
+{
+    match (chunks.last_mut(), position) {
+        (Some(Chunk::Copy { start, len }), Some(position)) if *start + *len == position => {
+            *len += 1
+        }
+        (_, Some(position)) => chunks.push(Chunk::Copy {
+            start: position,
+            len: 1,
+        }),
+        (Some(Chunk::Insert(items)), None) => items.push(item()),
+        (_, None) => chunks.push(Chunk::Insert(vec![item()])),
+    }
+}
+
+fn checked_range(start: usize, len: usize, bound: usize) -> Fallible<std::ops::Range<usize>> {
+    match start.checked_add(len) {
+        Some(end) if end <= bound => Ok(start..end),
+        _ => bail!(
+            "range {}+{} exceeds the base graph size {}",
+            start,
+            len,
+            bound
+        ),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::testing::generate_custom_graph;
+    use crate::MapImpl;
+
+    fn metadata(releases: &[(usize, &str)]) -> Vec<(usize, MapImpl<String, String>)> {
+        releases
+            .iter()
+            .map(|(i, channels)| {
+                let metadata = [("channels".to_string(), channels.to_string())]
+                    .iter()
+                    .cloned()
+                    .collect();
+                (*i, metadata)
+            })
+            .collect()
+    }
+
+    #[test]
+    fn apply_reproduces_graph() -> Fallible<()> {
+        let base = generate_custom_graph(
+            "image",
+            metadata(&[(0, "a"), (1, "a"), (2, "a"), (3, "a")]),
+            Some(vec![(0, 1), (1, 2), (0, 2), (2, 3)]),
+        );
+        // Release 1 changed its metadata, release 3 was removed and release 4 was added.
+        let graph = generate_custom_graph(
+            "image",
+            metadata(&[(0, "a"), (1, "a,b"), (2, "a"), (4, "a")]),
+            Some(vec![(0, 1), (1, 2), (0, 2), (2, 3), (0, 3)]),
+        );
+
+        let delta = GraphDelta::between(&base, 1, &graph, 2)?;
+        assert_eq!(delta.base, 1);
+        assert_eq!(delta.generation, 2);
+        assert_eq!(delta.nodes.len(), 4);
+        assert_eq!(
+            delta.edges,
+            vec![
+                Chunk::Copy { start: 0, len: 3 },
+                Chunk::Insert(vec![(2, 3), (0, 3)])
+            ]
+        );
+
+        let json: GraphDelta = serde_json::from_str(&serde_json::to_string(&delta)?)?;
+        let applied = json.apply(base.clone())?;
+        assert_eq!(applied, graph);
+        assert_eq!(
+            serde_json::to_string(&applied)?,
+            serde_json::to_string(&graph)?
+        );
+
+        let unchanged = GraphDelta::between(&graph, 2, &graph, 3)?;
+        assert_eq!(unchanged.nodes, vec![Chunk::Copy { start: 0, len: 4 }]);
+        assert_eq!(unchanged.apply(graph.clone())?, graph);
+
+        Ok(())
+    }
+
+    #[test]
+    fn apply_rejects_invalid_delta() -> Fallible<()> {
+        let base = generate_custom_graph("image", metadata(&[(0, "a"), (1, "a")]), None);
+
+        let delta = |nodes, edges| GraphDelta {
+            base: 1,
+            generation: 2,
+            nodes,
+            edges,
+        };
+
+        assert!(delta(vec![Chunk::Copy { start: 1, len: 2 }], vec![])
+            .apply(base.clone())
+            .is_err());
+        assert!(delta(
+            vec![
+                Chunk::Copy { start: 0, len: 1 },
+                Chunk::Copy { start: 0, len: 1 }
+            ],
+            vec![]
+        )
+        .apply(base.clone())
+        .is_err());
+        assert!(delta(
+            vec![Chunk::Copy { start: 0, len: 2 }],
+            vec![Chunk::Insert(vec![(0, 2)])]
+        )
+        .apply(base.clone())
+        .is_err());
+        assert!(delta(
+            vec![Chunk::Copy { start: 0, len: 2 }],
+            vec![Chunk::Insert(vec![(0, 1), (1, 0)])]
+        )
+        .apply(base)
+        .is_err());
+
+        Ok(())
+    }
+}
@@ -17,15 +17,21 @@ extern crate serde_derive;
 
 #[macro_use]
 pub mod plugins;
+pub mod delta;
+pub mod metadata;
+pub mod paths;
+pub mod transport;
 
 use commons::prelude_errors::*;
 use daggy::petgraph::visit::{IntoNodeReferences, NodeRef};
 use daggy::{Dag, EdgeIndex, Walker};
 use serde::de::{self, Deserialize, Deserializer, MapAccess, Visitor};
 use serde::ser::{Serialize, SerializeStruct, Serializer};
+use std::sync::{Arc, RwLock};
 use std::{collections, fmt};
 
 pub use daggy::{self, WouldCycle};
+pub use metadata::{MetadataKey, MetadataMap};
 
 pub const CONTENT_TYPE: &str = "application/json";
 const EXPECT_NODE_WEIGHT: &str = "all exisitng nodes to have a weight (release)";
@@ -43,10 +49,127 @@ pub use std::collections::BTreeMap as MapImpl;
 pub use std::collections::BTreeSet as SetImpl;
 
 /// Graph type which stores `Release` as node-weights and `Empty` as edge-weights.
-#[derive(Debug, Default)]
-#[cfg_attr(any(test, feature = "test"), derive(Clone))]
+#[derive(Debug, Default, Clone)]
 pub struct Graph {
-    dag: Dag<Release, Empty>,
+    /// Releases and edges, shared between clones of the graph until either of them is modified.
+    dag: Arc<Dag<Release, Empty>>,
+
+    /// Index from a release version to its node, shared like `dag`.
+    ///
+    /// Every method which adds, removes or reorders nodes must keep this in sync with `dag`.
+    versions: Arc<collections::HashMap<String, daggy::NodeIndex>>,
+
+    /// Lazily built membership index for comma-separated metadata values.
+    ///
+    /// Clones of the graph share the index until either of them is modified.
+    metadata_index: Arc<MetadataIndex>,
+}
+
+/// Releases grouped by the values of a comma-separated metadata key.
+pub type MetadataValueIndex = collections::HashMap<String, ReleaseMask>;
+
+/// Per metadata key `MetadataValueIndex`, built on first use.
+#[derive(Debug, Default)]
+struct MetadataIndex {
+    keys: RwLock<collections::HashMap<String, Arc<MetadataValueIndex>>>,
+
+    /// Graph this one was filtered from, which provides the keys not built yet.
+    origin: Option<Origin>,
+}
+
+/// Releases a graph was filtered from, along with their shared metadata index.
+struct Origin {
+    dag: Arc<Dag<Release, Empty>>,
+    index: Arc<MetadataIndex>,
+    /// Releases of `dag` which were kept, in the order of the filtered graph.
+    mask: ReleaseMask,
+}
+
+impl fmt::Debug for Origin {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("Origin")
+            .field("releases", &self.dag.node_count())
+            .field("kept", &self.mask.count())
+            .finish()
+    }
+}
+
+impl MetadataIndex {
+    /// Create an empty index for a graph filtered from the given origin.
+    fn with_origin(origin: Option<Origin>) -> Self {
+        Self {
+            keys: Default::default(),
+            origin,
+        }
+    }
+
+    /// Returns the already built index for `key`.
+    fn get(&self, key: &str) -> Option<Arc<MetadataValueIndex>> {
+        self.keys.read().ok()?.get(key).cloned()
+    }
+
+    /// Returns the index for `key` of the given releases, building it if needed.
+    ///
+    /// For a filtered graph, the index is built on its origin and shared with all other
+    /// graphs filtered from it. Only the part for the kept releases is copied.
+    fn values(&self, dag: &Dag<Release, Empty>, key: &str) -> Arc<MetadataValueIndex> {
+        if let Some(values) = self.get(key) {
+            return values;
+        }
+
+        let values = match &self.origin {
+            Some(origin) => origin
+                .index
+                .values(&origin.dag, key)
+                .iter()
+                .map(|(value, releases)| (value.clone(), releases.compact(&origin.mask)))
+                .collect(),
+            None => {
+                let mut values = MetadataValueIndex::new();
+                for (i, node) in dag.raw_nodes().iter().enumerate() {
+                    if let Release::Concrete(release) = &node.weight {
+                        if let Some(found) = release.metadata.get(key) {
+                            for value in found.split(',').map(str::trim) {
+                                values
+                                    .entry(value.to_string())
+                                    .or_insert_with(|| ReleaseMask::empty(dag.node_count()))
+                                    .insert(i);
+                            }
+                        }
+                    }
+                }
+                values
+            }
+        };
+
+        let values = Arc::new(values);
+        if let Ok(mut keys) = self.keys.write() {
+            keys.entry(key.to_string())
+                .or_insert_with(|| values.clone());
+        }
+        values
+    }
+
+    /// Returns the given releases whose metadata `key` lists `value`.
+    ///
+    /// Unless `key` is already indexed here, only the mask for `value` is taken from the origin.
+    fn releases(&self, dag: &Dag<Release, Empty>, key: &str, value: &str) -> ReleaseMask {
+        let values = match (self.get(key), &self.origin) {
+            (Some(values), _) => values,
+            (None, Some(origin)) => {
+                return origin
+                    .index
+                    .releases(&origin.dag, key, value)
+                    .compact(&origin.mask)
+            }
+            (None, None) => self.values(dag, key),
+        };
+
+        values
+            .get(value)
+            .cloned()
+            .unwrap_or_else(|| ReleaseMask::empty(dag.node_count()))
+    }
 }
 
 /// Wrapper enum for the concrete and abstract release types.
@@ -67,7 +190,7 @@ impl Release {
     }
 
     /// Get a mutable borrow of the release metadata if any
-    pub fn get_metadata_mut(&mut self) -> Option<&mut MapImpl<String, String>> {
+    pub fn get_metadata_mut(&mut self) -> Option<&mut MetadataMap> {
         match self {
             Release::Abstract(_) => None,
             Release::Concrete(release) => Some(&mut release.metadata),
@@ -92,7 +215,7 @@ impl Release {
 pub struct ConcreteRelease {
     pub version: String,
     pub payload: String,
-    pub metadata: MapImpl<String, String>,
+    pub metadata: MetadataMap,
 }
 
 /// Abtract release only storing a version.
@@ -161,6 +284,226 @@ impl<'a> Iterator for PreviousReleases<'a> {
 #[derive(Debug, Clone)]
 pub struct Empty;
 
+/// Number of releases tracked by a single word of a `ReleaseMask`.
+const MASK_WORD_BITS: usize = 64;
+
+/// Set of releases of a `Graph`, stored as a bitset over the node indices.
+///
+/// A mask is only meaningful for the graph it was built for, as removing releases
+/// invalidates node indices.
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct ReleaseMask {
+    words: Vec<u64>,
+    len: usize,
+}
+
+impl ReleaseMask {
+    /// Create a mask for `len` releases which contains none of them.
+    pub fn empty(len: usize) -> Self {
+        Self {
+            words: vec![0; (len + MASK_WORD_BITS - 1) / MASK_WORD_BITS],
+            len,
+        }
+    }
+
+    /// Create a mask for `len` releases which contains all of them.
+    pub fn full(len: usize) -> Self {
+        let mut mask = Self {
+            words: vec![!0; (len + MASK_WORD_BITS - 1) / MASK_WORD_BITS],
+            len,
+        };
+        let tail = len % MASK_WORD_BITS;
+        if tail != 0 {
+            if let Some(last) = mask.words.last_mut() {
+                *last &= (1 << tail) - 1;
+            }
+        }
+        mask
+    }
+
+    /// Returns true if the node with the given index is part of the mask.
+    pub fn contains(&self, index: usize) -> bool {
+        index < self.len
+            && self.words[index / MASK_WORD_BITS] & (1 << (index % MASK_WORD_BITS)) != 0
+    }
+
+    /// Returns true if the given release is part of the mask.
+    pub fn contains_release(&self, id: &ReleaseId) -> bool {
+        self.contains(id.0.index())
+    }
+
+    /// Add the node with the given index, growing the mask if needed.
+    pub fn insert(&mut self, index: usize) {
+        if index >= self.len {
+            self.len = index + 1;
+            self.words
+                .resize((self.len + MASK_WORD_BITS - 1) / MASK_WORD_BITS, 0);
+        }
+        self.words[index / MASK_WORD_BITS] |= 1 << (index % MASK_WORD_BITS);
+    }
+
+    /// Remove the node with the given index.
+    pub fn remove(&mut self, index: usize) {
+        if index < self.len {
+            self.words[index / MASK_WORD_BITS] &= !(1 << (index % MASK_WORD_BITS));
+        }
+    }
+
+    /// Only keep the nodes which are also part of `other`.
+    pub fn intersect_with(&mut self, other: &ReleaseMask) {
+        for (i, word) in self.words.iter_mut().enumerate() {
+            *word &= other.words.get(i).copied().unwrap_or(0);
+        }
+    }
+
+    /// Return the number of nodes in the mask.
+    pub fn count(&self) -> usize {
+        self.words
+            .iter()
+            .map(|word| word.count_ones() as usize)
+            .sum()
+    }
+
+    /// Iterates over the indices of all nodes in the mask in ascending order.
+    pub fn iter(&self) -> impl Iterator<Item = usize> + '_ {
+        self.words.iter().enumerate().flat_map(|(i, word)| {
+            let mut word = *word;
+            std::iter::from_fn(move || {
+                if word == 0 {
+                    return None;
+                }
+                let bit = word.trailing_zeros() as usize;
+                word &= word - 1;
+                Some(i * MASK_WORD_BITS + bit)
+            })
+        })
+    }
+
+    /// Returns the nodes of this mask which are also in `keep`, renumbered by their position
+    /// among the nodes of `keep`.
+    pub fn compact(&self, keep: &ReleaseMask) -> ReleaseMask {
+        let mut compacted = ReleaseMask::empty(keep.count());
+        for (position, index) in keep.iter().enumerate() {
+            if self.contains(index) {
+                compacted.insert(position);
+            }
+        }
+        compacted
+    }
+
+    /// Returns the nodes of `within` at the positions in this mask, which inverts `compact`.
+    fn expand(&self, within: &ReleaseMask) -> ReleaseMask {
+        let mut expanded = ReleaseMask::empty(within.len);
+        for (position, index) in within.iter().enumerate() {
+            if self.contains(position) {
+                expanded.insert(index);
+            }
+        }
+        expanded
+    }
+
+    /// Map every index of a graph with `len` nodes to its position among the masked nodes.
+    fn positions(&self, len: usize) -> Vec<Option<daggy::NodeIndex>> {
+        let mut positions = vec![None; len];
+        for (position, index) in self.iter().take_while(|index| *index < len).enumerate() {
+            positions[index] = Some(daggy::NodeIndex::from(position as u32));
+        }
+        positions
+    }
+}
+
+/// Maps the `ReleaseId`s of a graph to the ones after a bulk removal of releases.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct ReleaseIdMapping(Vec<Option<daggy::NodeIndex>>);
+
+impl ReleaseIdMapping {
+    /// Returns the new id of the given release, or `None` if it was removed.
+    pub fn get(&self, id: &ReleaseId) -> Option<ReleaseId> {
+        self.0.get(id.0.index()).copied().flatten().map(ReleaseId)
+    }
+}
+
+/// Read-only view on a subset of the releases of a `Graph`.
+///
+/// Filters narrow down the selected releases without cloning or mutating the
+/// underlying graph. Only the selected releases and the edges between them are
+/// serialized or materialized.
+#[derive(Debug, Clone)]
+pub struct GraphView<'a> {
+    graph: &'a Graph,
+    mask: ReleaseMask,
+}
+
+impl<'a> GraphView<'a> {
+    /// Create a view on the releases of `graph` which are part of `mask`.
+    pub fn new(graph: &'a Graph, mask: ReleaseMask) -> Self {
+        Self { graph, mask }
+    }
+
+    /// Deselect all releases for which `f` returns false.
+    pub fn retain<F>(mut self, mut f: F) -> Self
+    where
+        F: FnMut(&Release) -> bool,
+    {
+        for (i, node) in self.graph.dag.raw_nodes().iter().enumerate() {
+            if self.mask.contains(i) && !f(&node.weight) {
+                self.mask.remove(i);
+            }
+        }
+        self
+    }
+
+    /// Deselect all releases which are not part of `mask`.
+    pub fn intersect(mut self, mask: &ReleaseMask) -> Self {
+        self.mask.intersect_with(mask);
+        self
+    }
+
+    /// Returns the mask of selected releases.
+    pub fn mask(&self) -> &ReleaseMask {
+        &self.mask
+    }
+
+    /// Consumes the view and returns the mask of selected releases.
+    pub fn into_mask(self) -> ReleaseMask {
+        self.mask
+    }
+
+    /// Return the number of selected releases.
+    pub fn releases_count(&self) -> u64 {
+        self.mask.count() as u64
+    }
+
+    /// Iterates over the selected releases.
+    pub fn releases(&self) -> impl Iterator<Item = (ReleaseId, &'a Release)> + '_ {
+        let nodes = self.graph.dag.raw_nodes();
+        self.mask
+            .iter()
+            .take_while(move |index| *index < nodes.len())
+            .map(move |index| {
+                (
+                    ReleaseId(daggy::NodeIndex::from(index as u32)),
+                    &nodes[index].weight,
+                )
+            })
+    }
+
+    /// Build a new graph which only contains the selected releases.
+    pub fn to_graph(&self) -> Graph {
+        Graph::from_masked(
+            self.releases().map(|(id, release)| (id.0, release.clone())),
+            self.graph
+                .dag
+                .raw_edges()
+                .iter()
+                .map(|edge| (edge.source(), edge.target())),
+            self.graph.dag.node_count(),
+            &self.mask,
+            Some(self.graph.origin(&self.mask)),
+        )
+    }
+}
+
 /// Errors that can be returned by the methods in this library
 pub mod errors {
     use commons::prelude_errors::*;
@@ -198,7 +541,10 @@ impl Graph {
         let release = release.into();
         match self.find_by_version(&release.version()) {
             Some(id) => {
-                let node = self.dag.node_weight_mut(id.0).expect(EXPECT_NODE_WEIGHT);
+                let node = self
+                    .dag_mut()
+                    .node_weight_mut(id.0)
+                    .expect(EXPECT_NODE_WEIGHT);
                 if let Release::Concrete(_) = node {
                     // check if release digest and node digest are same
                     if release.manifestref().unwrap() != node.manifestref().unwrap() {
@@ -211,10 +557,71 @@ impl Graph {
                     }
                 }
                 *node = release;
+                self.invalidate_metadata_index();
                 Ok(id)
             }
-            None => Ok(ReleaseId(self.dag.add_node(release))),
+            None => Ok(ReleaseId(self.insert_node(release))),
+        }
+    }
+
+    /// Returns the DAG for modification, copying it first if it is shared with other graphs.
+    fn dag_mut(&mut self) -> &mut Dag<Release, Empty> {
+        Arc::make_mut(&mut self.dag)
+    }
+
+    /// Returns the version index for modification, copying it first if it is shared with other graphs.
+    fn versions_mut(&mut self) -> &mut collections::HashMap<String, daggy::NodeIndex> {
+        Arc::make_mut(&mut self.versions)
+    }
+
+    /// Takes the DAG out of the graph, copying it if it is shared with other graphs.
+    fn take_dag(&mut self) -> Dag<Release, Empty> {
+        Arc::try_unwrap(std::mem::take(&mut self.dag)).unwrap_or_else(|dag| (*dag).clone())
+    }
+
+    /// Add a node to the DAG and register its version in the index.
+    ///
+    /// The caller is responsible for ensuring that the version is not yet present.
+    fn insert_node(&mut self, release: Release) -> daggy::NodeIndex {
+        self.invalidate_metadata_index();
+        let version = release.version().to_string();
+        let index = self.dag_mut().add_node(release);
+        self.versions_mut().insert(version, index);
+        index
+    }
+
+    /// Remove a node from the DAG and keep the index in sync.
+    ///
+    /// `daggy::Dag::remove_node()` swaps the last node into the place of the removed
+    /// one, hence the index entry of the previously last node needs to be updated.
+    fn remove_node(&mut self, index: daggy::NodeIndex) -> Option<Release> {
+        let last = daggy::NodeIndex::from(self.dag.node_count().checked_sub(1)? as u32);
+        let removed = self.dag_mut().remove_node(index)?;
+        self.invalidate_metadata_index();
+        self.versions_mut().remove(removed.version());
+
+        if index != last {
+            if let Some(moved) = self.dag.node_weight(index) {
+                Arc::make_mut(&mut self.versions).insert(moved.version().to_string(), index);
+            }
         }
+
+        Some(removed)
+    }
+
+    /// Rebuild the version index from scratch.
+    fn reindex(&mut self) {
+        self.versions = Arc::new(
+            self.dag
+                .node_references()
+                .map(|nr| (nr.weight().version().to_string(), nr.id()))
+                .collect(),
+        );
+    }
+
+    /// Returns true if the index entry for the given node doesn't match its version anymore.
+    fn is_stale(&self, index: daggy::NodeIndex, release: &Release) -> bool {
+        self.versions.get(release.version()) != Some(&index)
     }
 
     /// Add a transition (edge) from `source` to `target`.
@@ -230,7 +637,7 @@ impl Graph {
             }));
         }
 
-        self.dag
+        self.dag_mut()
             .add_edge(from.0, to.0, Empty {})
             .map_err(Into::into)
     }
@@ -244,10 +651,7 @@ impl Graph {
 
     /// Returns a Some(ReleaseId) if the version exists in the graph, None otherwise.
     pub fn find_by_version(&self, version: &str) -> Option<ReleaseId> {
-        self.dag
-            .node_references()
-            .find(|nr| nr.weight().version() == version)
-            .map(|nr| ReleaseId(nr.id()))
+        self.versions.get(version).cloned().map(ReleaseId)
     }
 
     /// Returns a Release for the given &ReleaseId
@@ -257,21 +661,28 @@ impl Graph {
             .ok_or_else(move || format_err!("could not find Release with id: {:?}", id))
     }
 
-    /// Removes the directed edge between the given releases.
-    pub fn remove_edge(&mut self, from: &ReleaseId, to: &ReleaseId) -> Result<(), Error> {
-        if let Some(edge) = self.dag.find_edge(from.0, to.0) {
-            self.dag
-                .remove_edge(edge)
-                .map(|_| ())
-                .ok_or_else(|| format_err!("could not remove edge '{:?}'", edge))
-        } else {
-            Err(Error::from(errors::EdgeDoesntExist {
+    /// Returns the index of the directed edge between the given releases.
+    ///
+    /// Fails with the `EdgeDoesntExist` error if there is no such edge.
+    pub fn find_edge(&self, from: &ReleaseId, to: &ReleaseId) -> Result<EdgeIndex, Error> {
+        match self.dag.find_edge(from.0, to.0) {
+            Some(edge) => Ok(edge),
+            None => Err(Error::from(errors::EdgeDoesntExist {
                 from: self.find_by_releaseid(from)?.version().to_string(),
                 to: self.find_by_releaseid(to)?.version().to_string(),
-            }))
+            })),
         }
     }
 
+    /// Removes the directed edge between the given releases.
+    pub fn remove_edge(&mut self, from: &ReleaseId, to: &ReleaseId) -> Result<(), Error> {
+        let edge = self.find_edge(from, to)?;
+        self.dag_mut()
+            .remove_edge(edge)
+            .map(|_| ())
+            .ok_or_else(|| format_err!("could not remove edge '{:?}'", edge))
+    }
+
     /// Remove the directed edges given by the key/value pairs of releases.
     pub fn remove_edges(&mut self, indices: MapImpl<ReleaseId, ReleaseId>) -> Result<(), Error> {
         indices
@@ -283,7 +694,7 @@ impl Graph {
     ///
     /// Fails if the edge wasn't found and thus couldn't be removed.
     pub fn remove_edge_by_index(&mut self, index: daggy::EdgeIndex) -> Result<(), Error> {
-        match self.dag.remove_edge(index) {
+        match self.dag_mut().remove_edge(index) {
             Some(_) => Ok(()),
             None => bail!("could not remove edge with index {:?}", index),
         }
@@ -311,20 +722,32 @@ impl Graph {
     where
         F: FnMut(&mut Release) -> bool,
     {
-        self.dag
-            .node_weights_mut()
-            .enumerate()
-            .filter_map(|(i, nw)| {
-                if filter_fn(nw) {
-                    Some((
-                        ReleaseId(daggy::NodeIndex::from(i as u32)),
-                        nw.version().to_string(),
-                    ))
-                } else {
-                    None
-                }
-            })
-            .collect()
+        self.invalidate_metadata_index();
+
+        let mut stale = false;
+        let mut found = Vec::new();
+
+        for i in 0..self.dag.node_count() {
+            let index = daggy::NodeIndex::from(i as u32);
+            let nw = self
+                .dag_mut()
+                .node_weight_mut(index)
+                .expect(EXPECT_NODE_WEIGHT);
+            let matched = filter_fn(nw);
+            let nw = self.dag.node_weight(index).expect(EXPECT_NODE_WEIGHT);
+
+            if matched {
+                found.push((ReleaseId(index), nw.version().to_string()));
+            }
+            stale = stale || self.is_stale(index, nw);
+        }
+
+        // filter_fn might have changed versions
+        if stale {
+            self.reindex();
+        }
+
+        found
     }
 
     /// Returns tuples of ReleaseId and its version String for releases which
@@ -364,12 +787,22 @@ impl Graph {
             .collect()
     }
 
+    /// Returns a reference to the metadata for the given release.
+    pub fn get_metadata_as_ref(&self, release_id: &ReleaseId) -> Result<&MetadataMap, Error> {
+        match self.dag.node_weight(release_id.0) {
+            Some(Release::Concrete(release)) => Ok(&release.metadata),
+            _ => bail!("could not get metadata reference"),
+        }
+    }
+
     /// Returns a mutable reference to the metadata for the given release.
     pub fn get_metadata_as_ref_mut(
         &mut self,
         release_id: &ReleaseId,
-    ) -> Result<&mut MapImpl<String, String>, Error> {
-        match self.dag.node_weight_mut(release_id.0) {
+    ) -> Result<&mut MetadataMap, Error> {
+        self.invalidate_metadata_index();
+
+        match self.dag_mut().node_weight_mut(release_id.0) {
             Some(Release::Concrete(release)) => Ok(&mut release.metadata),
             _ => bail!("could not get metadata reference"),
         }
@@ -400,6 +833,176 @@ impl Graph {
         self.dag.node_count() as u64
     }
 
+    /// Return the number of edges in the graph.
+    pub fn edges_count(&self) -> u64 {
+        self.dag.edge_count() as u64
+    }
+
+    /// Returns a view on all releases of the graph.
+    pub fn view(&self) -> GraphView {
+        GraphView::new(self, ReleaseMask::full(self.dag.node_count()))
+    }
+
+    /// Consumes the graph and returns a new one which only contains the releases in `mask`
+    /// and the edges between them.
+    ///
+    /// This moves the kept releases instead of removing the others one by one, which is
+    /// considerably cheaper when most of the graph is dropped. If the releases are shared
+    /// with other graphs, only the kept ones are copied.
+    pub fn filter(self, mask: &ReleaseMask) -> Graph {
+        if Arc::strong_count(&self.dag) > 1 {
+            return self.view().intersect(mask).to_graph();
+        }
+
+        let len = self.dag.node_count();
+        // The releases are moved, hence only an origin of this graph can be kept.
+        let origin = self.metadata_index.origin.as_ref().map(|origin| Origin {
+            dag: origin.dag.clone(),
+            index: origin.index.clone(),
+            mask: mask.expand(&origin.mask),
+        });
+        let (nodes, edges) = Arc::try_unwrap(self.dag)
+            .unwrap_or_else(|dag| (*dag).clone())
+            .into_graph()
+            .into_nodes_edges();
+
+        Graph::from_masked(
+            nodes
+                .into_iter()
+                .enumerate()
+                .filter(|(i, _)| mask.contains(*i))
+                .map(|(i, node)| (daggy::NodeIndex::from(i as u32), node.weight)),
+            edges.iter().map(|edge| (edge.source(), edge.target())),
+            len,
+            mask,
+            origin,
+        )
+    }
+
+    /// Returns the origin for a graph filtered from this one, which shares its releases.
+    fn origin(&self, mask: &ReleaseMask) -> Origin {
+        Origin {
+            dag: self.dag.clone(),
+            index: self.metadata_index.clone(),
+            mask: mask.clone(),
+        }
+    }
+
+    /// Build a graph from the masked releases and all edges between them.
+    ///
+    /// `releases` must yield the masked releases of a graph with `len` nodes in ascending
+    /// index order, as they are assigned new indices in that order. The metadata index of
+    /// the new graph is taken from `origin` on demand.
+    fn from_masked<R, E>(
+        releases: R,
+        edges: E,
+        len: usize,
+        mask: &ReleaseMask,
+        origin: Option<Origin>,
+    ) -> Graph
+    where
+        R: Iterator<Item = (daggy::NodeIndex, Release)>,
+        E: Iterator<Item = (daggy::NodeIndex, daggy::NodeIndex)>,
+    {
+        let count = mask.count();
+        let positions = mask.positions(len);
+        let mut graph = Graph {
+            dag: Arc::new(Dag::with_capacity(count, 0)),
+            versions: Arc::new(collections::HashMap::with_capacity(count)),
+            metadata_index: Default::default(),
+        };
+
+        for (index, release) in releases {
+            let inserted = graph.insert_node(release);
+            debug_assert_eq!(Some(inserted), positions[index.index()]);
+        }
+
+        graph
+            .dag_mut()
+            .add_edges(edges.filter_map(|(source, target)| {
+                Some((
+                    positions[source.index()]?,
+                    positions[target.index()]?,
+                    Empty {},
+                ))
+            }))
+            .expect("a subgraph of a DAG to be acyclic");
+        graph.metadata_index = Arc::new(MetadataIndex::with_origin(origin));
+
+        graph
+    }
+
+    /// Returns the releases grouped by the trimmed values of the comma-separated metadata `key`.
+    ///
+    /// The index is built once per key and shared between clones of the graph, until it is
+    /// modified.
+    pub fn metadata_index(&self, key: &str) -> Arc<MetadataValueIndex> {
+        self.metadata_index.values(&self.dag, key)
+    }
+
+    /// Returns the releases whose comma-separated metadata `key` lists `value`.
+    pub fn find_by_metadata_value(&self, key: &str, value: &str) -> ReleaseMask {
+        self.metadata_index.releases(&self.dag, key, value)
+    }
+
+    /// Drop the metadata index, as releases are about to be added, removed or modified.
+    fn invalidate_metadata_index(&mut self) {
+        match Arc::get_mut(&mut self.metadata_index) {
+            Some(index) => {
+                if let Ok(keys) = index.keys.get_mut() {
+                    keys.clear();
+                }
+                index.origin = None;
+            }
+            None => self.metadata_index = Default::default(),
+        }
+    }
+
+    /// Only keeps the releases in `mask` and the edges between them.
+    ///
+    /// The DAG is rebuilt in a single pass instead of removing releases one at a time,
+    /// which invalidates all `ReleaseId`s. The returned mapping translates them to the
+    /// new ones.
+    pub fn retain_releases(&mut self, keep: &ReleaseMask) -> ReleaseIdMapping {
+        let mapping = ReleaseIdMapping(keep.positions(self.dag.node_count()));
+        if mapping.0.iter().all(Option::is_some) {
+            return mapping;
+        }
+
+        let graph = std::mem::take(self);
+        *self = graph.filter(keep);
+
+        mapping
+    }
+
+    /// Only keeps the edges for which `f` returns true and returns the number of removed edges.
+    ///
+    /// The DAG is rebuilt in a single pass. Unlike the removal of releases, this keeps all
+    /// `ReleaseId`s valid.
+    pub fn retain_edges<F>(&mut self, mut f: F) -> usize
+    where
+        F: FnMut(&ReleaseId, &ReleaseId) -> bool,
+    {
+        let (nodes, edges) = self.take_dag().into_graph().into_nodes_edges();
+        let mut dag = Dag::with_capacity(nodes.len(), edges.len());
+
+        for node in nodes {
+            dag.add_node(node.weight);
+        }
+
+        let before = edges.len();
+        dag.add_edges(
+            edges
+                .into_iter()
+                .filter(|edge| f(&ReleaseId(edge.source()), &ReleaseId(edge.target())))
+                .map(|edge| (edge.source(), edge.target(), edge.weight)),
+        )
+        .expect("a subgraph of a DAG to be acyclic");
+        self.dag = Arc::new(dag);
+
+        before - self.dag.edge_count()
+    }
+
     /// Removes the nodes with the given ReleaseIds and returns the number of
     /// removed releases.
     ///
@@ -428,7 +1031,7 @@ impl Graph {
         to_remove
             .into_iter()
             .rev()
-            .filter(|ni| self.dag.remove_node(*ni).is_some())
+            .filter(|ni| self.remove_node(*ni).is_some())
             .count()
     }
 
@@ -448,10 +1051,8 @@ impl Graph {
             })
             .collect();
 
-        to_remove
-            .iter()
-            .filter(|ni| self.dag.remove_node(**ni).is_some())
-            .count()
+        // node_references() yields ascending indices, which remove_nodes() expects.
+        self.remove_nodes(to_remove)
     }
 
     /// Iterates over all releases mutably
@@ -461,9 +1062,23 @@ impl Graph {
     where
         F: FnMut(&mut Release) -> Result<(), Error>,
     {
-        self.dag
+        self.invalidate_metadata_index();
+
+        let result = self
+            .dag_mut()
             .node_weights_mut()
-            .try_for_each(|mut nw| f(&mut nw))
+            .try_for_each(|mut nw| f(&mut nw));
+
+        // f might have changed versions
+        if self
+            .dag
+            .node_references()
+            .any(|nr| self.is_stale(nr.id(), nr.weight()))
+        {
+            self.reindex();
+        }
+
+        result
     }
 
     /// Get the edges expressed as version -> versions; optionally include edges from/to `Release::Abstract`.
@@ -558,9 +1173,10 @@ impl<'a> Deserialize<'a> for Graph {
                 let edges = edges.ok_or_else(|| de::Error::missing_field("edges"))?;
                 let nodes = nodes.ok_or_else(|| de::Error::missing_field("nodes"))?;
                 let mut graph = Graph {
-                    dag: Dag::with_capacity(nodes.len(), edges.len()),
+                    dag: Arc::new(Dag::with_capacity(nodes.len(), edges.len())),
+                    versions: Arc::new(collections::HashMap::with_capacity(nodes.len())),
+                    metadata_index: Default::default(),
                 };
-                let mut versions = collections::HashSet::with_capacity(nodes.len());
                 for node in nodes {
                     // Validate version string is non-empty.
                     if node.version().is_empty() {
@@ -570,16 +1186,16 @@ impl<'a> Deserialize<'a> for Graph {
                         ));
                     }
                     // Validate version string is unique in "nodes" set.
-                    if !versions.insert(node.version().to_string()) {
+                    if graph.versions.contains_key(node.version()) {
                         return Err(de::Error::invalid_value(
                             de::Unexpected::Str(node.version()),
                             &"a unique string version",
                         ));
                     }
-                    graph.dag.add_node(node);
+                    graph.insert_node(node);
                 }
                 graph
-                    .dag
+                    .dag_mut()
                     .add_edges(edges.into_iter().map(|(s, t)| (s, t, Empty {})))
                     .map_err(|_| {
                         de::Error::invalid_value(serde::de::Unexpected::StructVariant, &self)
@@ -625,6 +1241,46 @@ impl Serialize for Graph {
     }
 }
 
+impl<'a> Serialize for GraphView<'a> {
+    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+    where
+        S: Serializer,
+    {
+        struct Edges<'a, 'b>(&'b GraphView<'a>, &'b [Option<daggy::NodeIndex>]);
+        struct Nodes<'a, 'b>(&'b GraphView<'a>);
+
+        impl<'a, 'b> Serialize for Edges<'a, 'b> {
+            fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+            where
+                S: Serializer,
+            {
+                let positions = self.1;
+                serializer.collect_seq(self.0.graph.dag.raw_edges().iter().filter_map(|edge| {
+                    Some((
+                        positions[edge.source().index()]?,
+                        positions[edge.target().index()]?,
+                    ))
+                }))
+            }
+        }
+
+        impl<'a, 'b> Serialize for Nodes<'a, 'b> {
+            fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+            where
+                S: Serializer,
+            {
+                serializer.collect_seq(self.0.releases().map(|(_, release)| release))
+            }
+        }
+
+        let positions = self.mask.positions(self.graph.dag.node_count());
+        let mut state = serializer.serialize_struct("Graph", 2)?;
+        state.serialize_field("nodes", &Nodes(self))?;
+        state.serialize_field("edges", &Edges(self, &positions))?;
+        state.end()
+    }
+}
+
 #[cfg(any(test, feature = "test"))]
 impl PartialEq for Graph {
     fn eq(&self, other: &Graph) -> bool {
@@ -671,75 +1327,73 @@ impl Eq for Graph {}
 
 impl From<plugins::interface::Graph> for Graph {
     fn from(mut graph: plugins::interface::Graph) -> Self {
-        let mut graph_converted = Graph::default();
+        let nodes = graph.take_nodes();
+        let edges = graph.take_edges();
+
+        let mut graph_converted = Graph {
+            dag: Arc::new(Dag::with_capacity(nodes.len(), edges.len())),
+            versions: Arc::new(collections::HashMap::with_capacity(nodes.len())),
+            metadata_index: Default::default(),
+        };
 
         // Convert nodes
-        for node in graph.take_nodes().into_iter() {
-            graph_converted
-                .dag
-                .add_node(Release::Concrete(ConcreteRelease {
-                    version: node.version,
-                    payload: node.payload,
-                    metadata: node.metadata.into_iter().collect(),
-                }));
+        for node in nodes.into_iter() {
+            graph_converted.insert_node(Release::Concrete(ConcreteRelease {
+                version: node.version,
+                payload: node.payload,
+                metadata: node.metadata.into_iter().collect(),
+            }));
         }
 
-        // Convert edges
-        for edge in graph.take_edges().into_iter() {
-            graph_converted
-                .dag
-                .add_edge(
+        // Convert edges, checking for cycles only once
+        graph_converted
+            .dag_mut()
+            .add_edges(edges.into_iter().map(|edge| {
+                (
                     daggy::NodeIndex::from(edge.from as u32),
                     daggy::NodeIndex::from(edge.to as u32),
                     Empty {},
                 )
-                .expect("add_edge");
-        }
+            }))
+            .expect("add_edges");
 
         graph_converted
     }
 }
 
+/// Moves the release content into the plugin interface graph.
 impl From<Graph> for plugins::interface::Graph {
-    fn from(graph: Graph) -> Self {
+    fn from(mut graph: Graph) -> Self {
         use crate::Release::{Abstract, Concrete};
-        use daggy::petgraph::visit::IntoNeighborsDirected;
-        use daggy::petgraph::Direction;
-
-        let mut nodes_converted: Vec<plugins::interface::Graph_Node> =
-            std::vec::Vec::with_capacity(graph.dag.node_count());
-        let mut edges_converted: Vec<plugins::interface::Graph_Edge> =
-            std::vec::Vec::with_capacity(graph.dag.edge_count());
-
-        for node_reference in graph.dag.node_references() {
-            let node_index = node_reference.0;
-            let release = node_reference.1;
-
-            // Convert and push node
-            let mut node_converted = plugins::interface::Graph_Node::new();
-            match release {
-                Concrete(concrete_release) => {
-                    // TODO(steveeJ): avoid cloning all release content
-                    node_converted.set_version(concrete_release.version.clone());
-                    node_converted
-                        .set_metadata(concrete_release.metadata.clone().into_iter().collect());
-                    node_converted.set_payload(concrete_release.payload.clone());
+
+        let (nodes, edges) = graph.take_dag().into_graph().into_nodes_edges();
+
+        let nodes_converted: Vec<plugins::interface::Graph_Node> = nodes
+            .into_iter()
+            .map(|node| {
+                let mut node_converted = plugins::interface::Graph_Node::new();
+                match node.weight {
+                    Concrete(concrete_release) => {
+                        node_converted.set_version(concrete_release.version);
+                        node_converted
+                            .set_metadata(concrete_release.metadata.into_iter().collect());
+                        node_converted.set_payload(concrete_release.payload);
+                    }
+                    Abstract(_) => panic!("found Abstract release type"),
                 }
-                Abstract(_) => panic!("found Abstract release type"),
-            }
-            nodes_converted.push(node_converted);
+                node_converted
+            })
+            .collect();
 
-            // find neighbors and push edges
-            for neighbor in graph
-                .dag
-                .neighbors_directed(node_index, Direction::Outgoing)
-            {
+        let edges_converted: Vec<plugins::interface::Graph_Edge> = edges
+            .into_iter()
+            .map(|edge| {
                 let mut edge_converted = plugins::interface::Graph_Edge::new();
-                edge_converted.set_from(node_index.index() as u64);
-                edge_converted.set_to(neighbor.index() as u64);
-                edges_converted.push(edge_converted);
-            }
-        }
+                edge_converted.set_from(edge.source().index() as u64);
+                edge_converted.set_to(edge.target().index() as u64);
+                edge_converted
+            })
+            .collect();
 
         let mut graph_converted = plugins::interface::Graph::new();
         graph_converted.set_nodes(nodes_converted.into());
@@ -755,24 +1409,24 @@ pub mod testing {
 
     pub fn generate_graph() -> Graph {
         let mut graph = Graph::default();
-        let v1 = graph.dag.add_node(Release::Concrete(ConcreteRelease {
+        let v1 = graph.insert_node(Release::Concrete(ConcreteRelease {
             version: String::from("1.0.0"),
             payload: String::from("image/1.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         }));
-        let v2 = graph.dag.add_node(Release::Concrete(ConcreteRelease {
+        let v2 = graph.insert_node(Release::Concrete(ConcreteRelease {
             version: String::from("2.0.0"),
             payload: String::from("image/2.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         }));
-        let v3 = graph.dag.add_node(Release::Concrete(ConcreteRelease {
+        let v3 = graph.insert_node(Release::Concrete(ConcreteRelease {
             version: String::from("3.0.0"),
             payload: String::from("image/3.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         }));
-        graph.dag.add_edge(v1, v2, Empty {}).unwrap();
-        graph.dag.add_edge(v2, v3, Empty {}).unwrap();
-        graph.dag.add_edge(v1, v3, Empty {}).unwrap();
+        graph.dag_mut().add_edge(v1, v2, Empty {}).unwrap();
+        graph.dag_mut().add_edge(v2, v3, Empty {}).unwrap();
+        graph.dag_mut().add_edge(v1, v3, Empty {}).unwrap();
 
         graph
     }
@@ -856,26 +1510,31 @@ pub mod testing {
                     let release = Release::Concrete(ConcreteRelease {
                         version,
                         payload,
-                        metadata,
+                        metadata: metadata.into_iter().collect(),
                     });
-                    graph.dag.add_node(release)
+                    graph.insert_node(release)
                 })
                 .collect();
 
             assert_eq!(nodes.len() as u64, graph.releases_count());
 
             if let Some(edges) = self.edges {
-                for (key, value) in &edges {
-                    let one = nodes[*key];
-                    let two = nodes[*value];
-                    graph.dag.add_edge(one, two, Empty {}).unwrap();
-                }
+                // Adding the edges at once checks for cycles only once, which
+                // keeps building large graphs cheap.
+                graph
+                    .dag_mut()
+                    .add_edges(
+                        edges
+                            .iter()
+                            .map(|(key, value)| (nodes[*key], nodes[*value], Empty {})),
+                    )
+                    .unwrap();
                 assert_eq!(edges.len(), graph.dag.edge_count());
             } else {
                 for i in 0..(nodes.len() - 1) {
                     let one = nodes[i];
                     let two = nodes[i + 1];
-                    graph.dag.add_edge(one, two, Empty {}).unwrap();
+                    graph.dag_mut().add_edge(one, two, Empty {}).unwrap();
                 }
             };
 
@@ -1096,33 +1755,33 @@ mod tests {
     fn test_graph_eq_false_for_unequal_graphs() {
         let graph1 = {
             let mut graph = Graph::default();
-            let v1 = graph.dag.add_node(Release::Concrete(ConcreteRelease {
+            let v1 = graph.insert_node(Release::Concrete(ConcreteRelease {
                 version: String::from("1.0.0"),
                 payload: String::from("image/1.0.0"),
-                metadata: MapImpl::new(),
+                metadata: MetadataMap::new(),
             }));
-            let v2 = graph.dag.add_node(Release::Concrete(ConcreteRelease {
+            let v2 = graph.insert_node(Release::Concrete(ConcreteRelease {
                 version: String::from("2.0.0"),
                 payload: String::from("image/2.0.0"),
-                metadata: MapImpl::new(),
+                metadata: MetadataMap::new(),
             }));
-            graph.dag.add_edge(v1, v2, Empty {}).unwrap();
+            graph.dag_mut().add_edge(v1, v2, Empty {}).unwrap();
 
             graph
         };
         let graph2 = {
             let mut graph = Graph::default();
-            let v3 = graph.dag.add_node(Release::Concrete(ConcreteRelease {
+            let v3 = graph.insert_node(Release::Concrete(ConcreteRelease {
                 version: String::from("3.0.0"),
                 payload: String::from("image/3.0.0"),
-                metadata: MapImpl::new(),
+                metadata: MetadataMap::new(),
             }));
-            let v2 = graph.dag.add_node(Release::Concrete(ConcreteRelease {
+            let v2 = graph.insert_node(Release::Concrete(ConcreteRelease {
                 version: String::from("2.0.0"),
                 payload: String::from("image/2.0.0"),
-                metadata: MapImpl::new(),
+                metadata: MetadataMap::new(),
             }));
-            graph.dag.add_edge(v2, v3, Empty {}).unwrap();
+            graph.dag_mut().add_edge(v2, v3, Empty {}).unwrap();
 
             graph
         };
@@ -1139,39 +1798,39 @@ mod tests {
         let r1 = Release::Concrete(ConcreteRelease {
             version: String::from("1.0.0"),
             payload: String::from("image/1.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         });
         let r2 = Release::Concrete(ConcreteRelease {
             version: String::from("2.0.0"),
             payload: String::from("image/2.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         });
 
         let r3 = Release::Concrete(ConcreteRelease {
             version: String::from("3.0.0"),
             payload: String::from("image/3.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         });
 
         let graph1 = {
             let mut graph = Graph::default();
-            let v1 = graph.dag.add_node(r1.clone());
-            let v2 = graph.dag.add_node(r2.clone());
-            let v3 = graph.dag.add_node(r3.clone());
-            graph.dag.add_edge(v1, v2, Empty {}).unwrap();
-            graph.dag.add_edge(v1, v3, Empty {}).unwrap();
-            graph.dag.add_edge(v2, v3, Empty {}).unwrap();
+            let v1 = graph.insert_node(r1.clone());
+            let v2 = graph.insert_node(r2.clone());
+            let v3 = graph.insert_node(r3.clone());
+            graph.dag_mut().add_edge(v1, v2, Empty {}).unwrap();
+            graph.dag_mut().add_edge(v1, v3, Empty {}).unwrap();
+            graph.dag_mut().add_edge(v2, v3, Empty {}).unwrap();
 
             graph
         };
         let graph2 = {
             let mut graph = Graph::default();
-            let v3 = graph.dag.add_node(r3.clone());
-            let v2 = graph.dag.add_node(r2.clone());
-            let v1 = graph.dag.add_node(r1.clone());
-            graph.dag.add_edge(v2, v3, Empty {}).unwrap();
-            graph.dag.add_edge(v1, v2, Empty {}).unwrap();
-            graph.dag.add_edge(v1, v3, Empty {}).unwrap();
+            let v3 = graph.insert_node(r3.clone());
+            let v2 = graph.insert_node(r2.clone());
+            let v1 = graph.insert_node(r1.clone());
+            graph.dag_mut().add_edge(v2, v3, Empty {}).unwrap();
+            graph.dag_mut().add_edge(v1, v2, Empty {}).unwrap();
+            graph.dag_mut().add_edge(v1, v3, Empty {}).unwrap();
 
             graph
         };
@@ -1183,34 +1842,34 @@ mod tests {
         let r1 = Release::Concrete(ConcreteRelease {
             version: String::from("1.0.0"),
             payload: String::from("image/1.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         });
         let r2 = Release::Concrete(ConcreteRelease {
             version: String::from("2.0.0"),
             payload: String::from("image/2.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         });
 
         let r3 = Release::Concrete(ConcreteRelease {
             version: String::from("3.0.0"),
             payload: String::from("image/3.0.0"),
-            metadata: MapImpl::new(),
+            metadata: MetadataMap::new(),
         });
 
         let graph1 = {
             let mut graph = Graph::default();
-            let v1 = graph.dag.add_node(r1.clone());
-            let v2 = graph.dag.add_node(r2.clone());
-            graph.dag.add_edge(v1, v2, Empty {}).unwrap();
+            let v1 = graph.insert_node(r1.clone());
+            let v2 = graph.insert_node(r2.clone());
+            graph.dag_mut().add_edge(v1, v2, Empty {}).unwrap();
 
             graph
         };
         let graph2 = {
             let mut graph = Graph::default();
-            let v1 = graph.dag.add_node(r1.clone());
-            let v2 = graph.dag.add_node(r2.clone());
-            let _ = graph.dag.add_node(r3.clone());
-            graph.dag.add_edge(v1, v2, Empty {}).unwrap();
+            let v1 = graph.insert_node(r1.clone());
+            let v2 = graph.insert_node(r2.clone());
+            let _ = graph.insert_node(r3.clone());
+            graph.dag_mut().add_edge(v1, v2, Empty {}).unwrap();
 
             graph
         };
@@ -1225,6 +1884,30 @@ mod tests {
         assert_eq!(generate_graph(), graph_native_converted);
     }
 
+    #[test]
+    fn roundtrip_conversion_with_metadata_via_plugin_interface() {
+        let metadata: TestMetadata = (0..3)
+            .map(|i| {
+                let metadata = [("key".to_string(), format!("value-{}", i))]
+                    .iter()
+                    .cloned()
+                    .collect();
+                (i, metadata)
+            })
+            .collect();
+        let graph = generate_custom_graph("image", metadata, Some(vec![(0, 1), (1, 2), (0, 2)]));
+
+        let graph_plugin_interface: plugins::interface::Graph = graph.clone().into();
+        assert_eq!(graph_plugin_interface.get_edges().len(), 3);
+        assert_eq!(
+            graph_plugin_interface.get_nodes()[1].get_metadata()["key"],
+            "value-1"
+        );
+
+        let graph_native_converted: Graph = graph_plugin_interface.into();
+        assert_eq!(graph, graph_native_converted);
+    }
+
     fn get_test_metadata_fn_mut(key_prefix: &str, key_suffix: &str) -> TestMetadata {
         vec![
             (
@@ -1405,4 +2088,271 @@ mod tests {
 
         Ok(())
     }
+
+    #[test]
+    fn find_by_version_survives_node_removal() -> Fallible<()> {
+        let n = 6;
+        let mut graph = generate_custom_graph(
+            "image",
+            (0..n).map(|i| (i, Default::default())).collect(),
+            None,
+        );
+
+        let to_remove = ["0.0.0", "2.0.0"]
+            .iter()
+            .map(|version| {
+                graph
+                    .find_by_version(version)
+                    .ok_or_else(|| format_err!("couldn't find version {}", version))
+            })
+            .collect::<Fallible<Vec<ReleaseId>>>()?;
+        assert_eq!(graph.remove_releases(to_remove), 2);
+
+        assert_eq!(graph.find_by_version("0.0.0"), None);
+        assert_eq!(graph.find_by_version("2.0.0"), None);
+        for version in &["1.0.0", "3.0.0", "4.0.0", "5.0.0"] {
+            let id = graph
+                .find_by_version(version)
+                .ok_or_else(|| format_err!("couldn't find version {}", version))?;
+            assert_eq!(graph.find_by_releaseid(&id)?.version(), *version);
+        }
+
+        Ok(())
+    }
+
+    #[test]
+    fn release_mask_operations() {
+        let mut mask = ReleaseMask::full(70);
+        assert_eq!(mask.count(), 70);
+        assert!(mask.contains(69));
+        assert!(!mask.contains(70));
+
+        mask.remove(0);
+        mask.remove(64);
+        let mut other = ReleaseMask::empty(70);
+        for i in &[0, 1, 64, 65, 69] {
+            other.insert(*i);
+        }
+        mask.intersect_with(&other);
+
+        assert_eq!(mask.iter().collect::<Vec<_>>(), vec![1, 65, 69]);
+        assert_eq!(mask.count(), 3);
+
+        mask.insert(130);
+        assert!(mask.contains(130));
+        assert_eq!(mask.count(), 4);
+    }
+
+    #[test]
+    fn graph_view_only_contains_selected_releases() -> Fallible<()> {
+        let graph = generate_custom_graph(
+            "image",
+            (0..5).map(|i| (i, Default::default())).collect(),
+            Some(vec![(0, 1), (1, 2), (0, 3), (3, 4), (2, 4)]),
+        );
+
+        let view = graph
+            .view()
+            .retain(|release| release.version() != "1.0.0" && release.version() != "3.0.0");
+        assert_eq!(view.releases_count(), 3);
+
+        let expected = generate_custom_graph(
+            "image",
+            [0, 2, 4].iter().map(|i| (*i, Default::default())).collect(),
+            Some(vec![(1, 2)]),
+        );
+        let materialized = view.to_graph();
+        assert_eq!(expected, materialized);
+        assert_eq!(
+            serde_json::to_string(&view)?,
+            serde_json::to_string(&materialized)?
+        );
+
+        let mask = view.into_mask();
+        let filtered = graph.filter(&mask);
+        assert_eq!(expected, filtered);
+        for version in &["0.0.0", "2.0.0", "4.0.0"] {
+            let id = filtered
+                .find_by_version(version)
+                .ok_or_else(|| format_err!("couldn't find version {}", version))?;
+            assert_eq!(filtered.find_by_releaseid(&id)?.version(), *version);
+        }
+        assert_eq!(filtered.find_by_version("1.0.0"), None);
+
+        Ok(())
+    }
+
+    #[test]
+    fn metadata_index_follows_graph_changes() -> Fallible<()> {
+        let key = "release.channels";
+        let metadata: TestMetadata = vec![
+            (0, [(key, "a")]),
+            (1, [(key, "a, b")]),
+            (2, [(key, "b")]),
+            (3, [(key, "a,b")]),
+        ]
+        .into_iter()
+        .map(|(i, pairs)| {
+            (
+                i,
+                pairs
+                    .iter()
+                    .map(|(k, v)| (k.to_string(), v.to_string()))
+                    .collect(),
+            )
+        })
+        .collect();
+        let mut graph = generate_custom_graph("image", metadata, None);
+
+        let versions = |graph: &Graph, mask: &ReleaseMask| -> Vec<String> {
+            graph
+                .view()
+                .intersect(mask)
+                .releases()
+                .map(|(_, release)| release.version().to_string())
+                .collect()
+        };
+
+        let a = graph.find_by_metadata_value(key, "a");
+        assert_eq!(versions(&graph, &a), vec!["0.0.0", "1.0.0", "3.0.0"]);
+        assert_eq!(graph.find_by_metadata_value(key, "c").count(), 0);
+
+        // filtering carries the shared index over to the smaller graph
+        let clone = graph.clone();
+        let filtered = clone.filter(&a);
+        let b = filtered.find_by_metadata_value(key, "b");
+        assert_eq!(versions(&filtered, &b), vec!["1.0.0", "3.0.0"]);
+        assert!(
+            filtered.metadata_index.get(key).is_none(),
+            "only the requested value is taken from the shared index"
+        );
+
+        // filtering again keeps the shared index of the origin
+        let refiltered = filtered.filter(&b);
+        let a_and_b = refiltered.find_by_metadata_value(key, "a");
+        assert_eq!(versions(&refiltered, &a_and_b), vec!["1.0.0", "3.0.0"]);
+
+        // modifications invalidate the index
+        let id = graph
+            .find_by_version("2.0.0")
+            .ok_or_else(|| format_err!("couldn't find version 2.0.0"))?;
+        graph
+            .get_metadata_as_ref_mut(&id)?
+            .insert(key.to_string(), "a".to_string());
+        let a = graph.find_by_metadata_value(key, "a");
+        assert_eq!(versions(&graph, &a).len(), 4);
+
+        Ok(())
+    }
+
+    #[test]
+    fn retain_releases_maps_release_ids() -> Fallible<()> {
+        let mut graph = generate_custom_graph(
+            "image",
+            (0..4).map(|i| (i, Default::default())).collect(),
+            None,
+        );
+        let ids = ["0.0.0", "1.0.0", "2.0.0", "3.0.0"]
+            .iter()
+            .map(|version| {
+                graph
+                    .find_by_version(version)
+                    .ok_or_else(|| format_err!("couldn't find version {}", version))
+            })
+            .collect::<Fallible<Vec<ReleaseId>>>()?;
+
+        let keep = graph
+            .view()
+            .retain(|release| release.version() != "1.0.0")
+            .into_mask();
+        let mapping = graph.retain_releases(&keep);
+
+        assert_eq!(graph.releases_count(), 3);
+        assert_eq!(mapping.get(&ids[1]), None);
+        for (id, version) in ids.iter().zip(&["0.0.0", "1.0.0", "2.0.0", "3.0.0"]) {
+            if let Some(new_id) = mapping.get(id) {
+                assert_eq!(graph.find_by_releaseid(&new_id)?.version(), *version);
+                assert_eq!(graph.find_by_version(version), Some(new_id));
+            }
+        }
+        assert_eq!(graph.get_edges(true)?.len(), 1);
+
+        Ok(())
+    }
+
+    #[test]
+    fn clones_share_releases_until_modified() -> Fallible<()> {
+        let graph = generate_custom_graph(
+            "image",
+            (0..4).map(|i| (i, Default::default())).collect(),
+            Some(vec![(0, 1), (1, 2), (2, 3)]),
+        );
+        let mut filtered = graph.clone();
+        assert!(Arc::ptr_eq(&graph.dag, &filtered.dag));
+
+        let keep = filtered
+            .view()
+            .retain(|release| release.version() != "1.0.0")
+            .into_mask();
+        filtered.retain_releases(&keep);
+        assert_eq!(filtered.releases_count(), 3);
+        assert_eq!(filtered.get_edges(true)?.len(), 1);
+
+        let mut extended = graph.clone();
+        extended.add_release(Release::Abstract(AbstractRelease {
+            version: "4.0.0".to_string(),
+        }))?;
+        assert!(!Arc::ptr_eq(&graph.dag, &extended.dag));
+        assert_eq!(extended.releases_count(), 5);
+
+        assert_eq!(graph.releases_count(), 4);
+        assert_eq!(graph.get_edges(true)?.len(), 3);
+        assert_eq!(graph.find_by_version("4.0.0"), None);
+
+        Ok(())
+    }
+
+    #[test]
+    fn retain_edges_keeps_release_ids() -> Fallible<()> {
+        let mut graph = generate_custom_graph(
+            "image",
+            (0..4).map(|i| (i, Default::default())).collect(),
+            Some(vec![(0, 1), (0, 2), (1, 2), (2, 3)]),
+        );
+        let from = graph
+            .find_by_version("0.0.0")
+            .ok_or_else(|| format_err!("couldn't find version 0.0.0"))?;
+
+        assert_eq!(graph.retain_edges(|source, _| source != &from), 2);
+
+        let expected = generate_custom_graph(
+            "image",
+            (0..4).map(|i| (i, Default::default())).collect(),
+            Some(vec![(1, 2), (2, 3)]),
+        );
+        assert_eq!(expected, graph);
+        assert_eq!(graph.find_by_version("0.0.0"), Some(from));
+
+        Ok(())
+    }
+
+    #[test]
+    fn find_by_version_follows_version_rewrites() -> Fallible<()> {
+        let mut graph = generate_graph();
+
+        graph.iter_releases_mut(|release| {
+            if let Release::Concrete(release) = release {
+                release.version = format!("{}+amd64", release.version);
+            }
+            Ok(())
+        })?;
+
+        assert_eq!(graph.find_by_version("1.0.0"), None);
+        let id = graph
+            .find_by_version("1.0.0+amd64")
+            .ok_or_else(|| format_err!("couldn't find version 1.0.0+amd64"))?;
+        assert_eq!(graph.find_by_releaseid(&id)?.version(), "1.0.0+amd64");
+
+        Ok(())
+    }
 }
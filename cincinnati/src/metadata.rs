@@ -0,0 +1,623 @@
+//! Compact storage for release metadata.
+//!
+//! The releases of a graph share a small set of metadata keys, such as
+//! `io.openshift.upgrades.graph.release.channels`. Keys are therefore
+//! interned, so that every distinct key is allocated once per process and
+//! releases only hold a reference to it. The entries of a release are kept in
+//! a vector sorted by key, which is smaller than a map for the handful of
+//! entries a release carries and iterates in a stable order.
+//!
+//! `MetadataMap` serializes to and from the same JSON object as a map of
+//! strings.
+
+use lazy_static::lazy_static;
+use serde::de::{MapAccess, Visitor};
+use serde::ser::SerializeMap;
+use serde::{Deserialize, Deserializer, Serialize, Serializer};
+use std::borrow::Borrow;
+use std::cmp::Ordering;
+use std::collections::HashSet;
+use std::fmt;
+use std::hash::{Hash, Hasher};
+use std::iter::FromIterator;
+use std::ops::{Deref, Index};
+use std::sync::{Arc, RwLock};
+
+/// Number of interned keys below which unused keys are not pruned.
+const MIN_PRUNE_KEYS: usize = 1024;
+
+/// Keys under the default prefix which nearly every release carries.
+static WELL_KNOWN_KEYS: &[&str] = &[
+    "io.openshift.upgrades.graph.previous.add",
+    "io.openshift.upgrades.graph.previous.remove",
+    "io.openshift.upgrades.graph.previous.remove_regex",
+    "io.openshift.upgrades.graph.next.add",
+    "io.openshift.upgrades.graph.next.remove",
+    "io.openshift.upgrades.graph.release.arch",
+    "io.openshift.upgrades.graph.release.channels",
+    "io.openshift.upgrades.graph.release.manifestref",
+    "io.openshift.upgrades.graph.release.remove",
+];
+
+/// Set of interned keys, pruned of keys which are no longer used.
+struct Interner {
+    keys: HashSet<Arc<str>>,
+    prune_at: usize,
+}
+
+lazy_static! {
+    /// Well-known keys, interned once and never pruned, so that looking them up
+    /// doesn't lock the interner.
+    static ref PINNED_KEYS: HashSet<Arc<str>> =
+        WELL_KNOWN_KEYS.iter().map(|key| Arc::from(*key)).collect();
+    static ref KEYS: RwLock<Interner> = RwLock::new(Interner {
+        keys: HashSet::new(),
+        prune_at: MIN_PRUNE_KEYS,
+    });
+}
+
+/// An interned metadata key.
+#[derive(Clone)]
+pub struct MetadataKey(Arc<str>);
+
+impl MetadataKey {
+    /// Return the interned key for the given string.
+    pub fn new(key: &str) -> Self {
+        if let Some(pinned) = PINNED_KEYS.get(key) {
+            return Self(pinned.clone());
+        }
+
+        if let Some(interned) = KEYS.read().unwrap_or_else(|e| e.into_inner()).keys.get(key) {
+            return Self(interned.clone());
+        }
+
+        let mut interner = KEYS.write().unwrap_or_else(|e| e.into_inner());
+        // Another thread may have interned the key since the lookup above.
+        if let Some(interned) = interner.keys.get(key) {
+            return Self(interned.clone());
+        }
+
+        // Drop the keys which are only referenced by the interner.
+        if interner.keys.len() >= interner.prune_at {
+            interner.keys.retain(|key| Arc::strong_count(key) > 1);
+            interner.prune_at = MIN_PRUNE_KEYS.max(interner.keys.len() * 2);
+        }
+
+        let interned: Arc<str> = Arc::from(key);
+        interner.keys.insert(interned.clone());
+        Self(interned)
+    }
+
+    /// Return the key as a string slice.
+    pub fn as_str(&self) -> &str {
+        &self.0
+    }
+}
+
+impl Deref for MetadataKey {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl AsRef<str> for MetadataKey {
+    fn as_ref(&self) -> &str {
+        &self.0
+    }
+}
+
+impl Borrow<str> for MetadataKey {
+    fn borrow(&self) -> &str {
+        &self.0
+    }
+}
+
+impl PartialEq for MetadataKey {
+    fn eq(&self, other: &Self) -> bool {
+        Arc::ptr_eq(&self.0, &other.0) || self.0 == other.0
+    }
+}
+
+impl Eq for MetadataKey {}
+
+impl PartialEq<str> for MetadataKey {
+    fn eq(&self, other: &str) -> bool {
+        &*self.0 == other
+    }
+}
+
+impl PartialOrd for MetadataKey {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl Ord for MetadataKey {
+    fn cmp(&self, other: &Self) -> Ordering {
+        self.0.cmp(&other.0)
+    }
+}
+
+impl Hash for MetadataKey {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.0.hash(state)
+    }
+}
+
+impl fmt::Debug for MetadataKey {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        fmt::Debug::fmt(&*self.0, f)
+    }
+}
+
+impl fmt::Display for MetadataKey {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        fmt::Display::fmt(&*self.0, f)
+    }
+}
+
+impl From<&str> for MetadataKey {
+    fn from(key: &str) -> Self {
+        Self::new(key)
+    }
+}
+
+impl From<&String> for MetadataKey {
+    fn from(key: &String) -> Self {
+        Self::new(key)
+    }
+}
+
+impl From<String> for MetadataKey {
+    fn from(key: String) -> Self {
+        Self::new(&key)
+    }
+}
+
+impl From<&MetadataKey> for MetadataKey {
+    fn from(key: &MetadataKey) -> Self {
+        key.clone()
+    }
+}
+
+impl Serialize for MetadataKey {
+    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+    where
+        S: Serializer,
+    {
+        serializer.serialize_str(&self.0)
+    }
+}
+
+impl<'de> Deserialize<'de> for MetadataKey {
+    fn deserialize<D>(deserializer: D) -> Result<Self, D::Error>
+    where
+        D: Deserializer<'de>,
+    {
+        struct KeyVisitor;
+
+        impl<'de> Visitor<'de> for KeyVisitor {
+            type Value = MetadataKey;
+
+            fn expecting(&self, formatter: &mut fmt::Formatter) -> fmt::Result {
+                formatter.write_str("a string")
+            }
+
+            // Known keys are looked up without allocating.
+            fn visit_str<E>(self, key: &str) -> Result<MetadataKey, E>
+            where
+                E: serde::de::Error,
+            {
+                Ok(MetadataKey::new(key))
+            }
+        }
+
+        deserializer.deserialize_str(KeyVisitor)
+    }
+}
+
+/// Metadata of a release, as entries sorted by their interned key.
+#[derive(Clone, Default, PartialEq, Eq, Hash)]
+pub struct MetadataMap(Vec<(MetadataKey, String)>);
+
+impl MetadataMap {
+    /// Create an empty map.
+    pub fn new() -> Self {
+        Self(Vec::new())
+    }
+
+    /// Create an empty map with space for the given number of entries.
+    pub fn with_capacity(capacity: usize) -> Self {
+        Self(Vec::with_capacity(capacity))
+    }
+
+    /// Returns the number of entries.
+    pub fn len(&self) -> usize {
+        self.0.len()
+    }
+
+    /// Returns true if there are no entries.
+    pub fn is_empty(&self) -> bool {
+        self.0.is_empty()
+    }
+
+    fn position(&self, key: &str) -> Result<usize, usize> {
+        self.0.binary_search_by(|(k, _)| k.as_str().cmp(key))
+    }
+
+    /// Returns the value for the given key.
+    pub fn get(&self, key: &str) -> Option<&String> {
+        self.position(key).ok().map(|index| &self.0[index].1)
+    }
+
+    /// Returns the mutable value for the given key.
+    pub fn get_mut(&mut self, key: &str) -> Option<&mut String> {
+        match self.position(key) {
+            Ok(index) => Some(&mut self.0[index].1),
+            Err(_) => None,
+        }
+    }
+
+    /// Returns true if there's a value for the given key.
+    pub fn contains_key(&self, key: &str) -> bool {
+        self.position(key).is_ok()
+    }
+
+    /// Insert a value for the given key, returning the previous one.
+    ///
+    /// The key is only interned if it's not present yet.
+    pub fn insert<K>(&mut self, key: K, value: String) -> Option<String>
+    where
+        K: AsRef<str> + Into<MetadataKey>,
+    {
+        match self.position(key.as_ref()) {
+            Ok(index) => Some(std::mem::replace(&mut self.0[index].1, value)),
+            Err(index) => {
+                self.0.insert(index, (key.into(), value));
+                None
+            }
+        }
+    }
+
+    /// Remove the value for the given key.
+    pub fn remove(&mut self, key: &str) -> Option<String> {
+        match self.position(key) {
+            Ok(index) => Some(self.0.remove(index).1),
+            Err(_) => None,
+        }
+    }
+
+    /// Get the entry for the given key for in-place manipulation.
+    pub fn entry<K>(&mut self, key: K) -> Entry<'_, K>
+    where
+        K: AsRef<str> + Into<MetadataKey>,
+    {
+        let position = self.position(key.as_ref());
+        Entry {
+            map: self,
+            key,
+            position,
+        }
+    }
+
+    /// Only keep the entries for which the predicate returns true.
+    pub fn retain<F>(&mut self, mut f: F)
+    where
+        F: FnMut(&MetadataKey, &mut String) -> bool,
+    {
+        // `Vec::retain` doesn't hand out mutable references.
+        self.0 = std::mem::take(&mut self.0)
+            .into_iter()
+            .filter_map(|(key, mut value)| {
+                if f(&key, &mut value) {
+                    Some((key, value))
+                } else {
+                    None
+                }
+            })
+            .collect();
+    }
+
+    /// Remove all entries.
+    pub fn clear(&mut self) {
+        self.0.clear()
+    }
+
+    /// Iterate over the entries in key order.
+    pub fn iter(&self) -> Iter<'_> {
+        Iter(self.0.iter())
+    }
+
+    /// Iterate over the keys in order.
+    pub fn keys(&self) -> impl Iterator<Item = &MetadataKey> {
+        self.0.iter().map(|(key, _)| key)
+    }
+
+    /// Iterate over the values in key order.
+    pub fn values(&self) -> impl Iterator<Item = &String> {
+        self.0.iter().map(|(_, value)| value)
+    }
+
+    /// Sort the entries and drop all but the last value of duplicate keys.
+    fn normalize(&mut self) {
+        // The sort is stable, so the last value of a key is the most recent one.
+        self.0.sort_by(|a, b| a.0.cmp(&b.0));
+        let mut entries: Vec<(MetadataKey, String)> = Vec::with_capacity(self.0.len());
+        for (key, value) in self.0.drain(..) {
+            match entries.last_mut() {
+                Some(last) if last.0 == key => last.1 = value,
+                _ => entries.push((key, value)),
+            }
+        }
+        self.0 = entries;
+    }
+}
+
+/// A view into a single entry of a `MetadataMap`.
+pub struct Entry<'a, K> {
+    map: &'a mut MetadataMap,
+    key: K,
+    position: Result<usize, usize>,
+}
+
+impl<'a, K> Entry<'a, K>
+where
+    K: AsRef<str> + Into<MetadataKey>,
+{
+    /// Modify the value in place if it's present.
+    pub fn and_modify<F>(self, f: F) -> Self
+    where
+        F: FnOnce(&mut String),
+    {
+        if let Ok(index) = self.position {
+            f(&mut self.map.0[index].1);
+        }
+        self
+    }
+
+    /// Return the value, inserting the given default if it isn't present.
+    pub fn or_insert(self, default: String) -> &'a mut String {
+        self.or_insert_with(|| default)
+    }
+
+    /// Return the value, inserting the result of `default` if it isn't present.
+    pub fn or_insert_with<F>(self, default: F) -> &'a mut String
+    where
+        F: FnOnce() -> String,
+    {
+        let index = match self.position {
+            Ok(index) => index,
+            Err(index) => {
+                self.map.0.insert(index, (self.key.into(), default()));
+                index
+            }
+        };
+        &mut self.map.0[index].1
+    }
+
+    /// Return the value, inserting an empty string if it isn't present.
+    pub fn or_default(self) -> &'a mut String {
+        self.or_insert_with(String::new)
+    }
+}
+
+/// Iterator over the entries of a `MetadataMap`.
+pub struct Iter<'a>(std::slice::Iter<'a, (MetadataKey, String)>);
+
+impl<'a> Iterator for Iter<'a> {
+    type Item = (&'a MetadataKey, &'a String);
+
+    fn next(&mut self) -> Option<Self::Item> {
+        self.0.next().map(|(key, value)| (key, value))
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.0.size_hint()
+    }
+}
+
+impl ExactSizeIterator for Iter<'_> {}
+
+impl<'a> IntoIterator for &'a MetadataMap {
+    type Item = (&'a MetadataKey, &'a String);
+    type IntoIter = Iter<'a>;
+
+    fn into_iter(self) -> Self::IntoIter {
+        self.iter()
+    }
+}
+
+impl IntoIterator for MetadataMap {
+    type Item = (String, String);
+    type IntoIter = std::iter::Map<
+        std::vec::IntoIter<(MetadataKey, String)>,
+        fn((MetadataKey, String)) -> (String, String),
+    >;
+
+    fn into_iter(self) -> Self::IntoIter {
+        fn into_owned((key, value): (MetadataKey, String)) -> (String, String) {
+            (key.to_string(), value)
+        }
+
+        self.0
+            .into_iter()
+            .map(into_owned as fn((MetadataKey, String)) -> (String, String))
+    }
+}
+
+impl<K, V> FromIterator<(K, V)> for MetadataMap
+where
+    K: Into<MetadataKey>,
+    V: Into<String>,
+{
+    fn from_iter<I: IntoIterator<Item = (K, V)>>(iter: I) -> Self {
+        let mut map = Self(
+            iter.into_iter()
+                .map(|(key, value)| (key.into(), value.into()))
+                .collect(),
+        );
+        map.normalize();
+        map
+    }
+}
+
+impl<K, V> Extend<(K, V)> for MetadataMap
+where
+    K: Into<MetadataKey>,
+    V: Into<String>,
+{
+    fn extend<I: IntoIterator<Item = (K, V)>>(&mut self, iter: I) {
+        self.0.extend(
+            iter.into_iter()
+                .map(|(key, value)| (key.into(), value.into())),
+        );
+        self.normalize();
+    }
+}
+
+impl Index<&str> for MetadataMap {
+    type Output = String;
+
+    fn index(&self, key: &str) -> &String {
+        self.get(key)
+            .unwrap_or_else(|| panic!("no metadata entry for key '{}'", key))
+    }
+}
+
+impl fmt::Debug for MetadataMap {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_map().entries(self.iter()).finish()
+    }
+}
+
+impl Serialize for MetadataMap {
+    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+    where
+        S: Serializer,
+    {
+        let mut map = serializer.serialize_map(Some(self.len()))?;
+        for (key, value) in self {
+            map.serialize_entry(key, value)?;
+        }
+        map.end()
+    }
+}
+
+impl<'de> Deserialize<'de> for MetadataMap {
+    fn deserialize<D>(deserializer: D) -> Result<Self, D::Error>
+    where
+        D: Deserializer<'de>,
+    {
+        struct MetadataVisitor;
+
+        impl<'de> Visitor<'de> for MetadataVisitor {
+            type Value = MetadataMap;
+
+            fn expecting(&self, formatter: &mut fmt::Formatter) -> fmt::Result {
+                formatter.write_str("a map of strings")
+            }
+
+            fn visit_map<A>(self, mut access: A) -> Result<MetadataMap, A::Error>
+            where
+                A: MapAccess<'de>,
+            {
+                let mut map = MetadataMap::with_capacity(access.size_hint().unwrap_or(0));
+                while let Some(entry) = access.next_entry()? {
+                    map.0.push(entry);
+                }
+                map.normalize();
+                Ok(map)
+            }
+        }
+
+        deserializer.deserialize_map(MetadataVisitor)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn map_operations() {
+        let mut map: MetadataMap = vec![("b", "1"), ("a", "2"), ("b", "3")]
+            .into_iter()
+            .collect();
+        assert_eq!(map.len(), 2);
+        assert_eq!(map.get("b").map(String::as_str), Some("3"));
+        assert_eq!(
+            map.keys().map(MetadataKey::as_str).collect::<Vec<_>>(),
+            vec!["a", "b"]
+        );
+
+        assert_eq!(map.insert("c", "4".to_string()), None);
+        assert_eq!(
+            map.insert("a".to_string(), "5".to_string()),
+            Some("2".to_string())
+        );
+        assert_eq!(map.remove("b"), Some("3".to_string()));
+        assert!(!map.contains_key("b"));
+
+        map.entry("a")
+            .and_modify(|value| value.push_str(",6"))
+            .or_insert_with(|| unreachable!());
+        map.entry("d").or_default().push('7');
+        assert_eq!(map["a"], "5,6");
+        assert_eq!(map["d"], "7");
+
+        map.retain(|key, _| key.as_str() != "c");
+        assert_eq!(
+            map.into_iter().collect::<Vec<_>>(),
+            vec![
+                ("a".to_string(), "5,6".to_string()),
+                ("d".to_string(), "7".to_string())
+            ]
+        );
+    }
+
+    #[test]
+    fn keys_are_interned() {
+        let a: MetadataMap = vec![("io.openshift.upgrades.graph.release.channels", "a")]
+            .into_iter()
+            .collect();
+        let b: MetadataMap =
+            serde_json::from_str(r#"{"io.openshift.upgrades.graph.release.channels":"b"}"#)
+                .unwrap();
+
+        let (key_a, key_b) = (a.keys().next().unwrap(), b.keys().next().unwrap());
+        assert!(Arc::ptr_eq(&key_a.0, &key_b.0));
+        assert!(Arc::ptr_eq(
+            &key_a.0,
+            PINNED_KEYS
+                .get("io.openshift.upgrades.graph.release.channels")
+                .unwrap()
+        ));
+    }
+
+    #[test]
+    fn keys_are_interned_across_threads() {
+        let keys: Vec<MetadataKey> = (0..8)
+            .map(|_| std::thread::spawn(|| MetadataKey::new("keys_are_interned_across_threads")))
+            .collect::<Vec<_>>()
+            .into_iter()
+            .map(|thread| thread.join().unwrap())
+            .collect();
+
+        assert!(keys.iter().all(|key| Arc::ptr_eq(&key.0, &keys[0].0)));
+    }
+
+    #[test]
+    fn serde_matches_string_map() {
+        let json = r#"{"b":"x","a":"y,z"}"#;
+        let map: MetadataMap = serde_json::from_str(json).unwrap();
+        let reference: std::collections::BTreeMap<String, String> =
+            serde_json::from_str(json).unwrap();
+
+        assert_eq!(
+            serde_json::to_string(&map).unwrap(),
+            serde_json::to_string(&reference).unwrap()
+        );
+    }
+}
@@ -0,0 +1,262 @@
+//! Upgrade paths between releases.
+//!
+//! A `PathIndex` answers which releases can be updated to from a given one,
+//! and which releases lie on a shortest path to a target release, without
+//! handing out the whole graph. The successors of all releases are stored in
+//! a compact adjacency list, and every release is assigned its position in a
+//! topological order. As the position strictly increases along every edge, a
+//! search never needs to explore releases positioned after its target.
+
+use crate::{Graph, ReleaseId, ReleaseMask};
+use std::collections::VecDeque;
+
+/// Marks releases which have not been reached by a search.
+const UNVISITED: u32 = u32::MAX;
+
+/// Graph along with an index for upgrade path queries.
+#[derive(Debug)]
+pub struct PathIndex {
+    graph: Graph,
+
+    /// The direct successors of release `i` are `successors[offsets[i]..offsets[i + 1]]`.
+    offsets: Vec<u32>,
+    successors: Vec<u32>,
+
+    /// Position of every release in a topological order of the graph.
+    ranks: Vec<u32>,
+}
+
+impl PathIndex {
+    /// Index the given graph.
+    pub fn new(graph: Graph) -> Self {
+        let count = graph.dag.node_count();
+        let edges = graph.dag.raw_edges();
+
+        let mut offsets = vec![0u32; count + 1];
+        for edge in edges {
+            offsets[edge.source().index() + 1] += 1;
+        }
+        for i in 0..count {
+            offsets[i + 1] += offsets[i];
+        }
+
+        let mut successors = vec![0u32; edges.len()];
+        let mut slots = offsets.clone();
+        for edge in edges {
+            let slot = &mut slots[edge.source().index()];
+            successors[*slot as usize] = edge.target().index() as u32;
+            *slot += 1;
+        }
+        // Searches visit successors in index order, which makes their results deterministic.
+        for i in 0..count {
+            successors[offsets[i] as usize..offsets[i + 1] as usize].sort_unstable();
+        }
+
+        let mut in_degrees = vec![0u32; count];
+        for target in &successors {
+            in_degrees[*target as usize] += 1;
+        }
+        let mut queue: VecDeque<u32> = (0..count as u32)
+            .filter(|i| in_degrees[*i as usize] == 0)
+            .collect();
+        let mut ranks = vec![0u32; count];
+        let mut rank = 0;
+        while let Some(i) = queue.pop_front() {
+            ranks[i as usize] = rank;
+            rank += 1;
+            for target in
+                &successors[offsets[i as usize] as usize..offsets[i as usize + 1] as usize]
+            {
+                in_degrees[*target as usize] -= 1;
+                if in_degrees[*target as usize] == 0 {
+                    queue.push_back(*target);
+                }
+            }
+        }
+        debug_assert_eq!(rank as usize, count, "a DAG to have a topological order");
+
+        Self {
+            graph,
+            offsets,
+            successors,
+            ranks,
+        }
+    }
+
+    /// Returns the indexed graph.
+    pub fn graph(&self) -> &Graph {
+        &self.graph
+    }
+
+    fn successors(&self, index: u32) -> &[u32] {
+        let index = index as usize;
+        &self.successors[self.offsets[index] as usize..self.offsets[index + 1] as usize]
+    }
+
+    /// Returns the given release along with the releases it can be updated to directly.
+    pub fn next_hops(&self, from: &ReleaseId) -> Graph {
+        let from = from.0.index() as u32;
+        let successors = self.successors(from);
+
+        self.subgraph(
+            std::iter::once(from).chain(successors.iter().copied()),
+            successors.iter().map(|to| (from, *to)),
+        )
+    }
+
+    /// Returns the releases and edges of a shortest path between the given releases.
+    ///
+    /// Returns `None` if `to` can't be reached from `from`.
+    pub fn shortest_path(&self, from: &ReleaseId, to: &ReleaseId) -> Option<Graph> {
+        let path = self.path(from.0.index() as u32, to.0.index() as u32)?;
+
+        Some(self.subgraph(
+            path.iter().copied(),
+            path.windows(2).map(|pair| (pair[0], pair[1])),
+        ))
+    }
+
+    /// Search a shortest path breadth-first and return the releases on it in order.
+    fn path(&self, from: u32, to: u32) -> Option<Vec<u32>> {
+        if from == to {
+            return Some(vec![from]);
+        }
+
+        let limit = self.ranks[to as usize];
+        if self.ranks[from as usize] > limit {
+            return None;
+        }
+
+        let mut parents = vec![UNVISITED; self.ranks.len()];
+        parents[from as usize] = from;
+        let mut queue = VecDeque::new();
+        queue.push_back(from);
+
+        while let Some(current) = queue.pop_front() {
+            for next in self.successors(current) {
+                let next = *next;
+                if parents[next as usize] != UNVISITED {
+                    continue;
+                }
+
+                if next == to {
+                    let mut path = vec![to, current];
+                    let mut release = current;
+                    while release != from {
+                        release = parents[release as usize];
+                        path.push(release);
+                    }
+                    path.reverse();
+                    return Some(path);
+                }
+
+                // Every release positioned after the target can't lead to it.
+                if self.ranks[next as usize] < limit {
+                    parents[next as usize] = current;
+                    queue.push_back(next);
+                }
+            }
+        }
+
+        None
+    }
+
+    /// Build a graph containing the given releases and edges.
+    fn subgraph<R, E>(&self, releases: R, edges: E) -> Graph
+    where
+        R: Iterator<Item = u32>,
+        E: Iterator<Item = (u32, u32)>,
+    {
+        let count = self.ranks.len();
+        let mut mask = ReleaseMask::empty(count);
+        for release in releases {
+            mask.insert(release as usize);
+        }
+
+        let nodes = self.graph.dag.raw_nodes();
+        Graph::from_masked(
+            mask.iter()
+                .map(|index| (daggy::NodeIndex::new(index), nodes[index].weight.clone())),
+            edges.map(|(from, to)| (daggy::NodeIndex::from(from), daggy::NodeIndex::from(to))),
+            count,
+            &mask,
+            None,
+        )
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::testing::generate_custom_graph;
+
+    fn index() -> PathIndex {
+        let metadata = (0..6).map(|i| (i, Default::default())).collect();
+        // 0 -> 1 -> 2 -> 4, 0 -> 3 -> 4, 4 -> 5
+        let edges = vec![(0, 1), (1, 2), (2, 4), (0, 3), (3, 4), (4, 5)];
+
+        PathIndex::new(generate_custom_graph("image", metadata, Some(edges)))
+    }
+
+    fn versions(graph: &Graph) -> (Vec<String>, Vec<(String, String)>) {
+        let releases = graph
+            .view()
+            .releases()
+            .map(|(_, release)| release.version().to_string())
+            .collect();
+        let mut edges: Vec<(String, String)> = graph
+            .dag
+            .raw_edges()
+            .iter()
+            .map(|edge| {
+                (
+                    graph.dag[edge.source()].version().to_string(),
+                    graph.dag[edge.target()].version().to_string(),
+                )
+            })
+            .collect();
+        edges.sort();
+        (releases, edges)
+    }
+
+    fn pairs(pairs: &[(&str, &str)]) -> Vec<(String, String)> {
+        pairs
+            .iter()
+            .map(|(from, to)| (from.to_string(), to.to_string()))
+            .collect()
+    }
+
+    #[test]
+    fn next_hops_only_include_direct_edges() {
+        let index = index();
+        let from = index.graph().find_by_version("0.0.0").unwrap();
+
+        let (releases, edges) = versions(&index.next_hops(&from));
+        assert_eq!(releases, vec!["0.0.0", "1.0.0", "3.0.0"]);
+        assert_eq!(edges, pairs(&[("0.0.0", "1.0.0"), ("0.0.0", "3.0.0")]));
+    }
+
+    #[test]
+    fn shortest_path_is_found() {
+        let index = index();
+        let find = |version| index.graph().find_by_version(version).unwrap();
+
+        let path = index.shortest_path(&find("0.0.0"), &find("5.0.0")).unwrap();
+        let (releases, edges) = versions(&path);
+        assert_eq!(releases, vec!["0.0.0", "3.0.0", "4.0.0", "5.0.0"]);
+        assert_eq!(
+            edges,
+            pairs(&[("0.0.0", "3.0.0"), ("3.0.0", "4.0.0"), ("4.0.0", "5.0.0")])
+        );
+
+        let path = index.shortest_path(&find("2.0.0"), &find("2.0.0")).unwrap();
+        assert_eq!(versions(&path), (vec!["2.0.0".to_string()], vec![]));
+
+        assert!(index
+            .shortest_path(&find("5.0.0"), &find("0.0.0"))
+            .is_none());
+        assert!(index
+            .shortest_path(&find("1.0.0"), &find("3.0.0"))
+            .is_none());
+    }
+}
@@ -95,40 +95,26 @@ impl InternalPlugin for ArchFilterPlugin {
         )?;
 
         let mut graph = internal_io.graph;
+        let key = format!("{}.{}", self.key_prefix, self.key_suffix);
 
-        // iterate over all releases attempt to remove the arch metadata key
-        // 1. if it exists, keep every release which matches the given `arch`
-        // 2. collect all other releases to be removed
-        let to_remove = {
-            graph
-                .find_by_fn_mut(|release| {
-                    match release {
-                        cincinnati::Release::Concrete(concrete_release) => concrete_release
-                            .metadata
-                            .remove(&format!("{}.{}", self.key_prefix, self.key_suffix))
-                            .map_or(true, |values| {
-                                !values.split(',').any(|value| value.trim() == arch)
-                            }),
-                        // remove if it's not a ConcreteRelease
-                        _ => true,
-                    }
-                })
-                .into_iter()
-                .map(|(release_id, version)| {
-                    trace!("queuing '{}' for removal", version);
-                    release_id
-                })
-                .collect()
-        };
-
-        // remove all matches from the Graph
-        let removed = graph.remove_releases(to_remove);
-
-        trace!("removed {} releases", removed);
-
-        // remove the build suffix from the version
+        // select every release whose arch metadata matches the given `arch`
+        let keep = graph.find_by_metadata_value(&key, &arch);
+
+        trace!(
+            "removing {} releases",
+            graph.releases_count() - keep.count() as u64
+        );
+
+        // only keep the selected releases and the edges between them
+        graph.retain_releases(&keep);
+
+        // remove the arch metadata key and the build suffix from the version
         graph
             .iter_releases_mut(|mut release| {
+                if let Some(metadata) = release.get_metadata_mut() {
+                    metadata.remove(&key);
+                }
+
                 let version = {
                     let release_version = release.version().to_owned();
 
@@ -68,33 +68,18 @@ impl InternalPlugin for ChannelFilterPlugin {
         };
 
         let mut graph = internal_io.graph;
+        let key = format!("{}.{}", self.key_prefix, self.key_suffix);
 
-        let to_remove = {
-            graph
-                .find_by_fn_mut(|release| {
-                    match release {
-                        cincinnati::Release::Concrete(concrete_release) => concrete_release
-                            .metadata
-                            .get_mut(&format!("{}.{}", self.key_prefix, self.key_suffix))
-                            .map_or(true, |values| {
-                                !values.split(',').any(|value| value.trim() == channel)
-                            }),
-                        // remove if it's not a ConcreteRelease
-                        _ => true,
-                    }
-                })
-                .into_iter()
-                .map(|(release_id, version)| {
-                    trace!("queuing '{}' for removal", version);
-                    release_id
-                })
-                .collect()
-        };
+        // select all releases which are part of the channel
+        let keep = graph.find_by_metadata_value(&key, &channel);
 
-        // remove all matches from the Graph
-        let removed = graph.remove_releases(to_remove);
+        trace!(
+            "removing {} releases",
+            graph.releases_count() - keep.count() as u64
+        );
 
-        trace!("removed {} releases", removed);
+        // only keep the selected releases and the edges between them
+        graph.retain_releases(&keep);
 
         Ok(InternalIO {
             graph,
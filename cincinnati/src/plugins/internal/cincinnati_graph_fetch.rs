@@ -2,11 +2,16 @@
 //!
 //! Instead of processing the input graph, this plugin fetches a graph from a
 //! remote endpoint, which makes it effectively discard any given input graph.
+//!
+//! If upstream reports the generation of the served graph, later fetches
+//! request the delta since that generation and apply it to the previous graph.
 
 use crate as cincinnati;
 
+use self::cincinnati::delta::{self, GraphDelta};
 use self::cincinnati::plugins::prelude::*;
 use self::cincinnati::plugins::prelude_plugin_impl::*;
+use self::cincinnati::transport;
 use self::cincinnati::CONTENT_TYPE;
 
 use commons::prelude_errors::*;
@@ -18,10 +23,16 @@ use opentelemetry::{
 
 use commons::prelude_errors::Context;
 use commons::GraphError;
-use prometheus::Counter;
+use futures::lock::Mutex as FuturesMutex;
+use prometheus::{Counter, Gauge};
 use reqwest;
-use reqwest::header::{HeaderMap, HeaderValue, ACCEPT};
-use std::time::Duration;
+use reqwest::header::{
+    HeaderMap, HeaderValue, ACCEPT, CONTENT_TYPE as CONTENT_TYPE_HEADER, ETAG, IF_NONE_MATCH,
+};
+use reqwest::StatusCode;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, RwLock};
+use std::time::{Duration, Instant};
 
 /// Default URL to upstream graph provider.
 pub static DEFAULT_UPSTREAM_URL: &str = "http://localhost:8080/v1/graph";
@@ -29,6 +40,19 @@ pub static DEFAULT_UPSTREAM_URL: &str = "http://localhost:8080/v1/graph";
 /// Default graph-builder connection timeout in seconds.
 pub static DEFAULT_TIMEOUT_SECS: u64 = 30;
 
+/// Default lifetime of the shared upstream snapshot in seconds, 0 disables it.
+pub static DEFAULT_SNAPSHOT_TTL_SECS: u64 = 0;
+
+/// Parameter key under which the revision of the fetched upstream graph is recorded.
+///
+/// Equal revisions within a process imply an equal upstream graph, which lets
+/// consumers of the plugin output reuse what they derived from it. Unlike an
+/// input revision, it doesn't cover the client parameters.
+pub static UPSTREAM_REVISION_PARAM_KEY: &str = "io.openshift.upgrades.graph.upstream_revision";
+
+/// Source of the snapshot revisions.
+static SNAPSHOT_REVISIONS: AtomicU64 = AtomicU64::new(0);
+
 /// Plugin settings.
 #[derive(Clone, CustomDebug, Deserialize, SmartDefault)]
 #[serde(default)]
@@ -38,6 +62,16 @@ struct CincinnatiGraphFetchSettings {
 
     #[default(DEFAULT_TIMEOUT_SECS)]
     timeout: u64,
+
+    /// If non-zero, serve all requests from a shared snapshot of the upstream
+    /// graph which is revalidated once it is older than this many seconds.
+    #[default(DEFAULT_SNAPSHOT_TTL_SECS)]
+    snapshot_ttl_secs: u64,
+
+    /// Prefer the compact binary graph representation over JSON.
+    /// Upstream must be a graph-builder which supports it.
+    #[default(false)]
+    binary_transport: bool,
 }
 
 /// Graph fetcher for Cincinnati `/v1/graph` endpoints.
@@ -46,6 +80,9 @@ pub struct CincinnatiGraphFetchPlugin {
     /// The upstream from which to fetch the graph
     pub upstream: String,
 
+    /// Lifetime of the shared snapshot, `None` fetches upstream on every run
+    pub snapshot_ttl: Option<Duration>,
+
     /// The optional metric for counting upstream requests
     #[debug(skip)]
     pub http_upstream_reqs: Counter,
@@ -54,14 +91,63 @@ pub struct CincinnatiGraphFetchPlugin {
     #[debug(skip)]
     pub http_upstream_errors_total: Counter,
 
+    /// The optional metric for counting upstream responses which were not modified
+    #[debug(skip)]
+    pub http_upstream_not_modified_total: Counter,
+
+    /// The optional metric for the age of the served snapshot
+    #[debug(skip)]
+    pub snapshot_age_seconds: Gauge,
+
+    /// The optional metric for the duration of the last snapshot refresh
+    #[debug(skip)]
+    pub snapshot_refresh_duration_seconds: Gauge,
+
     // graph-builder connection client
     client: reqwest::Client,
+
+    // media types requested from upstream
+    accept: HeaderValue,
+
+    // endpoint serving deltas between graph generations
+    delta_upstream: Option<reqwest::Url>,
+
+    // last graph received from upstream, used for conditional requests
+    #[debug(skip)]
+    snapshot: RwLock<Option<Snapshot>>,
+
+    // ensures only one upstream request refreshes the snapshot at a time
+    #[debug(skip)]
+    refresh_lock: FuturesMutex<()>,
+}
+
+/// Upstream graph along with the entity-tag it was served with.
+#[derive(Clone)]
+struct Snapshot {
+    etag: Option<HeaderValue>,
+    generation: Option<u64>,
+    /// Process-wide unique identifier of the graph, kept while it is unchanged.
+    revision: u64,
+    graph: Arc<cincinnati::Graph>,
+    /// Response body the graph was decoded from, kept to recognize it if there's no entity-tag.
+    body: Option<bytes::Bytes>,
+    fetched: Instant,
 }
 
 impl PluginSettings for CincinnatiGraphFetchSettings {
     fn build_plugin(&self, registry: Option<&prometheus::Registry>) -> Fallible<BoxedPlugin> {
         let cfg = self.clone();
-        let plugin = CincinnatiGraphFetchPlugin::try_new(cfg.upstream, cfg.timeout, registry)?;
+        let snapshot_ttl = match cfg.snapshot_ttl_secs {
+            0 => None,
+            secs => Some(Duration::from_secs(secs)),
+        };
+        let plugin = CincinnatiGraphFetchPlugin::try_new(
+            cfg.upstream,
+            cfg.timeout,
+            snapshot_ttl,
+            cfg.binary_transport,
+            registry,
+        )?;
         Ok(new_plugin!(InternalPluginWrapper(plugin)))
     }
 }
@@ -82,6 +168,8 @@ impl CincinnatiGraphFetchPlugin {
     fn try_new(
         upstream: String,
         timeout: u64,
+        snapshot_ttl: Option<Duration>,
+        binary_transport: bool,
         prometheus_registry: Option<&prometheus::Registry>,
     ) -> Fallible<Self> {
         let http_upstream_reqs = Counter::new(
@@ -94,9 +182,27 @@ impl CincinnatiGraphFetchPlugin {
             "Total number of HTTP upstream unreachable errors",
         )?;
 
+        let http_upstream_not_modified_total = Counter::new(
+            "http_upstream_not_modified_total",
+            "Total number of HTTP upstream responses which reused the previous graph",
+        )?;
+
+        let snapshot_age_seconds = Gauge::new(
+            "upstream_snapshot_age_seconds",
+            "Age of the served upstream graph snapshot in seconds",
+        )?;
+
+        let snapshot_refresh_duration_seconds = Gauge::new(
+            "upstream_snapshot_refresh_duration_seconds",
+            "Duration of the last upstream graph snapshot refresh in seconds",
+        )?;
+
         if let Some(registry) = &prometheus_registry {
             registry.register(Box::new(http_upstream_reqs.clone()))?;
             registry.register(Box::new(http_upstream_errors_total.clone()))?;
+            registry.register(Box::new(http_upstream_not_modified_total.clone()))?;
+            registry.register(Box::new(snapshot_age_seconds.clone()))?;
+            registry.register(Box::new(snapshot_refresh_duration_seconds.clone()))?;
         };
 
         let client = reqwest::ClientBuilder::new()
@@ -105,21 +211,102 @@ impl CincinnatiGraphFetchPlugin {
             .build()
             .context("Building reqwest client")?;
 
+        let accept = if binary_transport {
+            HeaderValue::from_str(&format!(
+                "{}, {};q=0.5",
+                transport::CONTENT_TYPE,
+                CONTENT_TYPE
+            ))?
+        } else {
+            HeaderValue::from_static(CONTENT_TYPE)
+        };
+
+        // Deltas are served below the graph endpoint.
+        let delta_upstream = reqwest::Url::parse(&upstream).ok().and_then(|mut url| {
+            url.path_segments_mut().ok()?.pop_if_empty().push("delta");
+            Some(url)
+        });
+
         Ok(Self {
             upstream,
+            snapshot_ttl,
+            accept,
+            delta_upstream,
             http_upstream_reqs,
             http_upstream_errors_total,
+            http_upstream_not_modified_total,
+            snapshot_age_seconds,
+            snapshot_refresh_duration_seconds,
             client,
+            snapshot: RwLock::new(None),
+            refresh_lock: FuturesMutex::new(()),
         })
     }
-}
 
-impl CincinnatiGraphFetchPlugin {
-    async fn do_run_internal(self: &Self, io: InternalIO) -> Fallible<InternalIO> {
+    /// Returns the snapshot of the last upstream response, if any.
+    fn snapshot(&self) -> Option<Snapshot> {
+        self.snapshot.read().ok()?.clone()
+    }
+
+    /// Replace the snapshot with the given one.
+    fn set_snapshot(&self, snapshot: Snapshot) {
+        if let Ok(mut current) = self.snapshot.write() {
+            *current = Some(snapshot);
+        }
+    }
+
+    /// Return a snapshot which is at most `ttl` old.
+    ///
+    /// Only one caller at a time refreshes an outdated snapshot. Concurrent
+    /// callers keep being served the previous snapshot in the meantime, or
+    /// wait for the refresh if there's no snapshot yet. The previous snapshot
+    /// is also served if the refresh fails.
+    async fn shared_snapshot(&self, ttl: Duration) -> Fallible<Snapshot> {
+        if let Some(snapshot) = self.snapshot() {
+            if snapshot.fetched.elapsed() < ttl {
+                return Ok(snapshot);
+            }
+
+            return match self.refresh_lock.try_lock() {
+                Some(_refreshing) => self.refresh_snapshot(Some(snapshot)).await,
+                None => Ok(snapshot),
+            };
+        }
+
+        let _refreshing = self.refresh_lock.lock().await;
+
+        // another caller might have finished the refresh while we were waiting
+        match self.snapshot() {
+            Some(snapshot) if snapshot.fetched.elapsed() < ttl => Ok(snapshot),
+            outdated => self.refresh_snapshot(outdated).await,
+        }
+    }
+
+    /// Fetch a new snapshot, falling back to the outdated one if that fails.
+    async fn refresh_snapshot(&self, outdated: Option<Snapshot>) -> Fallible<Snapshot> {
+        match (self.fetch_snapshot().await, outdated) {
+            (Ok(snapshot), _) => Ok(snapshot),
+            (Err(e), Some(outdated)) => {
+                error!(
+                    "error refreshing graph, serving the previous snapshot: {}",
+                    e
+                );
+                self.http_upstream_errors_total.inc();
+                Ok(outdated)
+            }
+            (Err(e), None) => Err(e),
+        }
+    }
+
+    /// Fetch the graph from upstream and store it as the new snapshot.
+    ///
+    /// A known entity-tag is sent along, and the previous graph is reused if
+    /// upstream reports that it was not modified.
+    async fn fetch_snapshot(&self) -> Fallible<Snapshot> {
         // extract current trace ID from headers
         // this is required to make graph-builder trace a child of police-engine request
         let mut headers = HeaderMap::new();
-        headers.insert(ACCEPT, HeaderValue::from_static(CONTENT_TYPE));
+        headers.insert(ACCEPT, self.accept.clone());
         {
             let span = get_tracer().start("");
             let _active_span = mark_span_as_active(span);
@@ -127,6 +314,22 @@ impl CincinnatiGraphFetchPlugin {
             set_context(cx, &mut headers).context("failed to set the tracing context")?;
         }
 
+        let previous = self.snapshot();
+        let started = Instant::now();
+
+        if let Some(previous) = &previous {
+            if let Some(snapshot) = self.fetch_delta(headers.clone(), previous).await {
+                self.snapshot_refresh_duration_seconds
+                    .set(started.elapsed().as_secs_f64());
+                self.set_snapshot(snapshot.clone());
+                return Ok(snapshot);
+            }
+        }
+
+        if let Some(etag) = previous.as_ref().and_then(|snapshot| snapshot.etag.clone()) {
+            headers.insert(IF_NONE_MATCH, etag);
+        }
+
         trace!("getting graph from upstream at {}", self.upstream);
         self.http_upstream_reqs.inc();
 
@@ -138,26 +341,184 @@ impl CincinnatiGraphFetchPlugin {
             .map_err(|e| GraphError::FailedUpstreamFetch(e.to_string()))
             .await?;
 
-        if !res.status().is_success() {
-            return Err(GraphError::FailedUpstreamFetch(res.status().to_string()).into());
+        let snapshot = match previous {
+            Some(previous) if res.status() == StatusCode::NOT_MODIFIED => {
+                trace!("upstream graph not modified");
+                self.http_upstream_not_modified_total.inc();
+
+                Snapshot {
+                    fetched: Instant::now(),
+                    ..previous
+                }
+            }
+            _ => {
+                if !res.status().is_success() {
+                    return Err(GraphError::FailedUpstreamFetch(res.status().to_string()).into());
+                }
+
+                let etag = res.headers().get(ETAG).cloned();
+                let generation = generation(res.headers());
+                let binary = res
+                    .headers()
+                    .get(CONTENT_TYPE_HEADER)
+                    .and_then(|value| value.to_str().ok())
+                    .map_or(false, |value| value.starts_with(transport::CONTENT_TYPE));
+
+                let body = res
+                    // TODO(steveeJ): find a way to make this fail in a test
+                    .bytes()
+                    .map_err(move |e| GraphError::FailedUpstreamFetch(e.to_string()))
+                    .await?;
+
+                let graph: cincinnati::Graph = if binary {
+                    transport::decode(&body)
+                        .map_err(|e| GraphError::FailedUpstreamFetch(format!("{:#}", e)))?
+                } else {
+                    serde_json::from_slice(&body)
+                        .map_err(|e| GraphError::FailedJsonIn(e.to_string()))?
+                };
+
+                // Without an entity-tag, an unchanged graph is recognized by its body and keeps its revision.
+                let (revision, graph) = match previous {
+                    Some(previous) if etag.is_none() && previous.body.as_ref() == Some(&body) => {
+                        (previous.revision, previous.graph)
+                    }
+                    _ => (
+                        SNAPSHOT_REVISIONS.fetch_add(1, Ordering::Relaxed),
+                        Arc::new(graph),
+                    ),
+                };
+
+                Snapshot {
+                    body: if etag.is_none() { Some(body) } else { None },
+                    etag,
+                    generation,
+                    revision,
+                    graph,
+                    fetched: Instant::now(),
+                }
+            }
+        };
+
+        self.snapshot_refresh_duration_seconds
+            .set(started.elapsed().as_secs_f64());
+
+        // Kept even without snapshot mode, as it determines the revision reported in between runs.
+        self.set_snapshot(snapshot.clone());
+
+        Ok(snapshot)
+    }
+
+    /// Fetch the delta since the generation of the previous snapshot and apply it.
+    ///
+    /// Returns `None` if the full graph needs to be fetched instead, e.g.
+    /// because upstream doesn't know the generation anymore.
+    async fn fetch_delta(&self, mut headers: HeaderMap, previous: &Snapshot) -> Option<Snapshot> {
+        let base = previous.generation?;
+        let url = self.delta_upstream.as_ref()?;
+        headers.insert(ACCEPT, HeaderValue::from_static(delta::CONTENT_TYPE));
+
+        trace!("getting graph delta since generation {} from {}", base, url);
+        self.http_upstream_reqs.inc();
+
+        let result: Fallible<Option<Snapshot>> = async {
+            let res = self
+                .client
+                .get(url.clone())
+                .query(&[(delta::SINCE_PARAM, base)])
+                .headers(headers)
+                .send()
+                .await?;
+
+            match res.status() {
+                StatusCode::NOT_MODIFIED => {
+                    trace!("upstream graph not modified since generation {}", base);
+                    self.http_upstream_not_modified_total.inc();
+                    return Ok(Some(Snapshot {
+                        fetched: Instant::now(),
+                        ..previous.clone()
+                    }));
+                }
+                StatusCode::NOT_FOUND => {
+                    debug!("upstream has no delta since generation {}", base);
+                    return Ok(None);
+                }
+                status if !status.is_success() => bail!("unexpected status {}", status),
+                _ => {}
+            };
+
+            let generation = generation(res.headers());
+            let delta: GraphDelta = serde_json::from_slice(&res.bytes().await?)?;
+            ensure!(
+                delta.base == base && Some(delta.generation) == generation,
+                "delta from generation {} to {} doesn't match the requested generation {}",
+                delta.base,
+                delta.generation,
+                base
+            );
+
+            let graph = delta.apply((*previous.graph).clone())?;
+            Ok(Some(Snapshot {
+                // The entity-tag of the full graph is unknown.
+                etag: None,
+                generation,
+                revision: SNAPSHOT_REVISIONS.fetch_add(1, Ordering::Relaxed),
+                graph: Arc::new(graph),
+                body: None,
+                fetched: Instant::now(),
+            }))
         }
+        .await;
 
-        let body = res
-            // TODO(steveeJ): find a way to make this fail in a test
-            .bytes()
-            .map_err(move |e| GraphError::FailedUpstreamFetch(e.to_string()))
-            .await?;
+        result.unwrap_or_else(|e| {
+            warn!(
+                "failed to apply upstream graph delta, fetching the full graph: {:#}",
+                e
+            );
+            None
+        })
+    }
+
+    /// Return the snapshot to serve, according to the snapshot mode.
+    async fn current_snapshot(&self) -> Fallible<Snapshot> {
+        match self.snapshot_ttl {
+            Some(ttl) => self.shared_snapshot(ttl).await,
+            None => self.fetch_snapshot().await,
+        }
+    }
+
+    async fn do_run_internal(self: &Self, io: InternalIO) -> Fallible<InternalIO> {
+        let snapshot = self.current_snapshot().await?;
 
-        let graph =
-            serde_json::from_slice(&body).map_err(|e| GraphError::FailedJsonIn(e.to_string()))?;
+        self.snapshot_age_seconds
+            .set(snapshot.fetched.elapsed().as_secs_f64());
 
-        Ok(InternalIO {
-            graph,
+        let revision = snapshot.revision.to_string();
+        let mut io = InternalIO {
+            // The clone shares the releases of the snapshot until a later plugin modifies them.
+            graph: cincinnati::Graph::clone(&snapshot.graph),
             parameters: io.parameters,
-        })
+        };
+        // Input revisions must not be taken from the client. Later plugins may depend on
+        // the client parameters, hence the upstream revision is recorded separately.
+        io.invalidate_input_revision();
+        io.parameters
+            .insert(UPSTREAM_REVISION_PARAM_KEY.to_string(), revision);
+
+        Ok(io)
     }
 }
 
+/// Returns the graph generation reported in the response headers, if any.
+fn generation(headers: &HeaderMap) -> Option<u64> {
+    headers
+        .get(delta::GENERATION_HEADER)?
+        .to_str()
+        .ok()?
+        .parse()
+        .ok()
+}
+
 #[async_trait]
 impl InternalPlugin for CincinnatiGraphFetchPlugin {
     const PLUGIN_NAME: &'static str = Self::PLUGIN_NAME;
@@ -171,6 +532,22 @@ impl InternalPlugin for CincinnatiGraphFetchPlugin {
             })
             .await
     }
+
+    /// Returns the revision of the last graph received from upstream, without fetching it again.
+    ///
+    /// An outdated shared snapshot has no known revision, so that the next run refreshes it.
+    /// Without snapshot mode, the revision is the one seen by the last run.
+    async fn upstream_revision(self: &Self) -> Fallible<Option<String>> {
+        let snapshot = match self.snapshot() {
+            Some(snapshot) => snapshot,
+            None => return Ok(None),
+        };
+
+        match self.snapshot_ttl {
+            Some(ttl) if snapshot.fetched.elapsed() >= ttl => Ok(None),
+            _ => Ok(Some(snapshot.revision.to_string())),
+        }
+    }
 }
 
 #[cfg(test)]
@@ -201,8 +578,13 @@ mod tests {
                     .create();
 
                 let timeout: u64 = 30;
-                let plugin =
-                    CincinnatiGraphFetchPlugin::try_new(mockito::server_url(), timeout, None)?;
+                let plugin = CincinnatiGraphFetchPlugin::try_new(
+                    mockito::server_url(),
+                    timeout,
+                    None,
+                    false,
+                    None,
+                )?;
                 let http_upstream_reqs = plugin.http_upstream_reqs.clone();
                 let http_upstream_errors_total = plugin.http_upstream_errors_total.clone();
 
@@ -249,6 +631,323 @@ mod tests {
         ),
     );
 
+    #[test]
+    fn fetch_not_modified_reuses_graph() -> Fallible<()> {
+        let runtime = init_runtime()?;
+
+        let expected_graph = generate_custom_graph(
+            "image",
+            (0..3)
+                .into_iter()
+                .map(|i| (i, Default::default()))
+                .collect(),
+            Some(vec![(0, 1), (1, 2)]),
+        );
+        let etag = "\"test-etag\"";
+
+        let plugin =
+            CincinnatiGraphFetchPlugin::try_new(mockito::server_url(), 30, None, false, None)?;
+
+        {
+            let _m = mockito::mock("GET", "/")
+                .with_status(200)
+                .with_header("content-type", "application/json")
+                .with_header("etag", etag)
+                .with_body(serde_json::to_string(&expected_graph)?)
+                .create();
+
+            let processed_graph = runtime
+                .block_on(plugin.run_internal(InternalIO {
+                    graph: Default::default(),
+                    parameters: Default::default(),
+                }))?
+                .graph;
+            assert_eq!(expected_graph, processed_graph);
+        }
+
+        let _m = mockito::mock("GET", "/")
+            .match_header("if-none-match", etag)
+            .with_status(304)
+            .create();
+
+        let processed_graph = runtime
+            .block_on(plugin.run_internal(InternalIO {
+                graph: Default::default(),
+                parameters: Default::default(),
+            }))?
+            .graph;
+        assert_eq!(expected_graph, processed_graph);
+
+        assert_eq!(2, plugin.http_upstream_reqs.get() as u64);
+        assert_eq!(1, plugin.http_upstream_not_modified_total.get() as u64);
+        assert_eq!(0, plugin.http_upstream_errors_total.get() as u64);
+
+        Ok(())
+    }
+
+    #[test]
+    fn fetch_delta_since_generation() -> Fallible<()> {
+        let runtime = init_runtime()?;
+
+        let base_graph = generate_custom_graph(
+            "image",
+            (0..3)
+                .into_iter()
+                .map(|i| (i, Default::default()))
+                .collect(),
+            Some(vec![(0, 1), (1, 2)]),
+        );
+        let expected_graph = generate_custom_graph(
+            "image",
+            (0..4)
+                .into_iter()
+                .map(|i| (i, Default::default()))
+                .collect(),
+            Some(vec![(0, 1), (1, 2), (2, 3)]),
+        );
+
+        let plugin =
+            CincinnatiGraphFetchPlugin::try_new(mockito::server_url(), 30, None, false, None)?;
+        let run = || {
+            runtime.block_on(plugin.run_internal(InternalIO {
+                graph: Default::default(),
+                parameters: Default::default(),
+            }))
+        };
+
+        {
+            let _m = mockito::mock("GET", "/")
+                .with_status(200)
+                .with_header("content-type", "application/json")
+                .with_header(delta::GENERATION_HEADER, "1")
+                .with_body(serde_json::to_string(&base_graph)?)
+                .create();
+            assert_eq!(base_graph, run()?.graph);
+        }
+
+        {
+            let _m = mockito::mock("GET", "/delta")
+                .match_query(mockito::Matcher::UrlEncoded(
+                    delta::SINCE_PARAM.to_string(),
+                    "1".to_string(),
+                ))
+                .match_header("accept", delta::CONTENT_TYPE)
+                .with_status(200)
+                .with_header("content-type", delta::CONTENT_TYPE)
+                .with_header(delta::GENERATION_HEADER, "2")
+                .with_body(serde_json::to_string(&GraphDelta::between(
+                    &base_graph,
+                    1,
+                    &expected_graph,
+                    2,
+                )?)?)
+                .create();
+            assert_eq!(expected_graph, run()?.graph);
+        }
+
+        {
+            let _m = mockito::mock("GET", "/delta")
+                .match_query(mockito::Matcher::UrlEncoded(
+                    delta::SINCE_PARAM.to_string(),
+                    "2".to_string(),
+                ))
+                .with_status(304)
+                .create();
+            assert_eq!(expected_graph, run()?.graph);
+        }
+
+        // Upstream doesn't know the generation anymore, so the full graph is fetched.
+        let _delta = mockito::mock("GET", "/delta")
+            .match_query(mockito::Matcher::Any)
+            .with_status(404)
+            .create();
+        let _m = mockito::mock("GET", "/")
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_body(serde_json::to_string(&base_graph)?)
+            .create();
+        assert_eq!(base_graph, run()?.graph);
+
+        assert_eq!(5, plugin.http_upstream_reqs.get() as u64);
+        assert_eq!(1, plugin.http_upstream_not_modified_total.get() as u64);
+
+        Ok(())
+    }
+
+    #[test]
+    fn fetch_binary_transport() -> Fallible<()> {
+        let runtime = init_runtime()?;
+
+        let expected_graph = generate_custom_graph(
+            "image",
+            (0..3)
+                .into_iter()
+                .map(|i| (i, Default::default()))
+                .collect(),
+            Some(vec![(0, 1), (1, 2)]),
+        );
+
+        let _m = mockito::mock("GET", "/")
+            .match_header(
+                "accept",
+                mockito::Matcher::Regex(regex::escape(transport::CONTENT_TYPE)),
+            )
+            .with_status(200)
+            .with_header("content-type", transport::CONTENT_TYPE)
+            .with_body(transport::encode(&expected_graph)?)
+            .create();
+
+        let plugin =
+            CincinnatiGraphFetchPlugin::try_new(mockito::server_url(), 30, None, true, None)?;
+
+        let processed_graph = runtime
+            .block_on(plugin.run_internal(InternalIO {
+                graph: Default::default(),
+                parameters: Default::default(),
+            }))?
+            .graph;
+        assert_eq!(expected_graph, processed_graph);
+
+        Ok(())
+    }
+
+    #[test]
+    fn snapshot_is_shared_between_runs() -> Fallible<()> {
+        let runtime = init_runtime()?;
+
+        let expected_graph = generate_custom_graph(
+            "image",
+            (0..3)
+                .into_iter()
+                .map(|i| (i, Default::default()))
+                .collect(),
+            Some(vec![(0, 1), (1, 2)]),
+        );
+
+        let upstream = mockito::mock("GET", "/")
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_body(serde_json::to_string(&expected_graph)?)
+            .expect(1)
+            .create();
+
+        let plugin = CincinnatiGraphFetchPlugin::try_new(
+            mockito::server_url(),
+            30,
+            Some(Duration::from_secs(60)),
+            false,
+            None,
+        )?;
+
+        let mut revisions = std::collections::HashSet::new();
+        for _ in 0..3 {
+            let processed = runtime.block_on(plugin.run_internal(InternalIO {
+                graph: Default::default(),
+                parameters: Default::default(),
+            }))?;
+            assert_eq!(expected_graph, processed.graph);
+            revisions.insert(processed.parameters[UPSTREAM_REVISION_PARAM_KEY].clone());
+        }
+
+        upstream.assert();
+        assert_eq!(1, plugin.http_upstream_reqs.get() as u64);
+        assert_eq!(1, revisions.len());
+
+        Ok(())
+    }
+
+    #[test]
+    fn unchanged_graph_keeps_its_revision() -> Fallible<()> {
+        let runtime = init_runtime()?;
+
+        // Without an entity-tag, upstream responds with the full graph every time.
+        let upstream = mockito::mock("GET", "/")
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_body(r#"{"nodes":[],"edges":[]}"#)
+            .expect(2)
+            .create();
+
+        let plugin =
+            CincinnatiGraphFetchPlugin::try_new(mockito::server_url(), 30, None, false, None)?;
+        assert_eq!(None, runtime.block_on(plugin.upstream_revision())?);
+
+        let mut revisions = std::collections::HashSet::new();
+        for _ in 0..2 {
+            let processed = runtime.block_on(plugin.run_internal(InternalIO {
+                graph: Default::default(),
+                parameters: Default::default(),
+            }))?;
+            revisions.insert(processed.parameters[UPSTREAM_REVISION_PARAM_KEY].clone());
+        }
+        assert_eq!(1, revisions.len());
+
+        // The revision is known without asking upstream again.
+        let revision = runtime.block_on(plugin.upstream_revision())?;
+        assert_eq!(revision.as_ref(), revisions.iter().next());
+
+        upstream.assert();
+        assert_eq!(2, plugin.http_upstream_reqs.get() as u64);
+
+        Ok(())
+    }
+
+    #[test]
+    fn outdated_snapshot_is_served_if_upstream_fails() -> Fallible<()> {
+        let runtime = init_runtime()?;
+
+        let expected_graph = generate_custom_graph(
+            "image",
+            (0..2)
+                .into_iter()
+                .map(|i| (i, Default::default()))
+                .collect(),
+            Some(vec![(0, 1)]),
+        );
+
+        let upstream = mockito::mock("GET", "/")
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_body(serde_json::to_string(&expected_graph)?)
+            .expect(1)
+            .create();
+
+        let plugin = CincinnatiGraphFetchPlugin::try_new(
+            mockito::server_url(),
+            30,
+            Some(Duration::from_millis(1)),
+            false,
+            None,
+        )?;
+        let run = || {
+            runtime.block_on(plugin.run_internal(InternalIO {
+                graph: Default::default(),
+                parameters: Default::default(),
+            }))
+        };
+
+        let first = run()?;
+        upstream.assert();
+        drop(upstream);
+
+        let failing = mockito::mock("GET", "/")
+            .with_status(500)
+            .expect(1)
+            .create();
+        std::thread::sleep(Duration::from_millis(10));
+
+        let second = run()?;
+        failing.assert();
+        assert_eq!(expected_graph, second.graph);
+        assert_eq!(
+            first.parameters[UPSTREAM_REVISION_PARAM_KEY],
+            second.parameters[UPSTREAM_REVISION_PARAM_KEY]
+        );
+        assert_eq!(1, plugin.http_upstream_errors_total.get() as u64);
+
+        Ok(())
+    }
+
     macro_rules! fetch_upstream_failure_test {
         (
             name: $name:ident,
@@ -267,7 +966,13 @@ mod tests {
                     .with_body($mock_body.to_string())
                     .create();
 
-                let plugin = CincinnatiGraphFetchPlugin::try_new($upstream.to_string(), 30, None)?;
+                let plugin = CincinnatiGraphFetchPlugin::try_new(
+                    $upstream.to_string(),
+                    30,
+                    None,
+                    false,
+                    None,
+                )?;
                 let http_upstream_reqs = plugin.http_upstream_reqs.clone();
                 let http_upstream_errors_total = plugin.http_upstream_errors_total.clone();
 
@@ -332,8 +1037,13 @@ mod tests {
 
         let timeout: u64 = 30;
 
-        let _ =
-            CincinnatiGraphFetchPlugin::try_new(mockito::server_url(), timeout, Some(registry))?;
+        let _ = CincinnatiGraphFetchPlugin::try_new(
+            mockito::server_url(),
+            timeout,
+            None,
+            false,
+            Some(registry),
+        )?;
 
         let metrics_call = metrics::serve::<metrics::RegistryWrapper>(actix_web::web::Data::new(
             RegistryWrapper(registry),
@@ -4,10 +4,20 @@ use crate as cincinnati;
 
 use self::cincinnati::plugins::prelude::*;
 use self::cincinnati::plugins::prelude_plugin_impl::*;
+use self::cincinnati::plugins::RevisionMemo;
+
+use std::collections::{BTreeMap, HashSet};
+use std::sync::{Arc, Mutex};
 
 pub static DEFAULT_KEY_FILTER: &str = "io.openshift.upgrades.graph";
 pub static DEFAULT_REMOVE_ALL_EDGES_VALUE: &str = "*";
 
+/// Maximum number of patterns compiled into a single `RegexSet`.
+///
+/// A set of all patterns can exceed the compiled size limit of the regex crate
+/// and thrashes its lazy DFA, while bounded sets keep compiling and matching fast.
+static REGEX_SET_CHUNK_SIZE: usize = 256;
+
 #[derive(Clone, Debug, Deserialize, SmartDefault)]
 #[serde(default)]
 pub struct EdgeAddRemovePlugin {
@@ -20,6 +30,101 @@ pub struct EdgeAddRemovePlugin {
     /// If true causes the removal of all processed metadata from the releases.
     #[default(false)]
     pub remove_consumed_metadata: bool,
+
+    /// Result of the last run, reused while the input revision is unchanged.
+    #[serde(skip)]
+    pub(crate) memo: Arc<RevisionMemo>,
+
+    /// Compiled `previous.remove_regex` patterns, reused across runs.
+    #[serde(skip)]
+    pub(crate) regex_set_cache: Arc<RegexSetCache>,
+}
+
+/// Compiled patterns, split into sets of at most `REGEX_SET_CHUNK_SIZE` patterns.
+#[derive(Debug)]
+pub struct RegexSets {
+    patterns: Vec<String>,
+    sets: Vec<regex::RegexSet>,
+}
+
+impl RegexSets {
+    fn new(patterns: Vec<String>) -> Fallible<Self> {
+        let sets = patterns
+            .chunks(REGEX_SET_CHUNK_SIZE)
+            .map(|chunk| -> Fallible<regex::RegexSet> {
+                match regex::RegexSet::new(chunk) {
+                    Ok(set) => Ok(set),
+                    Err(e) => {
+                        // Name the offending pattern in the error.
+                        for pattern in chunk {
+                            regex::Regex::new(pattern)
+                                .context(format!("Parsing {} as Regex", pattern))?;
+                        }
+                        bail!(e)
+                    }
+                }
+            })
+            .collect::<Fallible<Vec<_>>>()?;
+
+        Ok(Self { patterns, sets })
+    }
+
+    /// Returns all patterns, in the order they were given.
+    pub fn patterns(&self) -> &[String] {
+        &self.patterns
+    }
+
+    /// Returns the indices of all patterns which match the given text, in ascending order.
+    pub fn matches(&self, text: &str) -> Vec<usize> {
+        self.sets
+            .iter()
+            .enumerate()
+            .flat_map(|(chunk, set)| {
+                set.matches(text)
+                    .into_iter()
+                    .map(move |index| chunk * REGEX_SET_CHUNK_SIZE + index)
+            })
+            .collect()
+    }
+}
+
+/// Caches the compiled regexes for the patterns of the latest run.
+///
+/// The patterns come from the secondary metadata and rarely change between
+/// graph refreshes, so they are only compiled again when they do.
+#[derive(Default)]
+pub struct RegexSetCache(Mutex<Option<Arc<RegexSets>>>);
+
+impl std::fmt::Debug for RegexSetCache {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        let len = self
+            .0
+            .lock()
+            .ok()
+            .and_then(|sets| sets.as_ref().map(|sets| sets.patterns().len()));
+        f.debug_tuple("RegexSetCache").field(&len).finish()
+    }
+}
+
+impl RegexSetCache {
+    /// Returns the compiled sets for the given patterns, compiling them if they changed.
+    pub fn get_or_compile(&self, patterns: Vec<String>) -> Fallible<Arc<RegexSets>> {
+        let mut cached = self
+            .0
+            .lock()
+            .map_err(|e| format_err!("regex cache lock poisoned: {}", e))?;
+
+        if let Some(sets) = &*cached {
+            if sets.patterns() == patterns.as_slice() {
+                return Ok(sets.clone());
+            }
+        }
+
+        let sets = Arc::new(RegexSets::new(patterns)?);
+        *cached = Some(sets.clone());
+
+        Ok(sets)
+    }
 }
 
 #[async_trait]
@@ -27,10 +132,22 @@ impl InternalPlugin for EdgeAddRemovePlugin {
     const PLUGIN_NAME: &'static str = Self::PLUGIN_NAME;
 
     async fn run_internal(self: &Self, io: InternalIO) -> Fallible<InternalIO> {
+        let revision = io.input_revision();
+        if let Some(graph) = revision.as_ref().and_then(|r| self.memo.get(r)) {
+            return Ok(InternalIO {
+                graph,
+                parameters: io.parameters,
+            });
+        }
+
         let mut graph = io.graph;
         self.add_edges(&mut graph)?;
         self.remove_edges(&mut graph)?;
 
+        if let Some(revision) = &revision {
+            self.memo.set(revision, &graph);
+        }
+
         Ok(InternalIO {
             graph,
             parameters: io.parameters,
@@ -85,16 +202,22 @@ impl EdgeAddRemovePlugin {
     ///
     /// The labels are assumed to have the syntax `<prefix>.(previous|next).remove=(<Version>,)*<Version>`
     /// If the value equals a single `REMOVE_ALL_EDGES_VALUE` all edges at the given direction are removed.
-    fn remove_edges(&self, mut graph: &mut cincinnati::Graph) -> Fallible<()> {
+    ///
+    /// The edges are collected first and removed from the graph at once.
+    fn remove_edges(&self, graph: &mut cincinnati::Graph) -> Fallible<()> {
+        let mut edges_to_remove: HashSet<(ReleaseId, ReleaseId)> = HashSet::new();
+        let mut parents_to_remove: HashSet<ReleaseId> = HashSet::new();
+
         macro_rules! handle_remove_edge {
             ($from:ident, $to:ident) => {
-                if let Err(e) = graph.remove_edge(&$from, &$to) {
+                if let Err(e) = graph.find_edge(&$from, &$to) {
                     if let Some(eae) = e.downcast_ref::<cincinnati::errors::EdgeDoesntExist>() {
                         warn!("{}", eae);
                         continue;
                     };
                     bail!(e)
                 };
+                edges_to_remove.insert(($from.clone(), $to.clone()));
             };
         }
 
@@ -111,18 +234,13 @@ impl EdgeAddRemovePlugin {
                     }
 
                     if from_csv.trim() == self.remove_all_edges_value {
-                        let parents: Vec<cincinnati::daggy::EdgeIndex> = graph
-                            .previous_releases(&to)
-                            .map(|(edge_index, _, _)| edge_index)
-                            .collect();
-
-                        trace!("removing parents for '{}': {:?}", to_version, parents);
-                        return graph.remove_edges_by_index(&parents);
+                        trace!("removing parents for '{}'", to_version);
+                        parents_to_remove.insert(to);
+                        return Ok(());
                     }
 
                     for from_version in from_csv.split(',').map(str::trim) {
-                        let from_version =
-                            try_annotate_semver_build(&mut graph, from_version, &to)?;
+                        let from_version = try_annotate_semver_build(graph, from_version, &to)?;
 
                         if let Some(from) = graph.find_by_version(&from_version) {
                             info!("[{}]: removing previous {}", to_version, from_version);
@@ -140,58 +258,65 @@ impl EdgeAddRemovePlugin {
 
         // Remove edges instructed by "previous.remove_regex"
         let previous_remove_regex_key = format!("{}.{}", self.key_prefix, "previous.remove_regex");
-        graph
-            .find_by_metadata_key(&previous_remove_regex_key)
-            .into_iter()
-            .try_for_each(
-                |(to, to_version, from_regex_string): (ReleaseId, String, String)| -> Fallible<()> {
-                    if self.remove_consumed_metadata {
-                        graph
-                            .get_metadata_as_ref_mut(&to)
-                            .map(|metadata| metadata.remove(&previous_remove_regex_key))?;
-                    }
-
-                    let from_regex = regex::Regex::new(&from_regex_string)
-                        .context(format!("Parsing {} as Regex", &from_regex_string))?;
-
-                    if from_regex_string == ".*" {
-                        let parents: Vec<daggy::EdgeIndex> = graph
-                            .previous_releases(&to)
-                            .map(|(edge_index, _, _)| edge_index)
-                            .collect();
+        let mut regex_targets: BTreeMap<String, Vec<(ReleaseId, String)>> = BTreeMap::new();
+        for (to, to_version, from_regex_string) in
+            graph.find_by_metadata_key(&previous_remove_regex_key)
+        {
+            if self.remove_consumed_metadata {
+                graph
+                    .get_metadata_as_ref_mut(&to)
+                    .map(|metadata| metadata.remove(&previous_remove_regex_key))?;
+            }
 
-                        trace!(
-                            "removing parents by regex for '{}': {:?}",
-                            to_version,
-                            parents
-                        );
-                        return graph.remove_edges_by_index(&parents);
-                    };
+            if from_regex_string == ".*" {
+                trace!("removing parents by regex for '{}'", to_version);
+                parents_to_remove.insert(to);
+                continue;
+            };
 
-                    let froms = graph.find_by_fn_mut(|release| {
-                        if from_regex.is_match(release.version()) {
-                            debug!(
-                                "Regex '{}' matches version '{}'",
-                                &from_regex,
-                                release.version(),
-                            );
-                            true
-                        } else {
-                            false
-                        }
-                    });
+            regex_targets
+                .entry(from_regex_string)
+                .or_default()
+                .push((to, to_version));
+        }
 
-                    for (from, from_version) in froms {
+        if !regex_targets.is_empty() {
+            let patterns: Vec<String> = regex_targets.keys().cloned().collect();
+            let regex_set = self.regex_set_cache.get_or_compile(patterns)?;
+            let targets: Vec<&Vec<(ReleaseId, String)>> = regex_targets.values().collect();
+
+            // Match every version once against all patterns.
+            let froms: Vec<(ReleaseId, String, Vec<usize>)> = graph
+                .view()
+                .releases()
+                .filter_map(|(from, release)| {
+                    let matches = regex_set.matches(release.version());
+                    if matches.is_empty() {
+                        None
+                    } else {
+                        Some((from, release.version().to_string(), matches))
+                    }
+                })
+                .collect();
+
+            for (from, from_version, matches) in froms {
+                for pattern_index in matches {
+                    debug!(
+                        "Regex '{}' matches version '{}'",
+                        &regex_set.patterns()[pattern_index],
+                        from_version,
+                    );
+                    for (to, to_version) in targets[pattern_index] {
                         info!(
                             "[{}]: removing previous {} by regex",
                             to_version, from_version
                         );
+                        let to = to.clone();
                         handle_remove_edge!(from, to);
                     }
-
-                    Ok(())
-                },
-            )?;
+                }
+            }
+        }
 
         let next_remove_key = format!("{}.{}", self.key_prefix, "next.remove");
         graph
@@ -206,7 +331,7 @@ impl EdgeAddRemovePlugin {
                     }
 
                     for to_version in to_csv.split(',').map(str::trim) {
-                        let to_version = try_annotate_semver_build(&mut graph, to_version, &from)?;
+                        let to_version = try_annotate_semver_build(graph, to_version, &from)?;
                         if let Some(to) = graph.find_by_version(&to_version) {
                             info!("[{}]: removing next {}", from_version, to_version);
                             handle_remove_edge!(from, to)
@@ -221,13 +346,19 @@ impl EdgeAddRemovePlugin {
                 },
             )?;
 
+        let removed = graph.retain_edges(|from, to| {
+            !parents_to_remove.contains(to)
+                && !edges_to_remove.contains(&(from.clone(), to.clone()))
+        });
+        trace!("removed {} edges", removed);
+
         Ok(())
     }
 
     /// Add next and previous releases specified by metadata.
     ///
     /// The labels are assumed to have the syntax `<prefix>.(previous|next).add=(<Version>,)*<Version>`
-    fn add_edges(&self, mut graph: &mut cincinnati::Graph) -> Fallible<()> {
+    fn add_edges(&self, graph: &mut cincinnati::Graph) -> Fallible<()> {
         macro_rules! handle_add_edge {
             ($direction:expr, $from:ident, $to:ident, $from_string:ident, $to_string:ident) => {
                 if let Err(e) = graph.add_edge(&$from, &$to) {
@@ -253,7 +384,7 @@ impl EdgeAddRemovePlugin {
 
                 for from_version in from_csv.split(',').map(str::trim) {
                     let from_version_annotated =
-                        try_annotate_semver_build(&mut graph, from_version, &to)?;
+                        try_annotate_semver_build(graph, from_version, &to)?;
 
                     if let Some(from) = graph.find_by_version(&from_version_annotated) {
                         info!(
@@ -283,8 +414,7 @@ impl EdgeAddRemovePlugin {
                 }
 
                 for to_version in to_csv.split(',').map(str::trim) {
-                    let to_version_annotated =
-                        try_annotate_semver_build(&mut graph, to_version, &from)?;
+                    let to_version_annotated = try_annotate_semver_build(graph, to_version, &from)?;
 
                     if let Some(to) = graph.find_by_version(&to_version_annotated) {
                         info!(
@@ -311,12 +441,12 @@ impl EdgeAddRemovePlugin {
 /// If the referenced ReleaseId doesn't have the arch metadata, the version
 /// string will be passed through unchanged.
 fn try_annotate_semver_build(
-    graph: &mut cincinnati::Graph,
+    graph: &cincinnati::Graph,
     version: &str,
     arch_reference: &ReleaseId,
 ) -> Fallible<String> {
     let version = if let Some(arch) = graph
-        .get_metadata_as_ref_mut(arch_reference)?
+        .get_metadata_as_ref(arch_reference)?
         .get("io.openshift.upgrades.graph.release.arch")
     {
         let mut version = semver::Version::parse(version)?;
@@ -392,6 +522,84 @@ mod tests {
         Ok(())
     }
 
+    #[test]
+    fn regex_sets_scale_to_many_patterns() -> Fallible<()> {
+        // More patterns than fit into a single set within the compiled size limit
+        // of the regex crate, as written for production-sized blocked edges.
+        let patterns: Vec<String> = (0..10_000)
+            .map(|i| {
+                let (minor, patch) = (i / 100, i % 100);
+                format!(r"4\.{}\.({}|{}|{}).*", minor, patch, patch + 1, patch + 2)
+            })
+            .collect();
+
+        let cache = RegexSetCache::default();
+        let sets = cache.get_or_compile(patterns.clone())?;
+        assert_eq!(sets.patterns(), patterns.as_slice());
+
+        // The matching patterns span two sets, the unanchored `4\.12\.(6|7|8)`
+        // matches as well.
+        assert_eq!(
+            sets.matches("4.12.80"),
+            vec![1206, 1207, 1208, 1278, 1279, 1280]
+        );
+        assert_eq!(sets.matches("4.100.0"), Vec::<usize>::new());
+
+        assert!(Arc::ptr_eq(&sets, &cache.get_or_compile(patterns)?));
+
+        Ok(())
+    }
+
+    #[test]
+    fn ensure_previous_remove_regex() -> Fallible<()> {
+        let key = format!("{}.{}", KEY_PREFIX, "previous.remove_regex");
+        let metadata: Vec<(usize, MapImpl<String, String>)> = vec![
+            (0, MapImpl::new()),
+            (1, MapImpl::new()),
+            (
+                2,
+                [(key.clone(), "^0\\..*".to_string())]
+                    .iter()
+                    .cloned()
+                    .collect(),
+            ),
+            (
+                3,
+                [(key.clone(), "^[01]\\..*".to_string())]
+                    .iter()
+                    .cloned()
+                    .collect(),
+            ),
+        ];
+
+        let input_graph: cincinnati::Graph = generate_custom_graph(
+            "image",
+            metadata.clone(),
+            Some(vec![(0, 2), (1, 2), (0, 3), (1, 3), (2, 3)]),
+        );
+        let expected_graph: cincinnati::Graph =
+            generate_custom_graph("image", metadata.clone(), Some(vec![(1, 2), (2, 3)]));
+
+        let plugin = EdgeAddRemovePlugin {
+            key_prefix: KEY_PREFIX.to_string(),
+            ..Default::default()
+        };
+
+        // The second run reuses the compiled patterns.
+        for _ in 0..2 {
+            let mut graph = input_graph.clone();
+            plugin.remove_edges(&mut graph)?;
+            assert_eq!(expected_graph, graph);
+        }
+
+        let mut invalid_metadata = metadata;
+        invalid_metadata[3].1.insert(key, "(".to_string());
+        let mut graph = generate_custom_graph("image", invalid_metadata, None);
+        assert!(plugin.remove_edges(&mut graph).is_err());
+
+        Ok(())
+    }
+
     #[test]
     fn ensure_previous_remove_all() -> Fallible<()> {
         let runtime = init_runtime()?;
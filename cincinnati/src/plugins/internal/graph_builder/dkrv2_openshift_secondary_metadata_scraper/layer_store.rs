@@ -0,0 +1,376 @@
+//! Content-addressed store of unpacked image layers.
+//!
+//! Every layer is unpacked once into a directory named after its blob digest.
+//! A data directory for a list of layers is then assembled by hardlinking the
+//! files of the unpacked layers, so that an image bump only requires fetching
+//! and unpacking the layers which actually changed.
+//!
+//! The assembled files share their inodes with the store, hence they must be
+//! treated as read-only.
+
+use commons::prelude_errors::*;
+use log::{debug, trace, warn};
+use std::collections::HashSet;
+use std::path::{Path, PathBuf};
+
+/// Prefix of whiteout files, which mark a path as removed from lower layers.
+static WHITEOUT_PREFIX: &str = ".wh.";
+
+/// Whiteout file which marks its directory as opaque, hiding the contents of lower layers.
+static WHITEOUT_OPAQUE: &str = ".wh..wh..opq";
+
+/// Extension of layer directories which are still being unpacked.
+static INCOMPLETE_EXTENSION: &str = "incomplete";
+
+/// Store of unpacked layers, keyed by blob digest.
+#[derive(Debug)]
+pub struct LayerStore {
+    root: PathBuf,
+}
+
+impl LayerStore {
+    /// Open the store at the given directory, creating it if it doesn't exist.
+    pub fn try_new(root: PathBuf) -> Fallible<Self> {
+        std::fs::create_dir_all(&root).context(format!("Creating directory {:?}", &root))?;
+        Ok(Self { root })
+    }
+
+    /// Path of the unpacked layer with the given digest.
+    fn layer_path(&self, digest: &str) -> Fallible<PathBuf> {
+        ensure!(
+            !digest.is_empty()
+                && digest
+                    .chars()
+                    .all(|c| c.is_ascii_alphanumeric() || c == ':' || c == '-' || c == '_'),
+            "invalid layer digest '{}'",
+            digest
+        );
+        Ok(self.root.join(digest.replace(':', "_")))
+    }
+
+    /// Returns true if the layer with the given digest has been unpacked.
+    pub fn contains(&self, digest: &str) -> Fallible<bool> {
+        Ok(self.layer_path(digest)?.is_dir())
+    }
+
+    /// Unpack the gzipped layer blob with the given digest into the store.
+    ///
+    /// The layer is unpacked next to its final location first, so that an
+    /// interrupted unpack is never mistaken for a complete layer.
+    pub fn insert(&self, digest: &str, blob: &[u8]) -> Fallible<()> {
+        let layer_path = self.layer_path(digest)?;
+        let incomplete = layer_path.with_extension(INCOMPLETE_EXTENSION);
+        if incomplete.exists() {
+            std::fs::remove_dir_all(&incomplete).context(format!("Removing {:?}", &incomplete))?;
+        }
+        std::fs::create_dir_all(&incomplete)
+            .context(format!("Creating directory {:?}", &incomplete))?;
+
+        tar::Archive::new(flate2::read::GzDecoder::new(blob))
+            .unpack(&incomplete)
+            .context(format!("Unpacking layer {} to {:?}", digest, &incomplete))?;
+
+        std::fs::rename(&incomplete, &layer_path)
+            .context(format!("Renaming {:?} -> {:?}", &incomplete, &layer_path))?;
+        trace!("Unpacked layer {} to {:?}", digest, &layer_path);
+
+        Ok(())
+    }
+
+    /// Assemble the given layers in order into the target directory.
+    ///
+    /// Whiteouts of a layer are applied to the lower layers before its own files are linked.
+    pub fn assemble(&self, layers: &[String], target: &Path) -> Fallible<()> {
+        for digest in layers {
+            let layer_path = self.layer_path(digest)?;
+            ensure!(layer_path.is_dir(), "layer {} is not in the store", digest);
+
+            let entries = walkdir::WalkDir::new(&layer_path)
+                .min_depth(1)
+                .into_iter()
+                .collect::<Result<Vec<_>, _>>()?;
+
+            for entry in &entries {
+                let relative = entry.path().strip_prefix(&layer_path)?;
+                let name = match entry.file_name().to_str() {
+                    Some(name) => name,
+                    None => continue,
+                };
+                if !name.starts_with(WHITEOUT_PREFIX) {
+                    continue;
+                }
+                let parent = target.join(relative.parent().unwrap_or_else(|| Path::new("")));
+                ensure_no_symlinks(target, relative)?;
+
+                if name == WHITEOUT_OPAQUE {
+                    trace!("Applying opaque whiteout {:?}", relative);
+                    if parent.is_dir() {
+                        for child in std::fs::read_dir(&parent)? {
+                            remove_path(&child?.path())?;
+                        }
+                    }
+                } else if let Some(hidden) = name.strip_prefix(WHITEOUT_PREFIX) {
+                    ensure!(
+                        !hidden.is_empty()
+                            && hidden != "."
+                            && hidden != ".."
+                            && !hidden.contains(std::path::is_separator),
+                        "invalid whiteout {:?} in layer {}",
+                        relative,
+                        digest
+                    );
+                    trace!("Applying whiteout {:?}", relative);
+                    remove_path(&parent.join(hidden))?;
+                }
+            }
+
+            for entry in &entries {
+                let relative = entry.path().strip_prefix(&layer_path)?;
+                if entry
+                    .file_name()
+                    .to_str()
+                    .map_or(false, |name| name.starts_with(WHITEOUT_PREFIX))
+                {
+                    continue;
+                }
+
+                ensure_no_symlinks(target, relative)?;
+                let destination = target.join(relative);
+                let file_type = entry.file_type();
+                if file_type.is_dir() {
+                    // A symlink to a directory is replaced, so that nothing is written through it.
+                    let is_dir = std::fs::symlink_metadata(&destination)
+                        .map_or(false, |metadata| metadata.is_dir());
+                    if !is_dir {
+                        remove_path(&destination)?;
+                        std::fs::create_dir_all(&destination)
+                            .context(format!("Creating directory {:?}", &destination))?;
+                    }
+                    continue;
+                }
+
+                remove_path(&destination)?;
+                if file_type.is_symlink() {
+                    let link = std::fs::read_link(entry.path())?;
+                    std::os::unix::fs::symlink(&link, &destination)
+                        .context(format!("Linking {:?} -> {:?}", &destination, &link))?;
+                } else if let Err(e) = std::fs::hard_link(entry.path(), &destination) {
+                    debug!(
+                        "Could not hardlink {:?}, copying instead: {}",
+                        entry.path(),
+                        e
+                    );
+                    std::fs::copy(entry.path(), &destination).context(format!(
+                        "Copying {:?} -> {:?}",
+                        entry.path(),
+                        &destination
+                    ))?;
+                }
+            }
+        }
+
+        Ok(())
+    }
+
+    /// Remove all layers from the store except for the given ones.
+    pub fn retain(&self, layers: &[String]) -> Fallible<()> {
+        let keep = layers
+            .iter()
+            .map(|digest| self.layer_path(digest))
+            .collect::<Fallible<HashSet<PathBuf>>>()?;
+
+        for entry in std::fs::read_dir(&self.root)? {
+            let path = entry?.path();
+            if !keep.contains(&path) {
+                debug!("Removing unused layer {:?}", &path);
+                if let Err(e) = remove_path(&path) {
+                    warn!("Could not remove unused layer {:?}: {}", &path, e);
+                }
+            }
+        }
+
+        Ok(())
+    }
+}
+
+/// Ensure that no parent of the given path within the target directory is a symlink.
+///
+/// Layers may contain symlinks, and writing or removing anything through one
+/// which was linked by a lower layer could reach outside the target directory.
+fn ensure_no_symlinks(target: &Path, relative: &Path) -> Fallible<()> {
+    let mut path = target.to_path_buf();
+    for component in relative.parent().into_iter().flat_map(Path::components) {
+        path.push(component);
+        match std::fs::symlink_metadata(&path) {
+            Ok(metadata) => ensure!(
+                !metadata.file_type().is_symlink(),
+                "refusing to write {:?} through symlink {:?}",
+                relative,
+                &path
+            ),
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => break,
+            Err(e) => return Err(e).context(format!("Reading metadata of {:?}", &path)),
+        }
+    }
+
+    Ok(())
+}
+
+/// Remove the file, symlink or directory at the given path, if any.
+fn remove_path(path: &Path) -> Fallible<()> {
+    let metadata = match std::fs::symlink_metadata(path) {
+        Ok(metadata) => metadata,
+        Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(()),
+        Err(e) => return Err(e).context(format!("Reading metadata of {:?}", path)),
+    };
+
+    if metadata.is_dir() {
+        std::fs::remove_dir_all(path)
+    } else {
+        std::fs::remove_file(path)
+    }
+    .context(format!("Removing {:?}", path))?;
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn layer(files: &[(&str, &str)]) -> Fallible<Vec<u8>> {
+        layer_with_symlinks(files, &[])
+    }
+
+    fn layer_with_symlinks(files: &[(&str, &str)], links: &[(&str, &Path)]) -> Fallible<Vec<u8>> {
+        let mut builder = tar::Builder::new(flate2::write::GzEncoder::new(
+            Vec::new(),
+            flate2::Compression::default(),
+        ));
+        for (path, content) in files {
+            let mut header = tar::Header::new_gnu();
+            header.set_size(content.len() as u64);
+            header.set_mode(0o644);
+            builder.append_data(&mut header, path, content.as_bytes())?;
+        }
+        for (path, link) in links {
+            let mut header = tar::Header::new_gnu();
+            header.set_entry_type(tar::EntryType::Symlink);
+            header.set_link_name(link)?;
+            header.set_size(0);
+            header.set_mode(0o777);
+            builder.append_data(&mut header, path, std::io::empty())?;
+        }
+        Ok(builder.into_inner()?.finish()?)
+    }
+
+    #[test]
+    fn assemble_layers_with_whiteouts() -> Fallible<()> {
+        let tmpdir = tempfile::tempdir()?;
+        let store = LayerStore::try_new(tmpdir.path().join("layers"))?;
+
+        let layers = vec!["sha256:aaaa".to_string(), "sha256:bbbb".to_string()];
+        store.insert(
+            &layers[0],
+            &layer(&[
+                ("version", "1"),
+                ("channels/a.yaml", "a"),
+                ("channels/b.yaml", "b"),
+                ("blocked-edges/x.yaml", "x"),
+            ])?,
+        )?;
+        store.insert(
+            &layers[1],
+            &layer(&[
+                ("version", "2"),
+                ("channels/.wh.b.yaml", ""),
+                ("blocked-edges/.wh..wh..opq", ""),
+                ("blocked-edges/y.yaml", "y"),
+            ])?,
+        )?;
+        assert!(store.contains(&layers[0])?);
+        assert!(!store.contains("sha256:cccc")?);
+
+        let target = tmpdir.path().join("data");
+        std::fs::create_dir(&target)?;
+        store.assemble(&layers, &target)?;
+
+        let read = |path: &str| std::fs::read_to_string(target.join(path)).ok();
+        assert_eq!(read("version").as_deref(), Some("2"));
+        assert_eq!(read("channels/a.yaml").as_deref(), Some("a"));
+        assert_eq!(read("channels/b.yaml"), None);
+        assert_eq!(read("channels/.wh.b.yaml"), None);
+        assert_eq!(read("blocked-edges/x.yaml"), None);
+        assert_eq!(read("blocked-edges/y.yaml").as_deref(), Some("y"));
+
+        store.retain(&layers[1..])?;
+        assert!(!store.contains(&layers[0])?);
+        assert!(store.contains(&layers[1])?);
+
+        assert!(store.insert("../escape", &[]).is_err());
+
+        Ok(())
+    }
+
+    #[test]
+    fn assemble_rejects_whiteouts_of_parent_directories() -> Fallible<()> {
+        let tmpdir = tempfile::tempdir()?;
+        let store = LayerStore::try_new(tmpdir.path().join("layers"))?;
+
+        let layers = vec!["sha256:aaaa".to_string(), "sha256:bbbb".to_string()];
+        store.insert(&layers[0], &layer(&[("version", "1")])?)?;
+        store.insert(&layers[1], &layer(&[(".wh...", "")])?)?;
+
+        let target = tmpdir.path().join("data");
+        std::fs::create_dir(&target)?;
+        assert!(store.assemble(&layers, &target).is_err());
+
+        assert!(store.contains(&layers[0])?);
+        assert!(target.join("version").is_file());
+
+        Ok(())
+    }
+
+    #[test]
+    fn assemble_refuses_to_write_through_symlinks() -> Fallible<()> {
+        let tmpdir = tempfile::tempdir()?;
+        let store = LayerStore::try_new(tmpdir.path().join("layers"))?;
+
+        let outside = tmpdir.path().join("outside");
+        std::fs::create_dir(&outside)?;
+        std::fs::write(outside.join("keep.yaml"), "keep")?;
+
+        let layers = vec!["sha256:aaaa".to_string(), "sha256:bbbb".to_string()];
+        store.insert(
+            &layers[0],
+            &layer_with_symlinks(&[("version", "1")], &[("channels", outside.as_path())])?,
+        )?;
+        store.insert(
+            &layers[1],
+            &layer(&[
+                ("channels/.wh..wh..opq", ""),
+                ("channels/.wh.keep.yaml", ""),
+            ])?,
+        )?;
+
+        let target = tmpdir.path().join("data");
+        std::fs::create_dir(&target)?;
+        assert!(store.assemble(&layers, &target).is_err());
+        assert!(outside.join("keep.yaml").is_file());
+
+        // A directory replaces the symlink instead of being created through it.
+        let layers = vec!["sha256:aaaa".to_string(), "sha256:cccc".to_string()];
+        store.insert(&layers[1], &layer(&[("channels/a.yaml", "a")])?)?;
+
+        let target = tmpdir.path().join("data2");
+        std::fs::create_dir(&target)?;
+        store.assemble(&layers, &target)?;
+        assert!(!std::fs::symlink_metadata(target.join("channels"))?
+            .file_type()
+            .is_symlink());
+        assert!(target.join("channels/a.yaml").is_file());
+        assert!(!outside.join("a.yaml").exists());
+
+        Ok(())
+    }
+}
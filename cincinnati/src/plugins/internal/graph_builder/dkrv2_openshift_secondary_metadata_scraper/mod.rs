@@ -5,6 +5,7 @@
 //! The plugin will only download a tarball if detects a change of revision or on first run.
 
 pub mod gpg;
+pub mod layer_store;
 pub mod plugin;
 
 pub use plugin::{
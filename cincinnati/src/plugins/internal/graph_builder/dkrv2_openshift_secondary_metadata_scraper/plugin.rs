@@ -1,8 +1,10 @@
 use crate as cincinnati;
 use crate::plugins::internal::dkrv2_openshift_secondary_metadata_scraper::gpg;
+use crate::plugins::internal::dkrv2_openshift_secondary_metadata_scraper::layer_store::LayerStore;
 use crate::plugins::internal::release_scrape_dockerv2::registry;
 use reqwest::{Client, ClientBuilder};
 use std::path::{Path, PathBuf};
+use std::sync::Arc;
 use std::time::Duration;
 use tempfile::TempDir;
 use url::Url;
@@ -26,6 +28,12 @@ pub static DEFAULT_SIGNATURE_BASEURL: &str =
     "https://mirror.openshift.com/pub/openshift-v4/signatures/openshift/release/";
 pub static DEFAULT_SIGNATURE_FETCH_TIMEOUT_SECS: u64 = 30;
 
+/// Number of layer blobs which are fetched concurrently.
+pub static DEFAULT_LAYER_FETCH_CONCURRENCY: usize = 4;
+
+/// Name of the layer store directory within the plugin's data directory.
+static LAYER_STORE_DIR: &str = "layers";
+
 // Defines the key for placing the data directory path in the IO parameters
 pub static GRAPH_DATA_DIR_PARAM_KEY: &str = "io.openshift.upgrades.secondary_metadata.directory";
 
@@ -77,6 +85,10 @@ pub struct DkrV2OpenshiftSecondaryMetadataScraperSettings {
     /// Public keys for signature verification
     #[default(Option::None)]
     public_keys_path: Option<PathBuf>,
+
+    /// Seconds for which an authenticated registry client is reused.
+    #[default(registry::DEFAULT_CLIENT_TTL_SECS)]
+    client_ttl_secs: u64,
 }
 
 impl DkrV2OpenshiftSecondaryMetadataScraperSettings {
@@ -145,9 +157,11 @@ pub struct DkrV2OpenshiftSecondaryMetadataScraperPlugin {
     settings: DkrV2OpenshiftSecondaryMetadataScraperSettings,
     output_allowlist: Vec<regex::Regex>,
     data_dir: TempDir,
+    layer_store: Arc<LayerStore>,
     state: FuturesMutex<State>,
     http_client: Client,
     registry: registry::Registry,
+    client_cache: registry::ClientCache,
 }
 
 impl DkrV2OpenshiftSecondaryMetadataScraperPlugin {
@@ -175,6 +189,7 @@ impl DkrV2OpenshiftSecondaryMetadataScraperPlugin {
         ))?;
 
         let data_dir = tempfile::tempdir_in(&settings.output_directory)?;
+        let layer_store = Arc::new(LayerStore::try_new(data_dir.path().join(LAYER_STORE_DIR))?);
 
         let registry = registry::Registry::try_from_str(&settings.registry)
             .context(format!("Parsing {} as Registry", &settings.registry))?;
@@ -193,15 +208,23 @@ impl DkrV2OpenshiftSecondaryMetadataScraperPlugin {
         let http_client = ClientBuilder::new()
             .gzip(true)
             .timeout(Duration::from_secs(DEFAULT_SIGNATURE_FETCH_TIMEOUT_SECS))
+            .tcp_keepalive(Some(Duration::from_secs(
+                registry::DEFAULT_TCP_KEEPALIVE_SECS,
+            )))
             .build()
             .context("Building reqwest client")?;
 
+        let client_cache =
+            registry::ClientCache::new(Duration::from_secs(settings.client_ttl_secs));
+
         Ok(Self {
             settings,
             output_allowlist,
             data_dir,
+            layer_store,
             http_client,
             registry,
+            client_cache,
             state: FuturesMutex::new(State::default()),
         })
     }
@@ -218,18 +241,29 @@ impl PluginSettings for DkrV2OpenshiftSecondaryMetadataScraperSettings {
 impl InternalPlugin for DkrV2OpenshiftSecondaryMetadataScraperPlugin {
     const PLUGIN_NAME: &'static str = Self::PLUGIN_NAME;
 
+    fn is_fetch_only(self: &Self) -> bool {
+        true
+    }
+
     async fn run_internal(self: &Self, mut io: InternalIO) -> Fallible<InternalIO> {
-        let registry_client = registry::new_registry_client(
-            &self.registry,
-            &self.settings.repository,
-            self.settings.username.as_deref(),
-            self.settings.password.as_deref(),
-        )
-        .await?;
+        let registry_client = self
+            .client_cache
+            .get_or_authenticate(
+                &self.registry,
+                &self.settings.repository,
+                self.settings.username.as_deref(),
+                self.settings.password.as_deref(),
+            )
+            .await?;
 
         let (manifest, reference) = registry_client
             .get_manifest_and_ref(&self.settings.repository, &self.settings.tag)
-            .await?;
+            .await
+            .map_err(|e| {
+                // The token may have been revoked, authenticate again on the next run.
+                self.client_cache.invalidate();
+                e
+            })?;
         trace!("manifest: {:?}, reference: {:?}", manifest, reference);
 
         if self.settings.verify_signature {
@@ -252,31 +286,39 @@ impl InternalPlugin for DkrV2OpenshiftSecondaryMetadataScraperPlugin {
         let layers = manifest.layers_digests(None)?;
         trace!("layers: {:?}", &layers);
 
+        let revision = cincinnati::plugins::input_revision(&layers);
         if self.are_layers_cached(&layers, &mut io).await? {
+            io.set_input_revision(Self::PLUGIN_NAME, &revision);
             return Ok(io);
         }
 
-        let layers_blobs = {
-            use futures::TryStreamExt;
-            layers
-                .iter()
-                .map(|layer| registry_client.get_blob(&self.settings.repository, &layer))
-                .collect::<futures::stream::FuturesOrdered<_>>()
-                .try_collect::<Vec<_>>()
-                .await?
-        };
+        self.fetch_missing_layers(&registry_client, &layers)
+            .await
+            .map_err(|e| {
+                // The token may have been revoked, authenticate again on the next run.
+                self.client_cache.invalidate();
+                e
+            })?;
 
         // wrap the blocking filesystem operations so that they don't block the runtime
-        let data_dir = tokio::task::block_in_place(|| async {
+        let data_dir = tokio::task::block_in_place(|| -> Fallible<TempDir> {
             let data_dir = self.create_data_dir(&mut io)?;
-            self.unpack_layers(layers_blobs.as_slice(), &data_dir)?;
-            self.remove_disallowed_files(&data_dir)?;
+            self.layer_store.assemble(&layers, data_dir.path())?;
+            trace!(
+                "Assembled {}/{} with {} layers to {:?}",
+                self.settings.registry,
+                self.settings.repository,
+                layers.len(),
+                data_dir,
+            );
+            self.remove_disallowed_files(data_dir.path())?;
+            self.layer_store.retain(&layers)?;
 
-            Result::<_, Error>::Ok(data_dir)
-        })
-        .await?;
+            Ok(data_dir)
+        })?;
 
         self.update_cache_state(layers, data_dir).await;
+        io.set_input_revision(Self::PLUGIN_NAME, &revision);
 
         Ok(io)
     }
@@ -324,20 +366,46 @@ impl DkrV2OpenshiftSecondaryMetadataScraperPlugin {
         Ok(data_dir)
     }
 
-    fn unpack_layers<P>(&self, layers_blobs: &[Vec<u8>], data_dir: P) -> Fallible<()>
-    where
-        P: AsRef<Path>,
-        P: std::fmt::Debug,
-    {
-        dkregistry::render::unpack(&layers_blobs, data_dir.as_ref())?;
-        trace!(
-            "Unpacked {}/{} with {} layers to {:?}",
-            self.settings.registry,
-            self.settings.repository,
-            layers_blobs.len(),
-            data_dir,
+    /// Fetch the layer blobs which are not in the layer store yet and unpack them into it.
+    ///
+    /// Blobs are fetched concurrently and each one is unpacked as soon as it
+    /// has been received, so that at most a few of them are held in memory.
+    async fn fetch_missing_layers(
+        &self,
+        registry_client: &dkregistry::v2::Client,
+        layers: &[String],
+    ) -> Fallible<()> {
+        use futures::{StreamExt, TryStreamExt};
+
+        let mut missing_layers = Vec::with_capacity(layers.len());
+        for layer in layers {
+            if self.layer_store.contains(layer)? {
+                trace!("Layer {} is already unpacked", layer);
+            } else {
+                missing_layers.push(layer.clone());
+            }
+        }
+        debug!(
+            "Fetching {}/{} layers for tag {}",
+            missing_layers.len(),
+            layers.len(),
+            self.settings.tag
         );
 
+        futures::stream::iter(missing_layers)
+            .map(|layer| async move {
+                let blob = registry_client
+                    .get_blob(&self.settings.repository, &layer)
+                    .await
+                    .context(format!("Fetching layer {}", &layer))?;
+
+                let layer_store = self.layer_store.clone();
+                tokio::task::spawn_blocking(move || layer_store.insert(&layer, &blob)).await?
+            })
+            .buffer_unordered(DEFAULT_LAYER_FETCH_CONCURRENCY)
+            .try_collect::<Vec<()>>()
+            .await?;
+
         Ok(())
     }
 
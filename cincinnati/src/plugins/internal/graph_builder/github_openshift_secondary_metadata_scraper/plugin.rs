@@ -2,6 +2,7 @@ use super::github_v3;
 use std::convert::{TryFrom, TryInto};
 
 use crate as cincinnati;
+use crate::plugins::internal::release_scrape_dockerv2::registry;
 
 use self::cincinnati::plugins::prelude::*;
 use self::cincinnati::plugins::prelude_plugin_impl::*;
@@ -27,6 +28,9 @@ pub static GITHUB_SCRAPER_TOKEN_PATH_ENV: &str = "CINCINNATI_GITHUB_SCRAPER_OAUT
 
 static USER_AGENT: &str = "openshift/cincinnati";
 
+/// Number of received tarball chunks which may wait for extraction.
+static EXTRACT_CHUNKS_IN_FLIGHT: usize = 16;
+
 /// Models the scrape mode
 #[derive(Serialize, Deserialize, Debug, Clone)]
 #[serde(rename_all = "lowercase")]
@@ -191,6 +195,15 @@ impl GithubOpenshiftSecondaryMetadataScraperPlugin {
 
         let data_dir = tempfile::tempdir_in(&settings.output_directory)?;
 
+        // Shared by all requests, so that pooled connections are reused across scrapes.
+        let client = reqwest::ClientBuilder::new()
+            .user_agent(USER_AGENT)
+            .tcp_keepalive(Some(std::time::Duration::from_secs(
+                registry::DEFAULT_TCP_KEEPALIVE_SECS,
+            )))
+            .build()
+            .context("Building reqwest client")?;
+
         Ok(Self {
             reference: settings
                 .reference
@@ -202,7 +215,7 @@ impl GithubOpenshiftSecondaryMetadataScraperPlugin {
             data_dir,
 
             state: FuturesMutex::new(State::default()),
-            client: reqwest::Client::default(),
+            client,
         })
     }
 
@@ -298,8 +311,10 @@ impl GithubOpenshiftSecondaryMetadataScraperPlugin {
         Ok(should_update)
     }
 
-    /// Fetch the tarball for the latest wanted commit and extract it to the output directory.
-    async fn download_wanted(&self) -> Fallible<(github_v3::Commit, Box<[u8]>)> {
+    /// Request the tarball for the latest wanted commit.
+    ///
+    /// The body is not read yet, so that it can be extracted while it is received.
+    async fn download_wanted(&self) -> Fallible<(github_v3::Commit, reqwest::Response)> {
         let commit_wanted = {
             let state = &self.state.lock().await;
             state
@@ -315,81 +330,63 @@ impl GithubOpenshiftSecondaryMetadataScraperPlugin {
         );
 
         trace!("Downloading {:?} from {}", &commit_wanted, &url);
-        reqwest::Client::new()
+        self.client
             .get(&url)
             .header(reqwest::header::USER_AGENT, USER_AGENT)
             .header(reqwest::header::ACCEPT, "application/vnd.github.v3.raw")
             .send()
             .await
-            .context(format!("Updating from tarball at {}", &url))?
-            .bytes()
-            .await
-            .context(format!(
-                "Getting bytes from the request response to {}",
-                &url,
-            ))
+            .context(format!("Updating from tarball at {}", &url))
             .map_err(Into::into)
-            .map(|bytes| (commit_wanted, bytes.to_vec().into_boxed_slice()))
+            .map(|response| (commit_wanted, response))
     }
 
-    /// Extract a given blob to the output directory, adhering to the output allowlist, and finally update the completed commit state.
-    async fn extract(&self, commit: github_v3::Commit, bytes: Box<[u8]>) -> Fallible<()> {
+    /// Extract the tarball in the given response to the output directory while it is received, adhering to the output allowlist, and finally update the completed commit state.
+    async fn extract(
+        &self,
+        commit: github_v3::Commit,
+        mut response: reqwest::Response,
+    ) -> Fallible<()> {
         // Use a tempdir as intermediary extraction target, and later rename to the destination
         let tmpdir = tempfile::tempdir_in(&self.settings.output_directory)?;
 
         {
-            let commit = commit.clone();
-            let output_allowlist = self.output_allowlist.clone();
-            let tmpdir = tmpdir.path().to_owned();
-
-            tokio::task::spawn_blocking(move || -> Fallible<()> {
-                use flate2::read::GzDecoder;
-                use tar::Archive;
-
-                let mut archive = Archive::new(GzDecoder::new(bytes.as_ref()));
-
-                archive
-                    .entries()?
-                    .filter_map(move |entry_result| match entry_result {
-                        Ok(entry) => {
-                            trace!("Processing entry {:?}", &entry.path());
-                            Some(entry)
-                        }
-
-                        Err(e) => {
-                            warn!(
-                                "Could not process entry in tarball from commit {:?}: {}",
-                                &commit, e
-                            );
-                            None
-                        }
-                    })
-                    .try_for_each(|mut entry| -> Fallible<_> {
-                        let path = entry
-                            .path()
-                            .context(format!(
-                                "Getting path from entry {:?}",
-                                &entry.header().clone().path().unwrap_or_default()
-                            ))?
-                            .to_str()
-                            .ok_or_else(|| format_err!("Could not get string from entry"))?
-                            .to_owned();
-                        trace!("Processing entry with path {:?}", &path);
-
-                        if output_allowlist
-                            .iter()
-                            .any(|allowlist_regex| allowlist_regex.is_match(&path))
-                        {
-                            debug!("Unpacking {:?} to {:?}", &path, &tmpdir);
-                            entry
-                                .unpack_in(&tmpdir)
-                                .context(format!("Unpacking {:?} to {:?}", &path, &tmpdir))?;
-                        };
-
-                        Ok(())
-                    })
-            })
-            .await??
+            let (sender, receiver) = tokio::sync::mpsc::channel(EXTRACT_CHUNKS_IN_FLIGHT);
+
+            let extraction = {
+                let commit = commit.clone();
+                let output_allowlist = self.output_allowlist.clone();
+                let tmpdir = tmpdir.path().to_owned();
+
+                tokio::task::spawn_blocking(move || {
+                    unpack_allowed(
+                        ChunkReader::new(receiver),
+                        &output_allowlist,
+                        &tmpdir,
+                        &commit,
+                    )
+                })
+            };
+
+            let download: Fallible<()> = async {
+                while let Some(chunk) = response
+                    .chunk()
+                    .await
+                    .context("Getting bytes from the tarball response")?
+                {
+                    if sender.send(chunk).await.is_err() {
+                        // The extraction has stopped, its result tells why.
+                        break;
+                    }
+                }
+                Ok(())
+            }
+            .await;
+            drop(sender);
+
+            let extracted = extraction.await?;
+            download?;
+            extracted?;
         };
 
         {
@@ -436,6 +433,91 @@ impl GithubOpenshiftSecondaryMetadataScraperPlugin {
     }
 }
 
+/// Blocking reader over body chunks which are received from an async task.
+struct ChunkReader {
+    receiver: tokio::sync::mpsc::Receiver<bytes::Bytes>,
+    chunk: bytes::Bytes,
+}
+
+impl ChunkReader {
+    fn new(receiver: tokio::sync::mpsc::Receiver<bytes::Bytes>) -> Self {
+        Self {
+            receiver,
+            chunk: Default::default(),
+        }
+    }
+}
+
+impl std::io::Read for ChunkReader {
+    fn read(&mut self, buf: &mut [u8]) -> std::io::Result<usize> {
+        while self.chunk.is_empty() {
+            match self.receiver.blocking_recv() {
+                Some(chunk) => self.chunk = chunk,
+                // The sender is gone, either at the end of the body or because the download failed.
+                None => return Ok(0),
+            }
+        }
+
+        let len = buf.len().min(self.chunk.len());
+        buf[..len].copy_from_slice(&self.chunk.split_to(len));
+        Ok(len)
+    }
+}
+
+/// Unpack the entries of the gzipped tarball which match the output allowlist into the given directory.
+fn unpack_allowed<R: std::io::Read>(
+    reader: R,
+    output_allowlist: &[regex::Regex],
+    target: &std::path::Path,
+    commit: &github_v3::Commit,
+) -> Fallible<()> {
+    use flate2::read::GzDecoder;
+    use tar::Archive;
+
+    let mut archive = Archive::new(GzDecoder::new(reader));
+
+    archive
+        .entries()?
+        .filter_map(move |entry_result| match entry_result {
+            Ok(entry) => {
+                trace!("Processing entry {:?}", &entry.path());
+                Some(entry)
+            }
+
+            Err(e) => {
+                warn!(
+                    "Could not process entry in tarball from commit {:?}: {}",
+                    &commit, e
+                );
+                None
+            }
+        })
+        .try_for_each(|mut entry| -> Fallible<_> {
+            let path = entry
+                .path()
+                .context(format!(
+                    "Getting path from entry {:?}",
+                    &entry.header().clone().path().unwrap_or_default()
+                ))?
+                .to_str()
+                .ok_or_else(|| format_err!("Could not get string from entry"))?
+                .to_owned();
+            trace!("Processing entry with path {:?}", &path);
+
+            if output_allowlist
+                .iter()
+                .any(|allowlist_regex| allowlist_regex.is_match(&path))
+            {
+                debug!("Unpacking {:?} to {:?}", &path, &target);
+                entry
+                    .unpack_in(&target)
+                    .context(format!("Unpacking {:?} to {:?}", &path, &target))?;
+            };
+
+            Ok(())
+        })
+}
+
 impl PluginSettings for GithubOpenshiftSecondaryMetadataScraperSettings {
     fn build_plugin(&self, _: Option<&prometheus::Registry>) -> Fallible<BoxedPlugin> {
         let plugin = GithubOpenshiftSecondaryMetadataScraperPlugin::try_new(self.clone())?;
@@ -447,6 +529,10 @@ impl PluginSettings for GithubOpenshiftSecondaryMetadataScraperSettings {
 impl InternalPlugin for GithubOpenshiftSecondaryMetadataScraperPlugin {
     const PLUGIN_NAME: &'static str = Self::PLUGIN_NAME;
 
+    fn is_fetch_only(self: &Self) -> bool {
+        true
+    }
+
     async fn run_internal(self: &Self, mut io: InternalIO) -> Fallible<InternalIO> {
         io.parameters.insert(
             GRAPH_DATA_DIR_PARAM_KEY.to_string(),
@@ -463,19 +549,86 @@ impl InternalPlugin for GithubOpenshiftSecondaryMetadataScraperPlugin {
             .context("Checking for new commit")?;
 
         if should_update {
-            let (commit, blob) = self
+            let (commit, response) = self
                 .download_wanted()
                 .await
                 .context("Downloading tarball")?;
-            self.extract(commit, blob)
+            self.extract(commit, response)
                 .await
                 .context("Extracting tarball")?;
         };
 
+        match &self.state.lock().await.commit_completed {
+            Some(commit) => io.set_input_revision(Self::PLUGIN_NAME, &commit.sha),
+            None => io.invalidate_input_revision(),
+        };
+
         Ok(io)
     }
 }
 
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn unpack_streamed_chunks() -> Fallible<()> {
+        let runtime = commons::testing::init_runtime()?;
+
+        let tarball = {
+            let mut builder = tar::Builder::new(flate2::write::GzEncoder::new(
+                Vec::new(),
+                flate2::Compression::default(),
+            ));
+            for (path, content) in &[("repo/version", "1"), ("repo/README.md", "readme")] {
+                let mut header = tar::Header::new_gnu();
+                header.set_size(content.len() as u64);
+                header.set_mode(0o644);
+                header.set_cksum();
+                builder.append_data(&mut header, path, content.as_bytes())?;
+            }
+            builder.into_inner()?.finish()?
+        };
+
+        let tmpdir = tempfile::tempdir()?;
+        let target = tmpdir.path().to_owned();
+        let commit = github_v3::Commit {
+            url: String::new(),
+            sha: "sha".to_string(),
+        };
+        let output_allowlist = vec![regex::Regex::new("version")?];
+
+        let (sender, receiver) = tokio::sync::mpsc::channel(1);
+        let extraction = runtime.spawn_blocking(move || {
+            unpack_allowed(
+                ChunkReader::new(receiver),
+                &output_allowlist,
+                &target,
+                &commit,
+            )
+        });
+
+        runtime.block_on(async {
+            for chunk in tarball.chunks(7) {
+                sender
+                    .send(bytes::Bytes::copy_from_slice(chunk))
+                    .await
+                    .map_err(|e| format_err!("{}", e))?;
+            }
+            drop(sender);
+            extraction.await?
+        })?;
+
+        assert_eq!(
+            std::fs::read_to_string(tmpdir.path().join("repo/version"))?,
+            "1"
+        );
+        assert!(!tmpdir.path().join("repo/README.md").exists());
+
+        Ok(())
+    }
+}
+
 #[cfg(test)]
 #[cfg(feature = "test-net")]
 mod network_tests {
@@ -4,7 +4,9 @@ use self::cincinnati::plugins::internal::graph_builder::github_openshift_seconda
 use self::cincinnati::plugins::prelude::*;
 use self::cincinnati::plugins::prelude_plugin_impl::*;
 
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
+use std::ffi::OsString;
+use std::sync::Mutex;
 
 pub static DEFAULT_KEY_FILTER: &str = "io.openshift.upgrades.graph";
 static SUPPORTED_VERSIONS: &[&str] = &["1.0.0"];
@@ -17,14 +19,14 @@ pub mod graph_data_model {
     use serde::Deserializer;
     use std::collections::HashMap;
     /// Represents the blocked edges files in the data repository.
-    #[derive(Debug, Deserialize)]
+    #[derive(Clone, Debug, Deserialize)]
     pub struct BlockedEdge {
         pub to: semver::Version,
         pub from: RegexWrapper,
     }
 
     /// New type used to implement Deserialize for regex::Regex so we can use it in the `BlockedEdge` struct
-    #[derive(Debug)]
+    #[derive(Clone, Debug)]
     pub struct RegexWrapper(regex::Regex);
 
     impl std::ops::Deref for RegexWrapper {
@@ -69,7 +71,7 @@ pub mod graph_data_model {
     }
 
     /// Represents the channel files in the data repository.
-    #[derive(Debug, Deserialize)]
+    #[derive(Clone, Debug, Deserialize)]
     pub struct Channel {
         pub name: String,
         pub versions: Vec<semver::Version>,
@@ -79,26 +81,6 @@ pub mod graph_data_model {
     pub type RawMetadata = HashMap<String, HashMap<String, String>>;
 }
 
-mod state {
-    //! This module contains types to manage the plugin state.
-
-    use std::collections::HashMap;
-    use std::sync::Arc;
-    use tokio::sync::RwLock as FuturesRwLock;
-
-    #[derive(Debug, Default)]
-    pub struct StateData {
-        sha: Option<String>,
-        metadata: HashMap<String, String>,
-    }
-
-    pub type State = Arc<FuturesRwLock<StateData>>;
-
-    pub fn new() -> State {
-        Arc::new(FuturesRwLock::new(Default::default()))
-    }
-}
-
 pub static DEFAULT_ARCH: &str = "amd64";
 
 /// Plugin settings.
@@ -136,14 +118,20 @@ pub struct OpenshiftSecondaryMetadataParserPlugin {
     settings: OpenshiftSecondaryMetadataParserSettings,
 
     // Stores the result of the last run
-    state: state::State,
+    memo: cincinnati::plugins::RevisionMemo,
+
+    // Store the files deserialized during the last run
+    blocked_edges_cache: FileCache<graph_data_model::BlockedEdge>,
+    channels_cache: FileCache<graph_data_model::Channel>,
 }
 
 impl OpenshiftSecondaryMetadataParserPlugin {
     pub fn new(settings: OpenshiftSecondaryMetadataParserSettings) -> Self {
         Self {
             settings,
-            state: state::new(),
+            memo: Default::default(),
+            blocked_edges_cache: Default::default(),
+            channels_cache: Default::default(),
         }
     }
 }
@@ -172,17 +160,38 @@ pub enum DeserializeDirectoryFilesError {
     Deserialize(PathBuf, serde_yaml::Error),
 }
 
+/// Number of files which are read and deserialized concurrently.
+pub static DEFAULT_LOAD_CONCURRENCY: usize = 16;
+
+/// Deserialized files by name, along with a hash of the content they were deserialized from.
+///
+/// This allows to skip deserializing unchanged files, even if they were
+/// extracted to a different directory.
+pub struct FileCache<T>(Mutex<HashMap<OsString, (u64, T)>>);
+
+impl<T> Default for FileCache<T> {
+    fn default() -> Self {
+        FileCache(Mutex::new(HashMap::new()))
+    }
+}
+
+impl<T> std::fmt::Debug for FileCache<T> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        let len = self.0.lock().map(|files| files.len()).unwrap_or_default();
+        write!(f, "FileCache {{ {} files }}", len)
+    }
+}
+
 pub async fn deserialize_directory_files<T>(
     path: &PathBuf,
     extension_re: regex::Regex,
     disallowed_errors: &HashSet<DeserializeDirectoryFilesErrorDiscriminants>,
+    cache: &FileCache<T>,
 ) -> Fallible<Vec<T>>
 where
-    T: DeserializeOwned,
+    T: DeserializeOwned + Clone + Send + 'static,
 {
-    use futures::Stream;
     use std::sync::Arc;
-    use std::sync::Mutex;
     use tokio_stream::wrappers::ReadDirStream;
     use tokio_stream::StreamExt;
 
@@ -212,7 +221,7 @@ where
         };
     }
 
-    let mut paths = ReadDirStream::new(
+    let mut paths: Vec<PathBuf> = ReadDirStream::new(
         tokio::fs::read_dir(&path)
             .await
             .context(format!("Reading directory {:?}", &path))?,
@@ -252,29 +261,40 @@ where
             );
             None
         }
-    });
-
-    let mut t_vec = Vec::with_capacity(match paths.size_hint() {
-        (_, Some(upper)) => upper,
-        (lower, None) => lower,
-    });
-
-    while let Some(path) = paths.next().await {
-        match tokio::fs::read(&path).await {
-            Ok(yaml) => match serde_yaml::from_slice(&yaml) {
-                Ok(value) => t_vec.push(value),
-                Err(e) => {
-                    warn!("Failed to deserialize file at {:?}: {}", &path, e);
-                    commit_error!(error, DeserializeDirectoryFilesError::Deserialize(path, e));
+    })
+    .collect()
+    .await;
+
+    // The directory order depends on the filesystem.
+    paths.sort();
+
+    let previous = match cache.0.lock() {
+        Ok(mut files) => std::mem::take(&mut *files),
+        Err(_) => Default::default(),
+    };
+    let loaded = load_files(paths, previous).await?;
+
+    let mut t_vec = Vec::with_capacity(loaded.len());
+    let mut files = HashMap::with_capacity(loaded.len());
+    for (path, result) in loaded {
+        match result {
+            Ok((hash, value)) => {
+                t_vec.push(value.clone());
+                if let Some(name) = path.file_name() {
+                    files.insert(name.to_os_string(), (hash, value));
                 }
-            },
+            }
             Err(e) => {
-                warn!("Couldn't read file {:?}: {}", &path, e);
-                commit_error!(error, DeserializeDirectoryFilesError::File(path, e));
+                warn!("{}", e);
+                commit_error!(error, e);
             }
         }
     }
 
+    if let Ok(mut cached) = cache.0.lock() {
+        *cached = files;
+    }
+
     if let Some(error) = Arc::try_unwrap(error)
         .map_err(|_| Error::msg("could not unwrap the error container"))?
         .into_inner()?
@@ -285,9 +305,121 @@ where
     Ok(t_vec)
 }
 
+/// Outcome of loading a single file, along with the hash of its content on success.
+type LoadedFile<T> = (PathBuf, Result<(u64, T), DeserializeDirectoryFilesError>);
+
+/// Read and deserialize the given files concurrently, keeping their order.
+///
+/// Files whose content matches the previously cached one are not deserialized
+/// again. The deserialization itself runs on the blocking thread pool.
+async fn load_files<T>(
+    paths: Vec<PathBuf>,
+    mut previous: HashMap<OsString, (u64, T)>,
+) -> Fallible<Vec<LoadedFile<T>>>
+where
+    T: DeserializeOwned + Send + 'static,
+{
+    use futures::{StreamExt, TryStreamExt};
+    use std::hash::{Hash, Hasher};
+
+    futures::stream::iter(paths)
+        .map(|path| {
+            let cached = path.file_name().and_then(|name| previous.remove(name));
+
+            async move {
+                let yaml = match tokio::fs::read(&path).await {
+                    Ok(yaml) => yaml,
+                    Err(e) => {
+                        let e = DeserializeDirectoryFilesError::File(path.clone(), e);
+                        return Ok((path, Err(e)));
+                    }
+                };
+
+                let hash = {
+                    let mut hasher = std::collections::hash_map::DefaultHasher::new();
+                    yaml.hash(&mut hasher);
+                    hasher.finish()
+                };
+
+                match cached {
+                    Some((cached_hash, value)) if cached_hash == hash => {
+                        trace!("{:?} is unchanged", &path);
+                        Ok((path, Ok((hash, value))))
+                    }
+                    _ => {
+                        let result =
+                            tokio::task::spawn_blocking(move || serde_yaml::from_slice::<T>(&yaml))
+                                .await
+                                .context(format!("Deserializing {:?}", &path))?;
+                        let result = result.map(|value| (hash, value)).map_err(|e| {
+                            DeserializeDirectoryFilesError::Deserialize(path.clone(), e)
+                        });
+                        Ok((path, result))
+                    }
+                }
+            }
+        })
+        .buffered(DEFAULT_LOAD_CONCURRENCY)
+        .try_collect()
+        .await
+}
+
 pub static BLOCKED_EDGES_DIR: &str = "blocked-edges";
 pub static CHANNELS_DIR: &str = "channels";
 
+/// Orders channel names by the part after the first '-', and then by the full name.
+fn channel_sort_key(name: &str) -> (&str, &str) {
+    (name.splitn(2, '-').nth(1).unwrap_or(""), name)
+}
+
+/// Releases of a graph indexed by their parsed version.
+///
+/// `semver::Version` disregards the build metadata for equality and hashing,
+/// hence releases which only differ in their build share an entry.
+struct SemverIndex(HashMap<semver::Version, Vec<(ReleaseId, semver::Version)>>);
+
+impl SemverIndex {
+    /// Parse the versions of all releases in the graph.
+    fn new(graph: &cincinnati::Graph) -> Self {
+        let mut index: HashMap<semver::Version, Vec<_>> =
+            HashMap::with_capacity(graph.releases_count() as usize);
+
+        for (release_id, release) in graph.view().releases() {
+            match semver::Version::from_str(release.version()) {
+                Ok(version) => index
+                    .entry(version.clone())
+                    .or_default()
+                    .push((release_id, version)),
+                Err(e) => warn!("{} is not SemVer compliant: {}", release.version(), e),
+            }
+        }
+
+        Self(index)
+    }
+
+    /// Returns the releases equal to the given version, disregarding the build metadata.
+    fn find<'a>(
+        &'a self,
+        version: &semver::Version,
+    ) -> impl Iterator<Item = &'a (ReleaseId, semver::Version)> {
+        self.0.get(version).into_iter().flatten()
+    }
+
+    /// Returns all releases with a SemVer compliant version.
+    fn releases(&self) -> impl Iterator<Item = &(ReleaseId, semver::Version)> {
+        self.0.values().flatten()
+    }
+
+    /// Returns the distinct build metadata of all releases, in order.
+    fn builds(&self) -> Vec<Vec<semver::Identifier>> {
+        self.releases()
+            .map(|(_, version)| version.build.clone())
+            .collect::<std::collections::BTreeSet<_>>()
+            .into_iter()
+            .collect()
+    }
+}
+
 impl OpenshiftSecondaryMetadataParserPlugin {
     pub(crate) const PLUGIN_NAME: &'static str = "openshift-secondary-metadata-parse";
 
@@ -320,6 +452,7 @@ impl OpenshiftSecondaryMetadataParserPlugin {
     async fn process_raw_metadata(
         &self,
         graph: &mut cincinnati::Graph,
+        semver_index: &SemverIndex,
         data_dir: &PathBuf,
     ) -> Fallible<()> {
         let path = data_dir.join("raw/metadata.json");
@@ -331,40 +464,35 @@ impl OpenshiftSecondaryMetadataParserPlugin {
         )?;
         debug!("Found {} raw metadata entries", raw_metadata.len());
 
-        raw_metadata.iter().for_each(|(version, metadata)| {
-            metadata.iter().for_each(|(key, value)| {
-                graph.find_by_fn_mut(|release| {
-                    let release_semver = semver::Version::from_str(release.version())
-                        .context(format!("Parsing {} as SemVer", release.version()));
-                    if let Err(e) = &release_semver {
-                        warn!("{}", e);
-                    }
+        for (version, metadata) in &raw_metadata {
+            let version_semver = match semver::Version::from_str(version) {
+                Ok(version_semver) => version_semver,
+                Err(e) => {
+                    warn!("Parsing {} as SemVer: {}", &version, e);
+                    continue;
+                }
+            };
 
-                    let version_semver = semver::Version::from_str(version)
-                        .context(format!("Parsing {} as SemVer", &version));
-                    if let Err(e) = &version_semver {
-                        warn!("{}", e);
+            for (release_id, _) in semver_index.find(&version_semver) {
+                let release_metadata = match graph.get_metadata_as_ref_mut(release_id) {
+                    Ok(release_metadata) => release_metadata,
+                    Err(e) => {
+                        warn!("[raw_metadata] {}", e);
+                        continue;
                     }
+                };
 
-                    match (release_semver, version_semver) {
-                        (Ok(release_semver), Ok(version_semver))
-                            if release_semver == version_semver =>
-                        {
-                            release.get_metadata_mut().map(|metadata| {
-                                metadata
-                                    .entry((*key).to_string())
-                                    .and_modify(|previous_add| {
-                                        *previous_add += &format!(",{}", &value)
-                                    })
-                                    .or_insert_with(|| (*value).to_string())
-                            });
-                            true
-                        }
-                        _ => false,
-                    }
-                });
-            })
-        });
+                for (key, value) in metadata {
+                    release_metadata
+                        .entry(key.to_string())
+                        .and_modify(|previous_add| {
+                            previous_add.push(',');
+                            previous_add.push_str(value)
+                        })
+                        .or_insert_with(|| value.to_string());
+                }
+            }
+        }
 
         Ok(())
     }
@@ -372,6 +500,7 @@ impl OpenshiftSecondaryMetadataParserPlugin {
     async fn process_blocked_edges(
         &self,
         graph: &mut cincinnati::Graph,
+        semver_index: &SemverIndex,
         data_dir: &PathBuf,
     ) -> Fallible<()> {
         let blocked_edges_dir = data_dir.join(BLOCKED_EDGES_DIR);
@@ -379,6 +508,7 @@ impl OpenshiftSecondaryMetadataParserPlugin {
             &blocked_edges_dir,
             regex::Regex::new("ya+ml")?,
             &self.settings.disallowed_errors,
+            &self.blocked_edges_cache,
         )
         .await
         .context(format!(
@@ -391,23 +521,7 @@ impl OpenshiftSecondaryMetadataParserPlugin {
             blocked_edges.len()
         );
 
-        let architectures = {
-            let mut collection = std::collections::BTreeSet::<Vec<semver::Identifier>>::new();
-
-            let _ = graph.find_by_fn_mut(|release| {
-                match semver::Version::from_str(release.version()) {
-                    Ok(version_semver) => {
-                        collection.insert(version_semver.build);
-                    }
-                    Err(e) => warn!("{} is not SemVer compliant: {}", release.version(), e),
-                };
-
-                // we don't care about this result
-                false
-            });
-
-            collection.into_iter().collect::<Vec<_>>()
-        };
+        let architectures = semver_index.builds();
 
         trace!(
             "Will block edges for these architectures by default: {:?}",
@@ -481,6 +595,7 @@ impl OpenshiftSecondaryMetadataParserPlugin {
     async fn process_channels(
         &self,
         graph: &mut cincinnati::Graph,
+        semver_index: &SemverIndex,
         data_dir: &PathBuf,
     ) -> Fallible<()> {
         let channels_dir = data_dir.join(CHANNELS_DIR);
@@ -488,91 +603,62 @@ impl OpenshiftSecondaryMetadataParserPlugin {
             &channels_dir,
             regex::Regex::new("ya+ml")?,
             &self.settings.disallowed_errors,
+            &self.channels_cache,
         )
         .await
         .context(format!("Reading channels from {:?}", channels_dir))?;
         debug!("Found {} valid channel declarations.", channels.len());
 
         let channels_key = format!("{}.release.channels", self.settings.key_prefix);
-        channels.into_iter().for_each(|channel|
-        // Find out for each channel
-        {
-            let versions_in_channel = channel
-                .versions
-                .iter()
-                .collect::<Vec<&semver::Version>>();
-
-            let releases_in_channel = graph.find_by_fn_mut(|release| {
-                let release_semver = match semver::Version::from_str(release.version())
-                    .context(format!("Parsing {} as SemVer", release.version()))
-                {
-                    Ok(semver) => semver,
-                    Err(e) => {
-                        warn!("{}", e);
-                        return false;
-                    }
-                };
 
-                versions_in_channel.iter().any(|release_in_channel| {
-                    let release_eq = *release_in_channel == &release_semver;
-
-                    // Comparing semver::Version is not enough because it disregards the build information.
-                    let build_eq = release_in_channel.build.is_empty() ||
-                    release_in_channel.build == release_semver.build;
-
-                    release_eq && build_eq
-                })
-            });
-
-            for (release_id, version) in releases_in_channel {
-                let metadata = match
-                    graph
-                    .get_metadata_as_ref_mut(&release_id)
-                    .context(format!(
-                        "[channels] Getting mutable metadata for {}",
-                        &version
-                    )) {
-                    Ok(metadata) => metadata,
-                    Err(e) => {
-                        warn!("{}", e);
-                        continue;
-                    }
-                };
-
-                metadata
-                    .entry(channels_key.clone())
-                    .and_modify(|channels_value| {
-                        channels_value.extend(format!(",{}", &channel.name).chars());
+        // Collect the channels of every release before building the metadata values.
+        let mut release_channels: HashMap<ReleaseId, Vec<&str>> = HashMap::new();
+        for channel in &channels {
+            for version in &channel.versions {
+                // Comparing semver::Version is not enough because it disregards the build information.
+                semver_index
+                    .find(version)
+                    .filter(|(_, release_semver)| {
+                        version.build.is_empty() || version.build == release_semver.build
                     })
-                    .or_insert_with(|| channel.name.clone());
+                    .for_each(|(release_id, _)| {
+                        let names = release_channels.entry(release_id.clone()).or_default();
+                        // A channel may list a version once per build.
+                        if names.last() != Some(&channel.name.as_str()) {
+                            names.push(&channel.name);
+                        }
+                    });
             }
-        });
+        }
 
         // Sort the channels as some tests and consumers might already depend on
         // the sorted output which existed in the hack util which is replaced by this plugin.
-        let sorted_releases = graph.find_by_fn_mut(|release| {
-            release
-                .get_metadata_mut()
-                .map(|metadata| {
-                    metadata.entry(channels_key.clone()).and_modify(|channels| {
-                        let mut channels_split = channels.split(',').collect::<Vec<_>>();
-                        // this has to match the sorting at
-                        // https://github.com/openshift/cincinnati-graph-data/blob/5fc8dd0825b42369de8070ecba2ae0c49d0a99d9/hack/graph-util.py#L187
-                        channels_split.sort_by(|a, b| a.cmp(b));
-                        channels_split.sort_by(|a, b| {
-                            let a_split: Vec<&str> = a.splitn(2, '-').collect();
-                            let b_split: Vec<&str> = b.splitn(2, '-').collect();
-                            a_split[1].cmp(b_split[1])
-                        });
-                        *channels = channels_split.join(",")
-                    })
-                })
-                .is_some()
-        });
-        debug!(
-            "Sorted channels metadata of {} releases.",
-            sorted_releases.len()
-        );
+        let release_ids: Vec<ReleaseId> = graph.view().releases().map(|(id, _)| id).collect();
+        let mut sorted_releases = 0;
+        for release_id in release_ids {
+            let metadata = match graph.get_metadata_as_ref_mut(&release_id) {
+                Ok(metadata) => metadata,
+                // abstract releases don't carry metadata
+                Err(_) => continue,
+            };
+
+            let mut names = release_channels.remove(&release_id).unwrap_or_default();
+            let existing = metadata.remove(&channels_key);
+            if let Some(existing) = &existing {
+                names.extend(existing.split(','));
+            } else if names.is_empty() {
+                continue;
+            }
+
+            // this has to match the sorting at
+            // https://github.com/openshift/cincinnati-graph-data/blob/5fc8dd0825b42369de8070ecba2ae0c49d0a99d9/hack/graph-util.py#L187
+            names.sort_by(|a, b| channel_sort_key(a).cmp(&channel_sort_key(b)));
+
+            let value = names.join(",");
+            metadata.insert(channels_key.clone(), value);
+            sorted_releases += 1;
+        }
+        debug!("Sorted channels metadata of {} releases.", sorted_releases);
 
         Ok(())
     }
@@ -585,10 +671,31 @@ impl InternalPlugin for OpenshiftSecondaryMetadataParserPlugin {
     async fn run_internal(self: &Self, mut io: InternalIO) -> Fallible<InternalIO> {
         let data_dir = self.get_data_directory(&io);
 
+        // The contents of the data directory are only covered by the input
+        // revision if the directory was provided by a scraper.
+        let revision = io
+            .input_revision()
+            .filter(|_| io.parameters.contains_key(GRAPH_DATA_DIR_PARAM_KEY));
+        if let Some(graph) = revision.as_ref().and_then(|r| self.memo.get(r)) {
+            debug!("secondary metadata and releases unchanged since the last run");
+            io.graph = graph;
+            return Ok(io);
+        }
+
         self.process_version(&data_dir).await?;
-        self.process_raw_metadata(&mut io.graph, &data_dir).await?;
-        self.process_blocked_edges(&mut io.graph, &data_dir).await?;
-        self.process_channels(&mut io.graph, &data_dir).await?;
+
+        // None of the steps changes the versions, so they're only parsed once.
+        let semver_index = SemverIndex::new(&io.graph);
+        self.process_raw_metadata(&mut io.graph, &semver_index, &data_dir)
+            .await?;
+        self.process_blocked_edges(&mut io.graph, &semver_index, &data_dir)
+            .await?;
+        self.process_channels(&mut io.graph, &semver_index, &data_dir)
+            .await?;
+
+        if let Some(revision) = &revision {
+            self.memo.set(revision, &io.graph);
+        }
 
         Ok(io)
     }
@@ -743,4 +850,85 @@ mod tests {
             .context("Running plugin")
             .unwrap_err();
     }
+
+    #[test]
+    fn semver_index_ignores_build() -> Fallible<()> {
+        use super::{channel_sort_key, SemverIndex};
+
+        let metadata = ["+amd64", "+s390x", ""]
+            .iter()
+            .enumerate()
+            .map(|(i, suffix)| {
+                let metadata = [("version_suffix".to_string(), suffix.to_string())]
+                    .iter()
+                    .cloned()
+                    .collect();
+                (i, metadata)
+            })
+            .collect();
+        let graph = cincinnati::testing::TestGraphBuilder::new()
+            .with_version_template("1.0.0")
+            .with_metadata(metadata)
+            .build();
+
+        let index = SemverIndex::new(&graph);
+        let version = semver::Version::from_str("1.0.0")?;
+        assert_eq!(index.find(&version).count(), 3);
+        assert_eq!(index.builds().len(), 3);
+
+        let mut names = vec!["stable-4.2", "fast-4.1", "candidate-4.2", "stable-4.1"];
+        names.sort_by(|a, b| channel_sort_key(a).cmp(&channel_sort_key(b)));
+        assert_eq!(
+            names,
+            vec!["fast-4.1", "stable-4.1", "candidate-4.2", "stable-4.2"]
+        );
+
+        Ok(())
+    }
+
+    #[test]
+    fn deserialize_directory_files_in_order_with_cache() -> Fallible<()> {
+        use super::graph_data_model::Channel;
+        use super::{deserialize_directory_files, FileCache};
+
+        let runtime = commons::testing::init_runtime()?;
+        let tmpdir = tempfile::tempdir()?;
+        let cache: FileCache<Channel> = Default::default();
+
+        let write_channel = |name: &str, versions: &str| -> Fallible<()> {
+            let yaml = format!("name: {}\nversions: [{}]\n", name, versions);
+            std::fs::write(tmpdir.path().join(format!("{}.yaml", name)), yaml)?;
+            Ok(())
+        };
+
+        let load = || -> Fallible<Vec<(String, usize)>> {
+            let channels = runtime.block_on(deserialize_directory_files(
+                &tmpdir.path().to_path_buf(),
+                regex::Regex::new("ya+ml")?,
+                &Default::default(),
+                &cache,
+            ))?;
+            Ok(channels
+                .into_iter()
+                .map(|channel| (channel.name, channel.versions.len()))
+                .collect())
+        };
+
+        for i in (0..20).rev() {
+            write_channel(&format!("channel-{:02}", i), "1.0.0")?;
+        }
+        let expected: Vec<(String, usize)> =
+            (0..20).map(|i| (format!("channel-{:02}", i), 1)).collect();
+        assert_eq!(load()?, expected);
+        assert_eq!(load()?, expected);
+
+        write_channel("channel-03", "1.0.0, 1.0.1")?;
+        std::fs::remove_file(tmpdir.path().join("channel-05.yaml"))?;
+        let mut expected = expected;
+        expected[3].1 = 2;
+        expected.remove(5);
+        assert_eq!(load()?, expected);
+
+        Ok(())
+    }
 }
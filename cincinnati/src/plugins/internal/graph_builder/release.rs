@@ -34,7 +34,7 @@ impl Into<cincinnati::Release> for Release {
         cincinnati::Release::Concrete(cincinnati::ConcreteRelease {
             version: self.metadata.version.to_string(),
             payload: self.source,
-            metadata: self.metadata.metadata,
+            metadata: self.metadata.metadata.into_iter().collect(),
         })
     }
 }
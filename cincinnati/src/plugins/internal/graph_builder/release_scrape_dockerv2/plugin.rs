@@ -48,6 +48,15 @@ pub struct ReleaseScrapeDockerv2Settings {
     /// Takes precedence over username and password
     #[default(Option::None)]
     pub credentials_path: Option<PathBuf>,
+
+    /// File persisting the release metadata cache across restarts.
+    /// Entries are appended as releases are fetched and loaded on startup.
+    #[default(Option::None)]
+    pub cache_path: Option<PathBuf>,
+
+    /// Seconds for which an authenticated registry client is reused.
+    #[default(registry::DEFAULT_CLIENT_TTL_SECS)]
+    pub client_ttl_secs: u64,
 }
 
 impl PluginSettings for ReleaseScrapeDockerv2Settings {
@@ -74,6 +83,12 @@ impl ReleaseScrapeDockerv2Settings {
                 settings.credentials_path = None;
             }
         }
+        if let Some(cache_path) = &settings.cache_path {
+            if cache_path == &std::path::PathBuf::from("") {
+                warn!("Settings contain an empty cache path, setting to None");
+                settings.cache_path = None;
+            }
+        }
 
         Ok(Box::new(settings))
     }
@@ -85,6 +100,12 @@ pub struct ReleaseScrapeDockerv2Plugin {
     settings: ReleaseScrapeDockerv2Settings,
     registry: registry::Registry,
     cache: registry::cache::Cache,
+    cache_file: Option<registry::cache::CacheFile>,
+    negative_layers: registry::NegativeLayerCache,
+    client_cache: registry::ClientCache,
+
+    #[debug(skip)]
+    memo: cincinnati::plugins::RevisionMemo,
 
     #[debug(skip)]
     graph_upstream_raw_releases: prometheus::IntGauge,
@@ -124,10 +145,34 @@ impl ReleaseScrapeDockerv2Plugin {
             settings.password = password;
         }
 
+        let cache = cache.unwrap_or_else(registry::cache::new);
+
+        let cache_file = match &settings.cache_path {
+            Some(cache_path) => {
+                let cache_file = registry::cache::CacheFile::open(cache_path)?;
+                let loaded = cache_file
+                    .load_into(&cache)
+                    .context(format!("Loading release cache from {:?}", cache_path))?;
+                info!(
+                    "loaded {} cached release metadata entries from {:?}",
+                    loaded, cache_path
+                );
+                Some(cache_file)
+            }
+            None => None,
+        };
+
+        let client_cache =
+            registry::ClientCache::new(std::time::Duration::from_secs(settings.client_ttl_secs));
+
         Ok(Self {
             settings,
             registry,
-            cache: cache.unwrap_or_else(registry::cache::new),
+            cache,
+            cache_file,
+            negative_layers: Default::default(),
+            client_cache,
+            memo: Default::default(),
             graph_upstream_raw_releases,
         })
     }
@@ -138,16 +183,32 @@ impl InternalPlugin for ReleaseScrapeDockerv2Plugin {
     const PLUGIN_NAME: &'static str = Self::PLUGIN_NAME;
 
     async fn run_internal(self: &Self, io: InternalIO) -> Fallible<InternalIO> {
+        let registry_client = self
+            .client_cache
+            .get_or_authenticate(
+                &self.registry,
+                &self.settings.repository,
+                self.settings.username.as_ref().map(String::as_ref),
+                self.settings.password.as_ref().map(String::as_ref),
+            )
+            .await?;
+
         let releases = registry::fetch_releases(
             &self.registry,
             &self.settings.repository,
-            self.settings.username.as_ref().map(String::as_ref),
-            self.settings.password.as_ref().map(String::as_ref),
+            &registry_client,
             self.cache.clone(),
+            self.cache_file.as_ref(),
+            &self.negative_layers,
             &self.settings.manifestref_key,
             self.settings.fetch_concurrency,
         )
         .await
+        .map_err(|e| {
+            // The token may have been revoked, authenticate again on the next scrape.
+            self.client_cache.invalidate();
+            e
+        })
         .context("failed to fetch all release metadata")?;
 
         if releases.is_empty() {
@@ -161,12 +222,33 @@ impl InternalPlugin for ReleaseScrapeDockerv2Plugin {
         self.graph_upstream_raw_releases
             .set(releases.len().try_into()?);
 
-        let graph = cincinnati::plugins::internal::graph_builder::release::create_graph(releases)?;
+        // Releases are immutable per manifestref, so the set of sources identifies the graph.
+        let revision = {
+            let mut sources: Vec<&str> = releases.iter().map(|r| r.source.as_str()).collect();
+            sources.sort_unstable();
+            cincinnati::plugins::input_revision(&sources)
+        };
+
+        let graph = match self.memo.get(&revision) {
+            Some(graph) => {
+                debug!("releases unchanged since the last scrape");
+                graph
+            }
+            None => {
+                let graph =
+                    cincinnati::plugins::internal::graph_builder::release::create_graph(releases)?;
+                self.memo.set(&revision, &graph);
+                graph
+            }
+        };
 
-        Ok(InternalIO {
+        let mut io = InternalIO {
             graph,
             parameters: io.parameters,
-        })
+        };
+        io.set_input_revision(Self::PLUGIN_NAME, &revision);
+
+        Ok(io)
     }
 }
 
@@ -15,31 +15,50 @@
 use crate as cincinnati;
 
 use self::cincinnati::plugins::internal::graph_builder::release::Metadata;
-use self::cincinnati::plugins::internal::graph_builder::release::MetadataKind;
 use self::cincinnati::plugins::prelude_plugin_impl::*;
 
 use flate2::read::GzDecoder;
-use futures::lock::Mutex as FuturesMutex;
 use futures::prelude::*;
 use futures::TryStreamExt;
 use log::{debug, error, trace, warn};
-use semver::Version;
 use serde::Deserialize;
 use serde_json;
+use std::collections::HashSet;
 use std::fs::File;
 use std::io::Read;
 use std::iter::Iterator;
 use std::path::{Path, PathBuf};
 use std::string::String;
-use std::sync::Arc;
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
 use tar::Archive;
 
+/// Default lifetime of an authenticated registry client in seconds.
+///
+/// Registries don't tell the client when its bearer token expires, so this
+/// stays below the common token lifetime of five minutes.
+pub static DEFAULT_CLIENT_TTL_SECS: u64 = 240;
+
+/// Interval of TCP keep-alive probes on pooled connections in seconds.
+pub static DEFAULT_TCP_KEEPALIVE_SECS: u64 = 60;
+
 /// Module for the release cache
 pub mod cache {
     use super::cincinnati::plugins::internal::graph_builder::release::Metadata;
+    use commons::prelude_errors::*;
+    use log::warn;
+    use std::collections::hash_map::RandomState;
     use std::collections::HashMap;
-    use std::sync::Arc;
-    use tokio::sync::RwLock as FuturesRwLock;
+    use std::fs::{File, OpenOptions};
+    use std::future::Future;
+    use std::hash::{BuildHasher, Hash, Hasher};
+    use std::io::{BufRead, BufReader, Read, Seek, SeekFrom, Write};
+    use std::path::{Path, PathBuf};
+    use std::sync::{Arc, Mutex};
+    use tokio::sync::OnceCell;
+
+    /// Number of independently locked shards.
+    const SHARDS: usize = 16;
 
     /// The key type of the cache
     type Key = String;
@@ -50,15 +69,207 @@ pub mod cache {
     /// The sync cache to hold the `Release` cache
     type CacheSync = HashMap<Key, Value>;
 
-    /// The async wrapper for `Cache`
-    type CacheAsync<T> = FuturesRwLock<T>;
+    /// A cache slot, shared by all tasks looking up the same key.
+    type Slot = Arc<OnceCell<Value>>;
 
     /// The cache to hold the `Release` cache
-    pub type Cache = Arc<CacheAsync<CacheSync>>;
+    pub type Cache = Arc<ReleaseCache>;
 
     /// Instantiate a new cache
     pub fn new() -> Cache {
-        Arc::new(CacheAsync::new(CacheSync::new()))
+        Arc::new(ReleaseCache::default())
+    }
+
+    /// Sharded release cache with single-flight lookups.
+    ///
+    /// Shard locks are only held to look up the slot of a key, never while
+    /// fetching, so concurrent lookups of different keys don't contend.
+    #[derive(Debug)]
+    pub struct ReleaseCache {
+        hasher: RandomState,
+        shards: Vec<Mutex<HashMap<Key, Slot>>>,
+    }
+
+    impl Default for ReleaseCache {
+        fn default() -> Self {
+            Self {
+                hasher: RandomState::new(),
+                shards: (0..SHARDS).map(|_| Default::default()).collect(),
+            }
+        }
+    }
+
+    impl ReleaseCache {
+        fn slot(&self, key: &str) -> Slot {
+            let mut hasher = self.hasher.build_hasher();
+            key.hash(&mut hasher);
+            let shard = &self.shards[hasher.finish() as usize % SHARDS];
+
+            // The map stays consistent even if a holder of the lock panicked.
+            let mut slots = shard.lock().unwrap_or_else(|e| e.into_inner());
+            match slots.get(key) {
+                Some(slot) => slot.clone(),
+                None => slots.entry(key.to_owned()).or_default().clone(),
+            }
+        }
+
+        /// Returns the cached value for the given key, if it has been fetched.
+        pub fn get(&self, key: &str) -> Option<Value> {
+            self.slot(key).get().cloned()
+        }
+
+        /// Returns the cached value for the given key, fetching it if needed.
+        ///
+        /// Exactly one caller runs `fetch` for a key while the others wait for
+        /// its result. If it fails, the next waiting caller tries again.
+        pub async fn get_or_try_fetch<F, Fut>(&self, key: &str, fetch: F) -> Fallible<Value>
+        where
+            F: FnOnce() -> Fut,
+            Fut: Future<Output = Fallible<Value>>,
+        {
+            let slot = self.slot(key);
+            let value = slot.get_or_try_init(fetch).await?;
+
+            Ok(value.clone())
+        }
+
+        /// Insert the given entries, keeping values which have already been fetched.
+        pub fn extend(&self, entries: CacheSync) {
+            for (key, value) in entries {
+                let _ = self.slot(&key).set(value);
+            }
+        }
+
+        /// Returns the number of fetched values.
+        pub fn len(&self) -> usize {
+            self.shards
+                .iter()
+                .map(|shard| {
+                    let slots = shard.lock().unwrap_or_else(|e| e.into_inner());
+                    slots.values().filter(|slot| slot.initialized()).count()
+                })
+                .sum()
+        }
+
+        /// Returns true if no value has been fetched.
+        pub fn is_empty(&self) -> bool {
+            self.len() == 0
+        }
+    }
+
+    /// Append-only file which persists the cache across restarts.
+    ///
+    /// Each line holds one JSON-encoded `[manifestref, metadata]` pair. As
+    /// the cache is keyed on the immutable manifest reference, entries never
+    /// need to be rewritten; a later line for the same key takes precedence.
+    #[derive(Debug)]
+    pub struct CacheFile {
+        path: PathBuf,
+        file: Mutex<File>,
+    }
+
+    impl CacheFile {
+        /// Open the file at the given path for appending, creating it if needed.
+        pub fn open(path: &Path) -> Fallible<Self> {
+            let mut file = OpenOptions::new()
+                .create(true)
+                .read(true)
+                .append(true)
+                .open(path)
+                .context(format!("could not open cache file {:?}", path))?;
+
+            // Terminate a line which was cut short so that it doesn't swallow the next entry.
+            if file.seek(SeekFrom::End(0))? > 0 {
+                let mut last = [0u8];
+                file.seek(SeekFrom::End(-1))?;
+                file.read_exact(&mut last)?;
+                if last[0] != b'\n' {
+                    file.write_all(b"\n")?;
+                }
+            }
+
+            Ok(Self {
+                path: path.to_owned(),
+                file: Mutex::new(file),
+            })
+        }
+
+        /// Read all entries which have been persisted so far.
+        ///
+        /// Lines which can't be parsed, e.g. one truncated by a crash, are skipped.
+        pub fn load(&self) -> Fallible<CacheSync> {
+            let file = File::open(&self.path)
+                .context(format!("could not open cache file {:?}", self.path))?;
+
+            let mut entries = CacheSync::new();
+            for (number, line) in BufReader::new(file).lines().enumerate() {
+                let line = line.context(format!("could not read cache file {:?}", self.path))?;
+                match serde_json::from_str::<(Key, Value)>(&line) {
+                    Ok((key, value)) => {
+                        entries.insert(key, value);
+                    }
+                    Err(e) => warn!(
+                        "skipping line {} of cache file {:?}: {}",
+                        number + 1,
+                        self.path,
+                        e
+                    ),
+                }
+            }
+
+            Ok(entries)
+        }
+
+        /// Load all persisted entries into the given cache.
+        ///
+        /// Returns the number of loaded entries.
+        pub fn load_into(&self, cache: &Cache) -> Fallible<usize> {
+            let entries = self.load()?;
+            let count = entries.len();
+            cache.extend(entries);
+
+            Ok(count)
+        }
+
+        /// Persist a single entry.
+        pub fn append(&self, key: &str, value: &Value) -> Fallible<()> {
+            let mut line = serde_json::to_vec(&(key, value))?;
+            line.push(b'\n');
+
+            self.file
+                .lock()
+                .map_err(|_| format_err!("cache file lock is poisoned"))?
+                .write_all(&line)
+                .context(format!("could not write to cache file {:?}", self.path))?;
+
+            Ok(())
+        }
+    }
+}
+
+/// Remembers the layers which are known not to contain release metadata.
+///
+/// Layers are addressed by the digest of their content, so a layer without
+/// release metadata never gains it. Release images of a repository share most
+/// of their layers, which thus only need to be downloaded once. Unlike trying
+/// a particular layer first, this keeps the top-most layer with metadata winning.
+#[derive(Debug, Default)]
+pub struct NegativeLayerCache(Mutex<HashSet<String>>);
+
+impl NegativeLayerCache {
+    /// Returns true if the layer is known not to contain release metadata.
+    pub fn contains(&self, layer_digest: &str) -> bool {
+        self.0
+            .lock()
+            .map(|layers| layers.contains(layer_digest))
+            .unwrap_or(false)
+    }
+
+    /// Remember that the layer doesn't contain release metadata.
+    pub fn insert(&self, layer_digest: &str) {
+        if let Ok(mut layers) = self.0.lock() {
+            layers.insert(layer_digest.to_string());
+        }
     }
 }
 
@@ -238,107 +449,151 @@ pub async fn new_registry_client(
     Ok(client)
 }
 
+/// Authenticated registry client which is reused across scrapes until it expires.
+///
+/// Reusing the client keeps its connection pool and bearer token, instead of
+/// performing the TLS handshakes and token requests again on every scrape.
+pub struct ClientCache {
+    ttl: Duration,
+    client: Mutex<Option<(dkregistry::v2::Client, Instant)>>,
+}
+
+impl std::fmt::Debug for ClientCache {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("ClientCache")
+            .field("ttl", &self.ttl)
+            .finish()
+    }
+}
+
+impl ClientCache {
+    /// Create an empty cache, keeping clients for the given duration.
+    pub fn new(ttl: Duration) -> Self {
+        Self {
+            ttl,
+            client: Mutex::new(None),
+        }
+    }
+
+    /// Return the cached client, or authenticate a new one if it is missing or expired.
+    pub async fn get_or_authenticate(
+        &self,
+        registry: &Registry,
+        repo: &str,
+        username: Option<&str>,
+        password: Option<&str>,
+    ) -> Fallible<dkregistry::v2::Client> {
+        if let Some(client) = self.get() {
+            return Ok(client);
+        }
+
+        trace!(
+            "authenticating new client for {}",
+            registry.host_port_string()
+        );
+        let client = new_registry_client(registry, repo, username, password).await?;
+        if let Ok(mut cached) = self.client.lock() {
+            *cached = Some((client.clone(), Instant::now()));
+        }
+
+        Ok(client)
+    }
+
+    /// Drop the cached client, e.g. after a request was rejected.
+    pub fn invalidate(&self) {
+        if let Ok(mut cached) = self.client.lock() {
+            *cached = None;
+        }
+    }
+
+    fn get(&self) -> Option<dkregistry::v2::Client> {
+        let cached = self.client.lock().ok()?;
+        cached
+            .as_ref()
+            .filter(|(_, created)| created.elapsed() < self.ttl)
+            .map(|(client, _)| client.clone())
+    }
+}
+
 /// Fetches a vector of all release metadata from the given repository, hosted on the given
 /// registry.
 pub async fn fetch_releases(
     registry: &Registry,
     repo: &str,
-    username: Option<&str>,
-    password: Option<&str>,
+    registry_client: &dkregistry::v2::Client,
     cache: cache::Cache,
+    cache_file: Option<&cache::CacheFile>,
+    negative_layers: &NegativeLayerCache,
     manifestref_key: &str,
     concurrency: usize,
 ) -> Result<Vec<cincinnati::plugins::internal::graph_builder::release::Release>, Error> {
-    let registry_client = new_registry_client(registry, repo, username, password).await?;
-
-    let registry_client_get_tags = registry_client.clone();
-    let tags = Box::pin(get_tags(repo, &registry_client_get_tags).await);
-
-    let releases = {
-        let estimated_releases = match tags.size_hint() {
-            (_, Some(upper)) => upper,
-            (lower, None) => lower,
-        };
-        Arc::new(FuturesMutex::new(Vec::with_capacity(estimated_releases)))
-    };
-
-    tags.try_for_each_concurrent(concurrency, |tag| {
-        let registry_client = registry_client.clone();
-        let cache = cache.clone();
-        let releases = releases.clone();
-
-        async move {
-            trace!("[{}] Fetching release", tag);
-            let (tag, manifest, manifestref) =
-                get_manifest_and_ref(tag, repo.to_owned(), &registry_client).await?;
-
-            // Try to read the architecture from the manifest
-            let arch = match manifest.architectures() {
-                Ok(archs) => {
-                    // We don't support ManifestLists now, so we expect only 1
-                    // architecture for the given manifest
-                    ensure!(
-                        archs.len() == 1,
-                        "[{}] broke assumption of exactly one architecture per tag: {:?}",
-                        tag,
-                        archs
-                    );
-                    archs.first().map(std::string::ToString::to_string)
-                }
-                Err(e) => {
-                    error!(
-                        "could not get architecture from manifest for tag {}: {}",
-                        tag, e
-                    );
-                    None
-                }
-            };
-
-            let layers_digests = manifest
-                .layers_digests(arch.as_ref().map(String::as_str))
-                .map_err(|e| format_err!("{}", e))
-                .context(format!(
-                    "[{}] could not get layers_digests from manifest",
-                    tag
-                ))?
-                // Reverse the order to start with the top-most layer
-                .into_iter()
-                .rev()
-                .collect();
-
-            let release = match lookup_or_fetch(
-                layers_digests,
-                registry_client.to_owned(),
-                registry.to_owned(),
-                repo.to_owned(),
-                tag.to_owned(),
-                &cache,
-                manifestref.clone(),
-                manifestref_key.to_string(),
-                arch,
-            )
-            .await?
-            {
-                Some(release) => release,
-                None => {
-                    // Reminder: this means the layer_digests point to layers
-                    // without any release and we've cached this before
-                    return Ok(());
-                }
-            };
-
-            releases.lock().await.push(release);
-
-            Ok(())
-        }
-    })
-    .await?;
+    let tags = Box::pin(get_tags(repo, registry_client).await);
+
+    // Tags whose layers don't contain any release yield `None` and are skipped
+    let releases = tags
+        .map_ok(|tag| {
+            let registry_client = registry_client.clone();
+            let cache = cache.clone();
+
+            async move {
+                trace!("[{}] Fetching release", tag);
+                let (tag, manifest, manifestref) =
+                    get_manifest_and_ref(tag, repo.to_owned(), &registry_client).await?;
+
+                // Try to read the architecture from the manifest
+                let arch = match manifest.architectures() {
+                    Ok(archs) => {
+                        // We don't support ManifestLists now, so we expect only 1
+                        // architecture for the given manifest
+                        ensure!(
+                            archs.len() == 1,
+                            "[{}] broke assumption of exactly one architecture per tag: {:?}",
+                            tag,
+                            archs
+                        );
+                        archs.first().map(std::string::ToString::to_string)
+                    }
+                    Err(e) => {
+                        error!(
+                            "could not get architecture from manifest for tag {}: {}",
+                            tag, e
+                        );
+                        None
+                    }
+                };
 
-    let releases = Arc::<
-        FuturesMutex<Vec<cincinnati::plugins::internal::graph_builder::release::Release>>,
-    >::try_unwrap(releases)
-    .map_err(|_| format_err!("Unwrapping the shared Releases vector. This must not fail."))?
-    .into_inner();
+                let layers_digests = manifest
+                    .layers_digests(arch.as_ref().map(String::as_str))
+                    .map_err(|e| format_err!("{}", e))
+                    .context(format!(
+                        "[{}] could not get layers_digests from manifest",
+                        tag
+                    ))?
+                    // Reverse the order to start with the top-most layer
+                    .into_iter()
+                    .rev()
+                    .collect();
+
+                lookup_or_fetch(
+                    layers_digests,
+                    registry_client.to_owned(),
+                    registry.to_owned(),
+                    repo.to_owned(),
+                    tag.to_owned(),
+                    &cache,
+                    cache_file,
+                    negative_layers,
+                    manifestref.clone(),
+                    manifestref_key.to_string(),
+                    arch,
+                )
+                .await
+            }
+        })
+        .try_buffer_unordered(concurrency)
+        .try_filter_map(future::ok)
+        .try_collect()
+        .await?;
 
     Ok(releases)
 }
@@ -347,11 +602,14 @@ pub async fn fetch_releases(
 ///
 /// Each tagged release is looked up at most once and both
 /// positive (Some metadata) and negative (None) results cached
-/// indefinitely.
+/// indefinitely. Concurrent lookups of the same manifest reference
+/// wait for the first one instead of fetching it again.
 ///
 /// Update Images with release metadata should be immutable, but
 /// tags on registry can be mutated at any time. Thus, the cache
 /// is keyed on the manifest reference.
+///
+/// If a cache file is given, fetched metadata is also written through to it.
 #[allow(clippy::too_many_arguments)]
 async fn lookup_or_fetch(
     layer_digests: Vec<String>,
@@ -360,39 +618,21 @@ async fn lookup_or_fetch(
     repo: String,
     tag: String,
     cache: &cache::Cache,
+    cache_file: Option<&cache::CacheFile>,
+    negative_layers: &NegativeLayerCache,
     manifestref: String,
     manifestref_key: String,
     arch: Option<String>,
 ) -> Fallible<Option<cincinnati::plugins::internal::graph_builder::release::Release>> {
-    let cached_metadata = {
-        // Nest the guard in a scope to guarantee that the cache isn't locked when trying to write to it later
-        cache.read().await.get(&manifestref).map(Clone::clone)
-    };
-
-    let metadata = match cached_metadata {
-        Some(cached_metadata) => {
-            trace!(
-                "[{}] Using cached release metadata for manifestref {}",
-                &tag,
-                &manifestref
-            );
-            cached_metadata.clone()
-        }
-        None => {
-            let placeholder = Option::from(Metadata {
-                kind: MetadataKind::V0,
-                version: Version::new(0, 0, 0),
-                previous: vec![],
-                next: vec![],
-                metadata: Default::default(),
-            });
-            cache.write().await.insert(manifestref.clone(), placeholder);
-
+    let fetch = {
+        let (repo, tag, manifestref) = (repo.clone(), tag.clone(), manifestref.clone());
+        move || async move {
             let metadata = find_first_release_metadata(
                 layer_digests,
                 registry_client,
                 repo.clone(),
                 tag.clone(),
+                negative_layers,
             )
             .await
             .context("failed to find first release")?
@@ -416,14 +656,27 @@ async fn lookup_or_fetch(
                 metadata
             });
 
+            if let Some(cache_file) = cache_file {
+                if let Err(e) = cache_file.append(&manifestref, &metadata) {
+                    warn!("[{}] Could not persist release metadata: {}", &tag, e);
+                }
+            }
+
             trace!("[{}] Caching release metadata", &tag);
-            cache
-                .write()
-                .await
-                .insert(manifestref.clone(), metadata.clone());
+            Ok(metadata)
+        }
+    };
 
-            metadata
+    let metadata = match cache.get(&manifestref) {
+        Some(cached_metadata) => {
+            trace!(
+                "[{}] Using cached release metadata for manifestref {}",
+                &tag,
+                &manifestref
+            );
+            cached_metadata
         }
+        None => cache.get_or_try_fetch(&manifestref, fetch).await?,
     };
 
     Ok(metadata.map(|metadata| {
@@ -465,18 +718,30 @@ fn format_release_source(registry: &Registry, repo: &str, manifestref: &str) ->
     format!("{}/{}@{}", registry.host_port_string(), repo, manifestref)
 }
 
+/// Look for the release metadata in the given layers, top-most first.
+///
+/// Layers which are known not to contain release metadata are skipped.
 async fn find_first_release_metadata(
     layer_digests: Vec<String>,
     registry_client: dkregistry::v2::Client,
     repo: String,
     tag: String,
+    negative_layers: &NegativeLayerCache,
 ) -> Fallible<Option<Metadata>> {
-    for layer_digest in layer_digests {
-        trace!("[{}] Downloading layer {}", &tag, &layer_digest);
-        let (repo, tag) = (repo.clone(), tag.clone());
+    for layer_digest in &layer_digests {
+        if negative_layers.contains(layer_digest) {
+            trace!(
+                "[{}] Skipping layer {} without metadata",
+                &tag,
+                layer_digest
+            );
+            continue;
+        }
+
+        trace!("[{}] Downloading layer {}", &tag, layer_digest);
 
         let blob = registry_client
-            .get_blob(&repo, &layer_digest)
+            .get_blob(&repo, layer_digest)
             .map_err(|e| format_err!("{}", e))
             .await?;
 
@@ -486,21 +751,22 @@ async fn find_first_release_metadata(
             "[{}] Looking for {} in archive {} with {} bytes",
             &tag,
             &metadata_filename,
-            &layer_digest,
+            layer_digest,
             &blob.len(),
         );
 
-        match tokio::task::spawn_blocking(move || assemble_metadata(&blob, metadata_filename))
-            .await?
+        match tokio::task::spawn_blocking(move || {
+            assemble_metadata(blob.as_slice(), metadata_filename)
+        })
+        .await?
         {
-            Ok(metadata) => {
-                return Ok(Some(metadata));
-            }
+            Ok(metadata) => return Ok(Some(metadata)),
             Err(e) => {
                 debug!(
                     "[{}] Could not assemble metadata from layer ({}): {}",
-                    &tag, &layer_digest, e,
+                    &tag, layer_digest, e,
                 );
+                negative_layers.insert(layer_digest);
             }
         }
     }
@@ -532,7 +798,10 @@ struct Layer {
     blob_sum: String,
 }
 
-fn assemble_metadata(blob: &[u8], metadata_filename: &str) -> Result<Metadata, Error> {
+/// Read the metadata file from a gzipped tar archive.
+///
+/// The archive is decompressed incrementally and reading stops at the metadata file.
+fn assemble_metadata<R: Read>(blob: R, metadata_filename: &str) -> Result<Metadata, Error> {
     let mut archive = Archive::new(GzDecoder::new(blob));
     match archive
         .entries()?
@@ -550,21 +819,122 @@ fn assemble_metadata(blob: &[u8], metadata_filename: &str) -> Result<Metadata, E
                 false
             }
         }) {
-        Some(mut file) => {
-            let mut contents = String::new();
-            file.read_to_string(&mut contents)?;
-            match serde_json::from_str::<Metadata>(&contents) {
-                Ok(m) => Ok::<Metadata, Error>(m),
-                Err(e) => bail!(format!("couldn't parse '{}': {}", metadata_filename, e)),
-            }
-        }
+        Some(file) => match serde_json::from_reader::<_, Metadata>(file) {
+            Ok(m) => Ok::<Metadata, Error>(m),
+            Err(e) => bail!(format!("couldn't parse '{}': {}", metadata_filename, e)),
+        },
         None => bail!(format!("'{}' not found", metadata_filename)),
     }
 }
 
 #[cfg(test)]
 mod tests {
+    use self::cincinnati::plugins::internal::graph_builder::release::MetadataKind;
     use super::*;
+    use semver::Version;
+    use std::io::Write;
+
+    #[test]
+    fn cache_file_roundtrip() -> Fallible<()> {
+        let tmpdir = tempfile::tempdir()?;
+        let path = tmpdir.path().join("releases.jsonl");
+
+        let metadata = Metadata {
+            kind: MetadataKind::V0,
+            version: Version::new(4, 8, 1),
+            previous: vec![Version::new(4, 8, 0)],
+            next: vec![],
+            metadata: Default::default(),
+        };
+
+        {
+            let cache_file = cache::CacheFile::open(&path)?;
+            cache_file.append("sha256:a", &Some(metadata.clone()))?;
+            cache_file.append("sha256:b", &None)?;
+        }
+
+        // Simulate a write which was interrupted.
+        std::fs::OpenOptions::new()
+            .append(true)
+            .open(&path)?
+            .write_all(b"[\"sha256:c\", {\"kind\"")?;
+
+        let cache_file = cache::CacheFile::open(&path)?;
+        cache_file.append("sha256:d", &None)?;
+
+        let cache = cache::new();
+        let loaded = cache_file.load_into(&cache)?;
+        assert_eq!(loaded, 3);
+
+        assert_eq!(cache.len(), 3);
+        assert_eq!(cache.get("sha256:a"), Some(Some(metadata)));
+        assert_eq!(cache.get("sha256:b"), Some(None));
+        assert_eq!(cache.get("sha256:c"), None);
+        assert_eq!(cache.get("sha256:d"), Some(None));
+
+        Ok(())
+    }
+
+    #[test]
+    fn client_cache_expires() -> Fallible<()> {
+        let client = dkregistry::v2::Client::configure()
+            .registry("localhost:5000")
+            .build()?;
+
+        let cache = ClientCache::new(Duration::from_millis(50));
+        assert!(cache.get().is_none());
+
+        *cache.client.lock().unwrap() = Some((client.clone(), Instant::now()));
+        assert!(cache.get().is_some());
+
+        cache.invalidate();
+        assert!(cache.get().is_none());
+
+        *cache.client.lock().unwrap() = Some((client, Instant::now()));
+        std::thread::sleep(Duration::from_millis(100));
+        assert!(cache.get().is_none());
+
+        Ok(())
+    }
+
+    #[test]
+    fn negative_layer_cache_remembers_layers() {
+        let negative_layers = NegativeLayerCache::default();
+        assert!(!negative_layers.contains("sha256:a"));
+
+        negative_layers.insert("sha256:a");
+        assert!(negative_layers.contains("sha256:a"));
+        assert!(!negative_layers.contains("sha256:b"));
+    }
+
+    #[test]
+    fn assemble_metadata_from_layer() -> Fallible<()> {
+        let metadata_filename = "release-manifests/release-metadata";
+        let json = br#"{"kind": "cincinnati-metadata-v0", "version": "4.8.1"}"#;
+
+        let mut builder = tar::Builder::new(flate2::write::GzEncoder::new(
+            Vec::new(),
+            flate2::Compression::fast(),
+        ));
+        for (path, contents) in &[
+            ("release-manifests/image-references", &b"{}"[..]),
+            (metadata_filename, &json[..]),
+        ] {
+            let mut header = tar::Header::new_gnu();
+            header.set_size(contents.len() as u64);
+            header.set_mode(0o644);
+            header.set_cksum();
+            builder.append_data(&mut header, path, *contents)?;
+        }
+        let blob = builder.into_inner()?.finish()?;
+
+        let metadata = assemble_metadata(blob.as_slice(), metadata_filename)?;
+        assert_eq!(metadata.version, Version::new(4, 8, 1));
+
+        assert!(assemble_metadata(blob.as_slice(), "missing").is_err());
+
+        Ok(())
+    }
 
     #[test]
     fn registry_try_parse_valid() {
@@ -3,16 +3,31 @@
 //! The fetch process is all or nothing, i.e. it fails in these cases:
 //! * a Release doesn't contain the manifestref in its metadata
 //! * the dynamic metadata can't be fetched for a single manifestref
+//!
+//! Labels are fetched concurrently and can optionally be cached across runs,
+//! so that a refresh only needs to fetch the labels of new manifestrefs.
 
 use crate as cincinnati;
 
 use self::cincinnati::plugins::prelude::*;
 use self::cincinnati::plugins::prelude_plugin_impl::*;
 
+use futures::lock::Mutex as FuturesMutex;
+use futures::TryStreamExt;
+use std::collections::{HashMap, HashSet};
+use std::sync::{Arc, RwLock};
+use std::time::{Duration, Instant};
+
 pub static DEFAULT_QUAY_LABEL_FILTER: &str = "io.openshift.upgrades.graph";
 pub static DEFAULT_QUAY_MANIFESTREF_KEY: &str = "io.openshift.upgrades.graph.release.manifestref";
 pub static DEFAULT_QUAY_REPOSITORY: &str = "openshift";
 
+/// Default number of concurrent label requests.
+pub static DEFAULT_QUAY_FETCH_CONCURRENCY: usize = 16;
+
+/// Default lifetime of cached labels in seconds, 0 disables the cache.
+pub static DEFAULT_QUAY_LABELS_CACHE_TTL_SECS: u64 = 0;
+
 /// Plugin settings.
 #[derive(Clone, Debug, Deserialize, SmartDefault)]
 #[serde(default)]
@@ -31,15 +46,36 @@ struct QuayMetadataSettings {
 
     #[default(DEFAULT_QUAY_MANIFESTREF_KEY.to_string())]
     manifestref_key: String,
+
+    #[default(DEFAULT_QUAY_FETCH_CONCURRENCY)]
+    fetch_concurrency: usize,
+
+    /// If non-zero, labels are reused for this many seconds before they are fetched again.
+    ///
+    /// Labels which are added to an existing manifestref, e.g. to block edges, are
+    /// picked up with up to this delay.
+    #[default(DEFAULT_QUAY_LABELS_CACHE_TTL_SECS)]
+    labels_cache_ttl_secs: u64,
 }
 
 /// Metadata fetcher for quay.io API.
-#[derive(Debug)]
+#[derive(CustomDebug)]
 pub struct QuayMetadataFetchPlugin {
     client: quay::v1::Client,
     repo: String,
     label_filter: String,
     manifestref_key: String,
+    fetch_concurrency: usize,
+    labels_cache_ttl: Option<Duration>,
+
+    #[debug(skip)]
+    labels_cache: RwLock<HashMap<String, CachedLabels>>,
+}
+
+/// Labels of a manifestref along with the time they were fetched.
+struct CachedLabels {
+    labels: Arc<Vec<(String, String)>>,
+    fetched: Instant,
 }
 
 impl PluginSettings for QuayMetadataSettings {
@@ -51,6 +87,11 @@ impl PluginSettings for QuayMetadataSettings {
             cfg.manifestref_key,
             cfg.api_credentials_path,
             cfg.api_base,
+            cfg.fetch_concurrency,
+            match cfg.labels_cache_ttl_secs {
+                0 => None,
+                secs => Some(Duration::from_secs(secs)),
+            },
         )?;
         Ok(new_plugin!(InternalPluginWrapper(plugin)))
     }
@@ -76,6 +117,8 @@ impl QuayMetadataFetchPlugin {
         manifestref_key: String,
         api_token_path: Option<PathBuf>,
         api_base: String,
+        fetch_concurrency: usize,
+        labels_cache_ttl: Option<Duration>,
     ) -> Fallible<Self> {
         let api_token = api_token_path
             .map(quay::read_credentials)
@@ -92,21 +135,78 @@ impl QuayMetadataFetchPlugin {
             repo,
             label_filter,
             manifestref_key,
+            fetch_concurrency,
+            labels_cache_ttl,
+            labels_cache: Default::default(),
         })
     }
+
+    /// Fetch the labels for the given manifestref, or reuse them from the cache.
+    async fn get_labels(&self, manifestref: String) -> Fallible<Arc<Vec<(String, String)>>> {
+        let cached = match (self.labels_cache_ttl, self.labels_cache.read()) {
+            (Some(ttl), Ok(cache)) => cache
+                .get(&manifestref)
+                .filter(|cached| cached.fetched.elapsed() < ttl)
+                .map(|cached| cached.labels.clone()),
+            _ => None,
+        };
+        if let Some(labels) = cached {
+            trace!("[{}] using cached labels", manifestref);
+            return Ok(labels);
+        }
+
+        let labels = self
+            .client
+            .get_labels(
+                self.repo.clone(),
+                manifestref.clone(),
+                Some(self.label_filter.clone()),
+            )
+            .await?
+            .into_iter()
+            .map(Into::into)
+            .collect::<Vec<(String, String)>>();
+        let labels = Arc::new(labels);
+
+        if self.labels_cache_ttl.is_some() {
+            if let Ok(mut cache) = self.labels_cache.write() {
+                cache.insert(
+                    manifestref,
+                    CachedLabels {
+                        labels: labels.clone(),
+                        fetched: Instant::now(),
+                    },
+                );
+            }
+        }
+
+        Ok(labels)
+    }
+
+    /// Drop cached labels which expired or belong to manifestrefs which are gone.
+    fn prune_labels_cache(&self, manifestrefs: &HashSet<&str>) {
+        let ttl = match self.labels_cache_ttl {
+            Some(ttl) => ttl,
+            None => return,
+        };
+
+        if let Ok(mut cache) = self.labels_cache.write() {
+            cache.retain(|manifestref, cached| {
+                manifestrefs.contains(manifestref.as_str()) && cached.fetched.elapsed() < ttl
+            });
+        }
+    }
 }
 
 #[async_trait]
 impl InternalPlugin for QuayMetadataFetchPlugin {
     const PLUGIN_NAME: &'static str = Self::PLUGIN_NAME;
 
-    async fn run_internal(self: &Self, io: InternalIO) -> Fallible<InternalIO> {
-        let (mut graph, parameters) = (io.graph, io.parameters);
-
+    async fn run_internal(self: &Self, mut io: InternalIO) -> Fallible<InternalIO> {
         trace!("fetching metadata from quay labels...");
 
         let release_manifestrefs: Vec<(ReleaseId, String, String)> =
-            graph.find_by_metadata_key(&self.manifestref_key);
+            io.graph.find_by_metadata_key(&self.manifestref_key);
 
         if release_manifestrefs.is_empty() {
             warn!(
@@ -115,33 +215,55 @@ impl InternalPlugin for QuayMetadataFetchPlugin {
             );
         }
 
-        let mut labels_with_releaseinfo = Vec::with_capacity(release_manifestrefs.len());
-        for (release_id, release_version, manifestref) in release_manifestrefs {
-            let (client, repo, label_filter) = (
-                self.client.clone(),
-                self.repo.clone(),
-                self.label_filter.clone(),
-            );
+        self.prune_labels_cache(
+            &release_manifestrefs
+                .iter()
+                .map(|(_, _, manifestref)| manifestref.as_str())
+                .collect(),
+        );
 
-            let quay_labels = client
-                .get_labels(
-                    repo.clone(),
-                    manifestref.clone(),
-                    Some(label_filter.clone()),
-                )
-                .await?
-                .into_iter()
-                .map(Into::into)
-                .collect::<Vec<(String, String)>>();
+        let labels_with_releaseinfo =
+            FuturesMutex::new(Vec::with_capacity(release_manifestrefs.len()));
+        futures::stream::iter(release_manifestrefs.into_iter().map(Ok))
+            .try_for_each_concurrent(
+                self.fetch_concurrency,
+                |(release_id, release_version, manifestref)| {
+                    let labels_with_releaseinfo = &labels_with_releaseinfo;
+
+                    async move {
+                        let quay_labels = self.get_labels(manifestref).await?;
+                        labels_with_releaseinfo
+                            .lock()
+                            .await
+                            .push((quay_labels, (release_id, release_version)));
+                        Ok::<(), Error>(())
+                    }
+                },
+            )
+            .await?;
+
+        let labels_with_releaseinfo = labels_with_releaseinfo.into_inner();
 
-            labels_with_releaseinfo.push((quay_labels, (release_id, release_version)));
+        if io.input_revision().is_some() {
+            let mut revisions: Vec<String> = labels_with_releaseinfo
+                .iter()
+                .map(|(labels, (_, release_version))| {
+                    cincinnati::plugins::input_revision(&(release_version, labels.as_slice()))
+                })
+                .collect();
+            revisions.sort_unstable();
+            io.set_input_revision(
+                Self::PLUGIN_NAME,
+                &cincinnati::plugins::input_revision(&revisions),
+            );
         }
 
         for (labels, (release_id, release_version)) in labels_with_releaseinfo {
-            let metadata = graph
+            let metadata = io
+                .graph
                 .get_metadata_as_ref_mut(&release_id)
                 .context("trying to find metadata for release")?;
-            for (key, value) in labels {
+            for (key, value) in labels.iter().cloned() {
                 let warn_msg = if metadata.contains_key(&key) {
                     Some(format!(
                         "[{}] key '{}' already exists. overwriting with value '{}'. ",
@@ -168,7 +290,91 @@ impl InternalPlugin for QuayMetadataFetchPlugin {
             }
         }
 
-        Ok(InternalIO { graph, parameters })
+        Ok(io)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use cincinnati::testing::{generate_custom_graph, TestMetadata};
+    use cincinnati::MapImpl;
+    use commons::testing::init_runtime;
+
+    #[test]
+    fn labels_are_fetched_once_with_cache() -> Fallible<()> {
+        let runtime = init_runtime()?;
+
+        let manifestrefs = ["sha256:cached0", "sha256:cached1"];
+        let mocks: Vec<mockito::Mock> = manifestrefs
+            .iter()
+            .enumerate()
+            .map(|(i, manifestref)| {
+                mockito::mock(
+                    "GET",
+                    mockito::Matcher::Regex(format!(
+                        "^/api/v1/repository/test/labels/manifest/{}/labels",
+                        manifestref
+                    )),
+                )
+                .with_status(200)
+                .with_header("content-type", "application/json")
+                .with_body(format!(
+                    r#"{{"labels":[{{"key":"{}.previous.remove","value":"{}","media_type":"text/plain","id":"{}","source_type":"api"}}]}}"#,
+                    DEFAULT_QUAY_LABEL_FILTER, i, i
+                ))
+                .expect(1)
+                .create()
+            })
+            .collect();
+
+        let metadata = |with_labels: bool| -> TestMetadata {
+            manifestrefs
+                .iter()
+                .enumerate()
+                .map(|(i, manifestref)| {
+                    let mut metadata: MapImpl<String, String> = [(
+                        DEFAULT_QUAY_MANIFESTREF_KEY.to_string(),
+                        manifestref.to_string(),
+                    )]
+                    .iter()
+                    .cloned()
+                    .collect();
+                    if with_labels {
+                        metadata.insert(
+                            format!("{}.previous.remove", DEFAULT_QUAY_LABEL_FILTER),
+                            i.to_string(),
+                        );
+                    }
+                    (i, metadata)
+                })
+                .collect()
+        };
+
+        let plugin = QuayMetadataFetchPlugin::try_new(
+            "test/labels".to_string(),
+            DEFAULT_QUAY_LABEL_FILTER.to_string(),
+            DEFAULT_QUAY_MANIFESTREF_KEY.to_string(),
+            None,
+            format!("{}/api/v1/", mockito::server_url()),
+            DEFAULT_QUAY_FETCH_CONCURRENCY,
+            Some(Duration::from_secs(60)),
+        )?;
+
+        let expected_graph = generate_custom_graph("image", metadata(true), None);
+        for _ in 0..2 {
+            let processed_graph = runtime
+                .block_on(plugin.run_internal(InternalIO {
+                    graph: generate_custom_graph("image", metadata(false), None),
+                    parameters: Default::default(),
+                }))?
+                .graph;
+            assert_eq!(expected_graph, processed_graph);
+        }
+
+        mocks.iter().for_each(mockito::Mock::assert);
+
+        Ok(())
     }
 }
 
@@ -327,6 +533,8 @@ mod tests_net {
                 DEFAULT_QUAY_MANIFESTREF_KEY.to_string(),
                 None,
                 quay::v1::DEFAULT_API_BASE.to_string(),
+                DEFAULT_QUAY_FETCH_CONCURRENCY,
+                None,
             )
             .expect("could not initialize the QuayMetadataPlugin"),
         );
@@ -387,6 +595,8 @@ mod tests_net {
                 DEFAULT_QUAY_MANIFESTREF_KEY.to_string(),
                 Some(token_file.into()),
                 quay::v1::DEFAULT_API_BASE.to_string(),
+                DEFAULT_QUAY_FETCH_CONCURRENCY,
+                None,
             )
             .context("could not initialize the QuayMetadataPlugin")?,
         );
@@ -42,20 +42,22 @@ impl InternalPlugin for NodeRemovePlugin {
     async fn run_internal(self: &Self, io: InternalIO) -> Fallible<InternalIO> {
         let mut graph = io.graph;
         let key_suffix = "release.remove";
-
-        let to_remove = {
-            graph
-                .find_by_metadata_pair(&format!("{}.{}", self.key_prefix, key_suffix), "true")
-                .into_iter()
-                .map(|(release_id, version)| {
-                    trace!("queuing '{}' for removal", version);
-                    release_id
-                })
-                .collect()
-        };
+        let key = format!("{}.{}", self.key_prefix, key_suffix);
+
+        let keep = graph
+            .view()
+            .retain(|release| match release {
+                cincinnati::Release::Concrete(concrete_release) => concrete_release
+                    .metadata
+                    .get(&key)
+                    .map_or(true, |value| value != "true"),
+                _ => true,
+            })
+            .into_mask();
 
         // remove all matches from the Graph
-        let removed = graph.remove_releases(to_remove);
+        let removed = graph.releases_count() - keep.count() as u64;
+        graph.retain_releases(&keep);
 
         trace!("removed {} releases", removed);
 
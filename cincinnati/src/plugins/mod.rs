@@ -19,11 +19,58 @@ use commons::tracing::get_tracer;
 use std::collections::HashMap;
 use std::convert::{TryFrom, TryInto};
 use std::fmt::Debug;
+use std::hash::{Hash, Hasher};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
 
+use futures::future::try_join_all;
 use opentelemetry::{
-    trace::{mark_span_as_active, FutureExt, Tracer},
+    trace::{FutureExt, TraceContextExt, Tracer},
     Context as ot_context,
 };
+use prometheus::{histogram_opts, HistogramVec, IntCounterVec, IntGaugeVec, Opts};
+
+lazy_static::lazy_static! {
+    static ref PLUGIN_DURATION: HistogramVec = HistogramVec::new(
+        histogram_opts!(
+            "plugin_duration_seconds",
+            "Duration of a single plugin run in seconds",
+            vec![0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 5.0, 30.0, 120.0]
+        ),
+        &["plugin"]
+    )
+    .unwrap();
+    static ref PLUGIN_ERRORS: IntCounterVec = IntCounterVec::new(
+        Opts::new("plugin_errors_total", "Total number of failed plugin runs"),
+        &["plugin"]
+    )
+    .unwrap();
+    static ref PLUGIN_GRAPH_RELEASES: IntGaugeVec = IntGaugeVec::new(
+        Opts::new(
+            "plugin_graph_releases",
+            "Number of releases in the graph of the last plugin run, before and after it"
+        ),
+        &["plugin", "stage"]
+    )
+    .unwrap();
+    static ref PLUGIN_GRAPH_EDGES: IntGaugeVec = IntGaugeVec::new(
+        Opts::new(
+            "plugin_graph_edges",
+            "Number of edges in the graph of the last plugin run, before and after it"
+        ),
+        &["plugin", "stage"]
+    )
+    .unwrap();
+}
+
+/// Register the plugin pipeline metrics to a prometheus registry.
+pub fn register_metrics(registry: &prometheus::Registry) -> Fallible<()> {
+    registry.register(Box::new(PLUGIN_DURATION.clone()))?;
+    registry.register(Box::new(PLUGIN_ERRORS.clone()))?;
+    registry.register(Box::new(PLUGIN_GRAPH_RELEASES.clone()))?;
+    registry.register(Box::new(PLUGIN_GRAPH_EDGES.clone()))?;
+    Ok(())
+}
 
 pub mod prelude {
     use crate as cincinnati;
@@ -116,6 +163,98 @@ pub struct InternalIO {
     pub parameters: HashMap<String, String>,
 }
 
+/// Parameter key prefix under which plugins record the revision of the external inputs they consumed.
+///
+/// Each plugin which fetches data records an identifier of it under its own
+/// name. All other plugins are deterministic, hence an unchanged set of
+/// revisions implies an unchanged graph.
+pub static INPUT_REVISION_PARAM_PREFIX: &str = "io.openshift.upgrades.graph.input_revision.";
+
+/// Compute a revision for the given value, only meant to be compared within the same process.
+pub fn input_revision<T: Hash + ?Sized>(value: &T) -> String {
+    let mut hasher = std::collections::hash_map::DefaultHasher::new();
+    value.hash(&mut hasher);
+    format!("{:016x}", hasher.finish())
+}
+
+impl InternalIO {
+    /// Returns the combined revision of the inputs consumed so far, if any have been recorded.
+    pub fn input_revision(&self) -> Option<String> {
+        let mut revisions: Vec<(&str, &str)> = self
+            .parameters
+            .iter()
+            .filter_map(|(key, value)| {
+                key.strip_prefix(INPUT_REVISION_PARAM_PREFIX)
+                    .map(|source| (source, value.as_str()))
+            })
+            .collect();
+        if revisions.is_empty() {
+            return None;
+        }
+        revisions.sort_unstable();
+
+        Some(
+            revisions
+                .iter()
+                .map(|(source, revision)| format!("{}={}", source, revision))
+                .collect::<Vec<_>>()
+                .join(";"),
+        )
+    }
+
+    /// Record the revision of the inputs consumed by the given source.
+    pub fn set_input_revision(&mut self, source: &str, revision: &str) {
+        self.parameters.insert(
+            format!("{}{}", INPUT_REVISION_PARAM_PREFIX, source),
+            revision.to_string(),
+        );
+    }
+
+    /// Mark the graph as depending on an input without a known revision.
+    ///
+    /// This replaces all recorded revisions with one which is never repeated.
+    pub fn invalidate_input_revision(&mut self) {
+        static UNKNOWN_REVISIONS: AtomicU64 = AtomicU64::new(0);
+
+        self.parameters
+            .retain(|key, _| !key.starts_with(INPUT_REVISION_PARAM_PREFIX));
+        let unknown = UNKNOWN_REVISIONS.fetch_add(1, Ordering::Relaxed);
+        self.set_input_revision("unknown", &unknown.to_string());
+    }
+}
+
+/// Memoizes the graph a deterministic plugin produced for the latest input revision.
+#[derive(Default)]
+pub struct RevisionMemo(Mutex<Option<(String, cincinnati::Graph)>>);
+
+impl Debug for RevisionMemo {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        let revision = self
+            .0
+            .lock()
+            .ok()
+            .and_then(|memo| memo.as_ref().map(|(revision, _)| revision.clone()));
+        f.debug_tuple("RevisionMemo").field(&revision).finish()
+    }
+}
+
+impl RevisionMemo {
+    /// Returns a copy of the memoized graph if it was produced for the given revision.
+    pub fn get(&self, revision: &str) -> Option<cincinnati::Graph> {
+        match &*self.0.lock().ok()? {
+            Some((memoized, graph)) if memoized == revision => Some(graph.clone()),
+            _ => None,
+        }
+    }
+
+    /// Memoize the graph produced for the given revision, replacing the previous one.
+    pub fn set(&self, revision: &str, graph: &cincinnati::Graph) {
+        if let Ok(mut memo) = self.0.lock() {
+            *memo = Some((revision.to_string(), graph.clone()));
+        }
+    }
+}
+
 /// Struct used by the InternalPlugin trait impl's
 #[derive(Debug, PartialEq)]
 #[cfg_attr(test, derive(Clone))]
@@ -134,6 +273,16 @@ where
     async fn run(self: &Self, t: T) -> Fallible<T>;
 
     fn get_name(self: &Self) -> &'static str;
+
+    /// Returns true if the plugin only fetches data into the parameters.
+    fn is_fetch_only(self: &Self) -> bool {
+        false
+    }
+
+    /// Returns the revision of the upstream data the plugin currently serves, if it tracks one.
+    async fn upstream_revision(self: &Self) -> Fallible<Option<String>> {
+        Ok(None)
+    }
 }
 
 /// Trait to be implemented by internal plugins with their native IO type
@@ -146,6 +295,23 @@ pub trait InternalPlugin {
     fn get_name(self: &Self) -> &'static str {
         Self::PLUGIN_NAME
     }
+
+    /// Returns true if the plugin only fetches data into the parameters.
+    ///
+    /// Such a plugin neither reads its input nor modifies the graph, which
+    /// allows running it concurrently with the plugin preceding it.
+    fn is_fetch_only(self: &Self) -> bool {
+        false
+    }
+
+    /// Returns the revision of the upstream data the plugin currently serves, if it tracks one.
+    ///
+    /// Equal revisions imply that a run of the plugin produces the same output. This
+    /// must not contact upstream, it only reports what the plugin already knows.
+    /// `None` is also returned if the revision is unknown until the plugin runs again.
+    async fn upstream_revision(self: &Self) -> Fallible<Option<String>> {
+        Ok(None)
+    }
 }
 
 /// Trait to be implemented by external plugins with its native IO type
@@ -354,6 +520,14 @@ where
     fn get_name(&self) -> &'static str {
         <T as InternalPlugin>::PLUGIN_NAME
     }
+
+    fn is_fetch_only(&self) -> bool {
+        self.0.is_fetch_only()
+    }
+
+    async fn upstream_revision(self: &Self) -> Fallible<Option<String>> {
+        self.0.upstream_revision().await
+    }
 }
 
 /// This implementation allows the process function to run ipmlementors of
@@ -377,6 +551,10 @@ where
 
 /// Processes all given Plugins sequentially.
 ///
+/// Fetch-only plugins don't depend on the output of the plugin preceding
+/// them, so they run concurrently with it on an empty input. Their parameters
+/// are then merged into its output, in the order of the plugins.
+///
 /// This function automatically converts between the different IO representations
 /// if necessary.
 pub async fn process<T>(plugins: T, initial_io: PluginIO) -> Fallible<InternalIO>
@@ -384,83 +562,230 @@ where
     T: Iterator<Item = &'static BoxedPlugin>,
     T: Sync + Send,
     T: 'static,
+{
+    let cx = ot_context::current_with_span(get_tracer().start("plugins"));
+    process_plugins(plugins, initial_io).with_context(cx).await
+}
+
+/// Returns the upstream revision of the last of the given plugins which tracks one.
+///
+/// This is the revision recorded for the output of a run of the plugins, and
+/// allows checking whether output derived from an earlier run is still current.
+pub async fn upstream_revision<T>(plugins: T) -> Fallible<Option<String>>
+where
+    T: Iterator<Item = &'static BoxedPlugin>,
+{
+    let mut revision = None;
+    for plugin in plugins {
+        if let Some(current) = plugin.upstream_revision().await? {
+            revision = Some(current);
+        }
+    }
+    Ok(revision)
+}
+
+async fn process_plugins<T>(plugins: T, initial_io: PluginIO) -> Fallible<InternalIO>
+where
+    T: Iterator<Item = &'static BoxedPlugin>,
+    T: Sync + Send,
 {
     let mut io = initial_io;
 
-    let span = get_tracer().start("plugins");
-    let _active_span = mark_span_as_active(span);
+    let mut plugins = plugins.peekable();
+    while let Some(next_plugin) = plugins.next() {
+        let mut fetch_plugins = vec![];
+        while let Some(fetch_plugin) = plugins.next_if(|plugin| plugin.is_fetch_only()) {
+            fetch_plugins.push(fetch_plugin);
+        }
 
-    for next_plugin in plugins {
-        let plugin_name = next_plugin.get_name();
-        log::trace!("Running next plugin '{}'", plugin_name);
+        if fetch_plugins.is_empty() {
+            io = run_plugin(next_plugin, io).await?;
+            continue;
+        }
+
+        let fetches = fetch_plugins.into_iter().map(|plugin| {
+            let empty_io = InternalIO {
+                graph: Default::default(),
+                parameters: Default::default(),
+            };
+            run_plugin(plugin, PluginIO::InternalIO(empty_io))
+        });
+        let (next_io, fetched_ios) =
+            futures::future::try_join(run_plugin(next_plugin, io), try_join_all(fetches)).await?;
 
-        let plugin_span = get_tracer().start(plugin_name);
-        let _active_plugin_span = mark_span_as_active(plugin_span);
-        let cx = ot_context::current();
-        io = next_plugin.run(io).with_context(cx).await?;
+        let mut next_io: InternalIO = next_io.try_into()?;
+        for fetched_io in fetched_ios {
+            let fetched_io: InternalIO = fetched_io.try_into()?;
+            next_io.parameters.extend(fetched_io.parameters);
+        }
+        io = PluginIO::InternalIO(next_io);
     }
 
     io.try_into()
 }
 
-/// Wrapper around `process` with an optional timeout.
-///
-/// It creates a new runtime per call which is moved to a new thread.
-/// This has the desired effect of timing out even if the runtime is blocked by a task.
-/// It has the sideeffect that these threads are unrecoverably leaked.
-///
-/// These two strategies are used in combination to implement the timeout:
-/// 1. Use the runtime's internal timeout implementation which works for proper async tasks.
-/// 2. Spawn a separate sleeper thread to enforce a deadline of 101% of the timeout
-///    in case the async timeout is not effective.
-pub fn process_blocking<T>(
-    plugins: T,
-    initial_io: PluginIO,
-    timeout: Option<std::time::Duration>,
-) -> Fallible<InternalIO>
-where
-    T: Iterator<Item = &'static BoxedPlugin>,
-    T: Sync + Send,
-    T: 'static,
-{
-    let runtime = tokio::runtime::Runtime::new()?;
+/// Run a single plugin in its own tracing span and record its metrics.
+async fn run_plugin(plugin: &'static BoxedPlugin, io: PluginIO) -> Fallible<PluginIO> {
+    let plugin_name = plugin.get_name();
+    log::trace!("Running next plugin '{}'", plugin_name);
 
-    let timeout = match timeout {
-        None => return runtime.block_on(process(plugins, initial_io)),
-        Some(timeout) => timeout,
+    observe_graph_size(plugin_name, "input", &io);
+    let timer = PLUGIN_DURATION
+        .with_label_values(&[plugin_name])
+        .start_timer();
+
+    let cx = ot_context::current_with_span(get_tracer().start(plugin_name));
+    let result = plugin.run(io).with_context(cx).await;
+    timer.observe_duration();
+
+    match &result {
+        Ok(io) => observe_graph_size(plugin_name, "output", io),
+        Err(_) => PLUGIN_ERRORS.with_label_values(&[plugin_name]).inc(),
     };
-    let deadline = timeout + (timeout / 100);
 
-    let (tx, rx) = std::sync::mpsc::channel::<Fallible<InternalIO>>();
+    result
+}
+
+/// Record the size of the graph, unless it would have to be deserialized first.
+fn observe_graph_size(plugin_name: &str, stage: &str, io: &PluginIO) {
+    if let PluginIO::InternalIO(io) = io {
+        PLUGIN_GRAPH_RELEASES
+            .with_label_values(&[plugin_name, stage])
+            .set(io.graph.releases_count() as i64);
+        PLUGIN_GRAPH_EDGES
+            .with_label_values(&[plugin_name, stage])
+            .set(io.graph.edges_count() as i64);
+    }
+}
 
+/// Long-lived runtime for processing plugins with a timeout.
+///
+/// Processing runs as a task on the runtime, which is aborted when the
+/// timeout is exceeded. The timeout is enforced by the calling thread, so it
+/// also holds if a plugin blocks the runtime's worker threads. The runtime is
+/// replaced before the next run if an aborted run hasn't stopped by then.
+#[derive(Debug)]
+pub struct PluginRunner {
+    runtime: Option<tokio::runtime::Runtime>,
+    /// Number of worker threads, defaults to the number of CPUs.
+    worker_threads: Option<usize>,
+    /// Number of aborted tasks on the current runtime which haven't finished yet.
+    pending_aborts: Arc<AtomicUsize>,
+}
+
+impl PluginRunner {
+    /// Create a new runner with its own multi-threaded runtime.
+    pub fn try_new() -> Fallible<Self> {
+        Self::try_with_worker_threads(None)
+    }
+
+    fn try_with_worker_threads(worker_threads: Option<usize>) -> Fallible<Self> {
+        Ok(Self {
+            runtime: Some(Self::build_runtime(worker_threads)?),
+            worker_threads,
+            pending_aborts: Default::default(),
+        })
+    }
+
+    fn build_runtime(worker_threads: Option<usize>) -> Fallible<tokio::runtime::Runtime> {
+        let mut builder = tokio::runtime::Builder::new_multi_thread();
+        if let Some(worker_threads) = worker_threads {
+            builder.worker_threads(worker_threads);
+        }
+
+        Ok(builder.thread_name("plugins").enable_all().build()?)
+    }
+
+    fn runtime(&self) -> &tokio::runtime::Runtime {
+        self.runtime
+            .as_ref()
+            .expect("the runtime is only taken on drop")
+    }
+
+    /// Wrapper around `process` with an optional timeout, blocking the calling thread.
+    pub fn process_blocking<T>(
+        &mut self,
+        plugins: T,
+        initial_io: PluginIO,
+        timeout: Option<std::time::Duration>,
+    ) -> Fallible<InternalIO>
+    where
+        T: Iterator<Item = &'static BoxedPlugin>,
+        T: Sync + Send,
+        T: 'static,
     {
-        let tx = tx.clone();
-
-        std::thread::spawn(move || {
-            let io_future =
-                async { tokio::time::timeout(timeout, process(plugins, initial_io)).await };
-            let io_result = runtime
-                .block_on(io_future)
-                .context(format!(
-                    "Processing all plugins with a timeout of {:?}",
-                    timeout
-                ))
-                .map_err(Error::from)
-                .unwrap_or_else(Err);
+        self.replace_blocked_runtime()?;
+
+        let timeout = match timeout {
+            None => return self.runtime().block_on(process(plugins, initial_io)),
+            Some(timeout) => timeout,
+        };
 
+        let (tx, rx) = std::sync::mpsc::sync_channel::<Fallible<InternalIO>>(1);
+        let task = self.runtime().spawn(async move {
             // This may fail if it's attempted after the timeout is exceeded.
-            let _ = tx.send(io_result);
+            let _ = tx.send(process(plugins, initial_io).await);
         });
-    };
 
-    std::thread::spawn(move || {
-        std::thread::sleep(deadline);
+        match rx.recv_timeout(timeout) {
+            Ok(io_result) => io_result,
+            Err(std::sync::mpsc::RecvTimeoutError::Timeout) => {
+                task.abort();
+                self.watch_aborted(task);
+                Err(format_err!("Exceeded timeout of {:?}", &timeout))
+            }
+            Err(std::sync::mpsc::RecvTimeoutError::Disconnected) => {
+                Err(format_err!("Processing all plugins was interrupted"))
+            }
+        }
+    }
+
+    /// Keep track of an aborted task until it has actually stopped.
+    ///
+    /// Aborting only takes effect when the task yields, a task blocking its
+    /// worker thread keeps running until it does.
+    fn watch_aborted(&self, task: tokio::task::JoinHandle<()>) {
+        self.pending_aborts.fetch_add(1, Ordering::SeqCst);
+
+        let pending_aborts = self.pending_aborts.clone();
+        self.runtime().spawn(async move {
+            let _ = task.await;
+            pending_aborts.fetch_sub(1, Ordering::SeqCst);
+        });
+    }
 
-        // This may fail if it's attempted after processing is finished.
-        let _ = tx.send(Err(format_err!("Exceeded timeout of {:?}", &timeout)));
-    });
+    /// Replace the runtime if an aborted run still hasn't stopped.
+    ///
+    /// Such a run most likely blocks its worker thread, which would otherwise
+    /// be lost for all later runs. The old runtime is shut down in the
+    /// background and its threads exit once the blocking plugins return.
+    fn replace_blocked_runtime(&mut self) -> Fallible<()> {
+        let pending = self.pending_aborts.load(Ordering::SeqCst);
+        if pending == 0 {
+            return Ok(());
+        }
 
-    rx.recv()?
+        log::warn!(
+            "{} aborted plugin runs have not stopped yet, replacing the plugin runtime",
+            pending
+        );
+        let runtime = Self::build_runtime(self.worker_threads)?;
+        if let Some(blocked) = self.runtime.replace(runtime) {
+            blocked.shutdown_background();
+        }
+        self.pending_aborts = Default::default();
+
+        Ok(())
+    }
+}
+
+impl Drop for PluginRunner {
+    fn drop(&mut self) {
+        // Don't wait for tasks which might be blocking.
+        if let Some(runtime) = self.runtime.take() {
+            runtime.shutdown_background();
+        }
+    }
 }
 
 #[cfg(test)]
@@ -473,6 +798,35 @@ mod tests {
     use std::sync::atomic::{AtomicUsize, Ordering};
     use std::sync::Arc;
 
+    #[test]
+    fn input_revision_is_tracked() {
+        let mut io = InternalIO {
+            graph: Default::default(),
+            parameters: Default::default(),
+        };
+        assert_eq!(io.input_revision(), None);
+
+        io.set_input_revision("b", "2");
+        io.set_input_revision("a", "1");
+        assert_eq!(io.input_revision().as_deref(), Some("a=1;b=2"));
+
+        let memo = RevisionMemo::default();
+        assert!(memo.get("a=1;b=2").is_none());
+        memo.set("a=1;b=2", &generate_graph());
+        assert_eq!(
+            memo.get("a=1;b=2").map(|graph| graph.releases_count()),
+            Some(generate_graph().releases_count())
+        );
+        assert!(memo.get("a=1;b=3").is_none());
+
+        io.invalidate_input_revision();
+        let invalidated = io.input_revision();
+        assert!(invalidated.is_some());
+        io.set_input_revision("a", "1");
+        io.invalidate_input_revision();
+        assert_ne!(io.input_revision(), invalidated);
+    }
+
     #[test]
     fn convert_externalio_pluginresult() {
         let kind = interface::PluginError_Kind::INTERNAL_FAILURE;
@@ -598,6 +952,74 @@ mod tests {
         Ok(())
     }
 
+    #[derive(Debug)]
+    struct TestFetchPlugin {}
+    #[async_trait]
+    impl InternalPlugin for TestFetchPlugin {
+        const PLUGIN_NAME: &'static str = "test_fetch_plugin";
+
+        async fn run_internal(self: &Self, mut io: InternalIO) -> Fallible<InternalIO> {
+            ensure!(
+                io.parameters.is_empty(),
+                "fetch-only plugin got parameters {:?}",
+                io.parameters
+            );
+            io.parameters
+                .insert("FETCHED".to_string(), "true".to_string());
+
+            Ok(io)
+        }
+
+        fn is_fetch_only(self: &Self) -> bool {
+            true
+        }
+    }
+
+    #[test]
+    fn process_plugins_merges_fetch_only_plugins() -> Fallible<()> {
+        let runtime = commons::testing::init_runtime()?;
+
+        lazy_static! {
+            static ref PLUGINS: Vec<BoxedPlugin> = new_plugins!(
+                InternalPluginWrapper(TestInternalPlugin {
+                    counter: Default::default(),
+                    dict: Arc::new(FuturesMutex::new(Default::default())),
+                    inner_fn: None,
+                }),
+                InternalPluginWrapper(TestFetchPlugin {})
+            );
+        }
+
+        let initial_internalio = InternalIO {
+            graph: generate_graph(),
+            parameters: [("hello".to_string(), "plugin".to_string())]
+                .iter()
+                .cloned()
+                .collect(),
+        };
+
+        let expected_internalio = InternalIO {
+            graph: generate_graph(),
+            parameters: [
+                ("hello".to_string(), "plugin".to_string()),
+                ("COUNTER".to_string(), "1".to_string()),
+                ("FETCHED".to_string(), "true".to_string()),
+            ]
+            .iter()
+            .cloned()
+            .collect(),
+        };
+
+        let result_internalio: InternalIO = runtime.block_on(super::process(
+            PLUGINS.iter(),
+            PluginIO::InternalIO(initial_internalio),
+        ))?;
+
+        assert_eq!(expected_internalio, result_internalio);
+
+        Ok(())
+    }
+
     #[test]
     fn process_plugins_loop() -> Fallible<()> {
         let runtime = commons::testing::init_runtime()?;
@@ -669,9 +1091,10 @@ mod tests {
             parameters: Default::default(),
         };
 
+        let mut runner = PluginRunner::try_new()?;
         let timeout = *PLUGIN_DELAY * 2;
         let before_process = std::time::Instant::now();
-        let result_internalio = super::process_blocking(
+        let result_internalio = runner.process_blocking(
             PLUGINS.iter(),
             PluginIO::InternalIO(initial_internalio),
             Some(timeout),
@@ -714,11 +1137,12 @@ mod tests {
             parameters: Default::default(),
         };
 
-        // timeout hit
+        // timeout hit, the same runner keeps working while previous runs are still blocked
+        let mut runner = PluginRunner::try_new()?;
         let timeout = *PLUGIN_DELAY / 100;
         for _ in 0..10 {
             let before_process = std::time::Instant::now();
-            let result_internalio = super::process_blocking(
+            let result_internalio = runner.process_blocking(
                 PLUGINS.iter(),
                 PluginIO::InternalIO(initial_internalio.clone()),
                 Some(timeout),
@@ -742,6 +1166,46 @@ mod tests {
         Ok(())
     }
 
+    #[test]
+    fn process_blocking_replaces_blocked_runtime() -> Fallible<()> {
+        lazy_static! {
+            static ref BLOCKING_PLUGINS: Vec<BoxedPlugin> =
+                new_plugins!(InternalPluginWrapper(TestInternalPlugin {
+                    counter: Default::default(),
+                    dict: Arc::new(FuturesMutex::new(Default::default())),
+                    inner_fn: Some(Arc::new(|| {
+                        std::thread::sleep(std::time::Duration::from_secs(100));
+                        Ok(())
+                    })),
+                }));
+            static ref PLUGINS: Vec<BoxedPlugin> =
+                new_plugins!(InternalPluginWrapper(TestInternalPlugin {
+                    counter: Default::default(),
+                    dict: Arc::new(FuturesMutex::new(Default::default())),
+                    inner_fn: None,
+                }));
+        }
+
+        let initial_io = PluginIO::InternalIO(InternalIO {
+            graph: Default::default(),
+            parameters: Default::default(),
+        });
+
+        // Every timed out run blocks the only worker thread of the runtime.
+        let mut runner = PluginRunner::try_with_worker_threads(Some(1))?;
+        let timeout = std::time::Duration::from_secs(1);
+        for _ in 0..3 {
+            let blocked =
+                runner.process_blocking(BLOCKING_PLUGINS.iter(), initial_io.clone(), Some(timeout));
+            assert!(blocked.is_err(), "Expected error, got {:?}", blocked);
+
+            let result = runner.process_blocking(PLUGINS.iter(), initial_io.clone(), Some(timeout));
+            assert!(result.is_ok(), "Expected Ok, got {:?}", result);
+        }
+
+        Ok(())
+    }
+
     #[test]
     fn plugin_names() -> Fallible<()> {
         lazy_static! {
@@ -0,0 +1,365 @@
+//! Compact binary representation of a graph.
+//!
+//! This is used on the hop from the graph-builder to the policy-engine, where
+//! parsing the JSON representation dominates the cost of fetching the graph.
+//! The graph is encoded as the following protobuf message, which lists every
+//! metadata key once and references it by index from the nodes:
+//!
+//! ```protobuf
+//! syntax = "proto3";
+//!
+//! message CompactGraph {
+//!   message Node {
+//!     string version = 1;
+//!     string payload = 2;
+//!     // Indices into `keys`, one for each entry of `metadata_values`.
+//!     repeated uint32 metadata_keys = 3 [packed = true];
+//!     repeated string metadata_values = 4;
+//!   }
+//!
+//!   // Distinct metadata keys.
+//!   repeated string keys = 1;
+//!   repeated Node nodes = 2;
+//!   // Edges as consecutive pairs of source and target node indices.
+//!   repeated uint64 edges = 3 [packed = true];
+//! }
+//! ```
+//!
+//! Decoding builds the `Graph` directly from the input, without creating
+//! the intermediate protobuf message.
+
+use crate::{ConcreteRelease, Empty, Graph, MetadataKey, MetadataMap, Release};
+use commons::prelude_errors::*;
+use daggy::Dag;
+use protobuf::wire_format::WireType;
+use protobuf::{CodedInputStream, CodedOutputStream};
+use std::collections::{BTreeSet, HashMap};
+use std::sync::Arc;
+
+/// Media type of the compact binary graph representation.
+pub const CONTENT_TYPE: &str = "application/vnd.cincinnati.graph+protobuf";
+
+const FIELD_KEYS: u32 = 1;
+const FIELD_NODES: u32 = 2;
+const FIELD_EDGES: u32 = 3;
+
+const FIELD_NODE_VERSION: u32 = 1;
+const FIELD_NODE_PAYLOAD: u32 = 2;
+const FIELD_NODE_METADATA_KEYS: u32 = 3;
+const FIELD_NODE_METADATA_VALUES: u32 = 4;
+
+/// Encode the graph in the compact binary representation.
+///
+/// Keys and metadata entries are sorted, so equal graphs result in equal bytes.
+pub fn encode(graph: &Graph) -> Fallible<Vec<u8>> {
+    let releases = graph
+        .dag
+        .raw_nodes()
+        .iter()
+        .map(|node| match &node.weight {
+            Release::Concrete(release) => Ok(release),
+            Release::Abstract(release) => {
+                bail!("cannot encode abstract release '{}'", release.version)
+            }
+        })
+        .collect::<Fallible<Vec<&ConcreteRelease>>>()?;
+
+    let keys: Vec<&str> = releases
+        .iter()
+        .flat_map(|release| release.metadata.keys().map(MetadataKey::as_str))
+        .collect::<BTreeSet<_>>()
+        .into_iter()
+        .collect();
+    let key_indices: HashMap<&str, u32> = keys
+        .iter()
+        .enumerate()
+        .map(|(index, key)| (*key, index as u32))
+        .collect();
+
+    let mut bytes = Vec::new();
+    let mut node_bytes = Vec::new();
+    {
+        let mut os = CodedOutputStream::vec(&mut bytes);
+
+        for key in &keys {
+            os.write_string(FIELD_KEYS, key)?;
+        }
+
+        for release in releases {
+            node_bytes.clear();
+            encode_node(release, &key_indices, &mut node_bytes)?;
+            os.write_bytes(FIELD_NODES, &node_bytes)?;
+        }
+
+        let edges = graph.dag.raw_edges().iter().flat_map(|edge| {
+            std::iter::once(edge.source().index() as u64)
+                .chain(std::iter::once(edge.target().index() as u64))
+        });
+        write_packed_uint64(&mut os, FIELD_EDGES, edges)?;
+
+        os.flush()?;
+    }
+
+    Ok(bytes)
+}
+
+fn encode_node(
+    release: &ConcreteRelease,
+    key_indices: &HashMap<&str, u32>,
+    bytes: &mut Vec<u8>,
+) -> Fallible<()> {
+    let mut metadata: Vec<(u32, &str)> = release
+        .metadata
+        .iter()
+        .map(|(key, value)| (key_indices[key.as_str()], value.as_str()))
+        .collect();
+    metadata.sort_unstable();
+
+    let mut os = CodedOutputStream::vec(bytes);
+    os.write_string(FIELD_NODE_VERSION, &release.version)?;
+    os.write_string(FIELD_NODE_PAYLOAD, &release.payload)?;
+    write_packed_uint32(
+        &mut os,
+        FIELD_NODE_METADATA_KEYS,
+        metadata.iter().map(|(key, _)| *key),
+    )?;
+    for (_, value) in &metadata {
+        os.write_string(FIELD_NODE_METADATA_VALUES, value)?;
+    }
+    os.flush()?;
+
+    Ok(())
+}
+
+fn write_packed_uint32<I>(os: &mut CodedOutputStream, field: u32, values: I) -> Fallible<()>
+where
+    I: Iterator<Item = u32> + Clone,
+{
+    let size: u32 = values
+        .clone()
+        .map(protobuf::rt::compute_raw_varint32_size)
+        .sum();
+    if size == 0 {
+        return Ok(());
+    }
+
+    os.write_tag(field, WireType::WireTypeLengthDelimited)?;
+    os.write_raw_varint32(size)?;
+    for value in values {
+        os.write_raw_varint32(value)?;
+    }
+    Ok(())
+}
+
+fn write_packed_uint64<I>(os: &mut CodedOutputStream, field: u32, values: I) -> Fallible<()>
+where
+    I: Iterator<Item = u64> + Clone,
+{
+    let size: u32 = values
+        .clone()
+        .map(protobuf::rt::compute_raw_varint64_size)
+        .sum();
+    if size == 0 {
+        return Ok(());
+    }
+
+    os.write_tag(field, WireType::WireTypeLengthDelimited)?;
+    os.write_raw_varint32(size)?;
+    for value in values {
+        os.write_raw_varint64(value)?;
+    }
+    Ok(())
+}
+
+/// A node as it was read, with its metadata keys not yet resolved.
+#[derive(Default)]
+struct RawNode {
+    version: String,
+    payload: String,
+    metadata_keys: Vec<u32>,
+    metadata_values: Vec<String>,
+}
+
+/// Decode a graph from the compact binary representation.
+///
+/// This applies the same validation as deserializing a graph from JSON.
+pub fn decode(bytes: &[u8]) -> Fallible<Graph> {
+    let mut is = CodedInputStream::from_bytes(bytes);
+
+    let mut keys: Vec<MetadataKey> = Vec::new();
+    let mut nodes: Vec<RawNode> = Vec::new();
+    let mut edges: Vec<u64> = Vec::new();
+    let mut unknown = protobuf::UnknownFields::new();
+
+    while !is.eof()? {
+        let (field, wire_type) = is.read_tag_unpack()?;
+        match (field, wire_type) {
+            (FIELD_KEYS, WireType::WireTypeLengthDelimited) => {
+                keys.push(MetadataKey::from(is.read_string()?))
+            }
+            (FIELD_NODES, WireType::WireTypeLengthDelimited) => nodes.push(decode_node(&mut is)?),
+            (FIELD_EDGES, wire_type) => {
+                protobuf::rt::read_repeated_uint64_into(wire_type, &mut is, &mut edges)?
+            }
+            (field, wire_type) => {
+                protobuf::rt::read_unknown_or_skip_group(field, wire_type, &mut is, &mut unknown)?
+            }
+        }
+    }
+
+    ensure!(
+        edges.len() % 2 == 0,
+        "odd number of edge indices: {}",
+        edges.len()
+    );
+
+    let mut graph = Graph {
+        dag: Arc::new(Dag::with_capacity(nodes.len(), edges.len() / 2)),
+        versions: Arc::new(std::collections::HashMap::with_capacity(nodes.len())),
+        metadata_index: Default::default(),
+    };
+
+    for node in nodes {
+        ensure!(!node.version.is_empty(), "found node with empty version");
+        ensure!(
+            !graph.versions.contains_key(&node.version),
+            "found duplicate version '{}'",
+            node.version
+        );
+        ensure!(
+            node.metadata_keys.len() == node.metadata_values.len(),
+            "[{}] found {} metadata keys for {} values",
+            node.version,
+            node.metadata_keys.len(),
+            node.metadata_values.len()
+        );
+
+        let metadata = node
+            .metadata_keys
+            .into_iter()
+            .zip(node.metadata_values)
+            .map(|(key, value)| {
+                let key = keys
+                    .get(key as usize)
+                    .ok_or_else(|| format_err!("invalid metadata key index {}", key))?;
+                Ok((key.clone(), value))
+            })
+            .collect::<Fallible<MetadataMap>>()?;
+
+        graph.insert_node(Release::Concrete(ConcreteRelease {
+            version: node.version,
+            payload: node.payload,
+            metadata,
+        }));
+    }
+
+    let node_count = graph.dag.node_count() as u64;
+    if let Some(index) = edges.iter().find(|index| **index >= node_count) {
+        bail!("edge references missing node {}", index);
+    }
+
+    graph
+        .dag_mut()
+        .add_edges(edges.chunks(2).map(|pair| {
+            (
+                daggy::NodeIndex::new(pair[0] as usize),
+                daggy::NodeIndex::new(pair[1] as usize),
+                Empty {},
+            )
+        }))
+        .map_err(|_| format_err!("edges would form a cycle"))?;
+
+    Ok(graph)
+}
+
+fn decode_node(is: &mut CodedInputStream) -> Fallible<RawNode> {
+    let length = is.read_raw_varint64()?;
+    let old_limit = is.push_limit(length)?;
+
+    let mut node = RawNode::default();
+    let mut unknown = protobuf::UnknownFields::new();
+    while !is.eof()? {
+        let (field, wire_type) = is.read_tag_unpack()?;
+        match (field, wire_type) {
+            (FIELD_NODE_VERSION, WireType::WireTypeLengthDelimited) => {
+                node.version = is.read_string()?
+            }
+            (FIELD_NODE_PAYLOAD, WireType::WireTypeLengthDelimited) => {
+                node.payload = is.read_string()?
+            }
+            (FIELD_NODE_METADATA_KEYS, wire_type) => {
+                protobuf::rt::read_repeated_uint32_into(wire_type, is, &mut node.metadata_keys)?
+            }
+            (FIELD_NODE_METADATA_VALUES, WireType::WireTypeLengthDelimited) => {
+                node.metadata_values.push(is.read_string()?)
+            }
+            (field, wire_type) => {
+                protobuf::rt::read_unknown_or_skip_group(field, wire_type, is, &mut unknown)?
+            }
+        }
+    }
+
+    is.pop_limit(old_limit);
+    Ok(node)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::testing::{generate_custom_graph, generate_graph};
+
+    #[test]
+    fn roundtrip() -> Fallible<()> {
+        let metadata = (0..3)
+            .map(|i| {
+                let metadata = vec![
+                    ("channels", "a,b"),
+                    ("arch", "amd64"),
+                    ("release", if i == 1 { "x" } else { "y" }),
+                ]
+                .into_iter()
+                .map(|(k, v)| (k.to_string(), v.to_string()))
+                .collect();
+                (i, metadata)
+            })
+            .collect();
+        let graph = generate_custom_graph("image", metadata, Some(vec![(0, 1), (1, 2), (0, 2)]));
+
+        let bytes = encode(&graph)?;
+        assert_eq!(bytes, encode(&graph)?);
+
+        let decoded = decode(&bytes)?;
+        assert_eq!(graph, decoded);
+        assert_eq!(
+            serde_json::to_string(&graph)?,
+            serde_json::to_string(&decoded)?
+        );
+
+        Ok(())
+    }
+
+    #[test]
+    fn roundtrip_empty() -> Fallible<()> {
+        let graph = Graph::default();
+
+        let bytes = encode(&graph)?;
+        assert!(bytes.is_empty());
+        assert_eq!(graph, decode(&bytes)?);
+
+        Ok(())
+    }
+
+    #[test]
+    fn decode_rejects_invalid_edges() -> Fallible<()> {
+        let mut bytes = encode(&generate_graph())?;
+        {
+            let mut os = CodedOutputStream::vec(&mut bytes);
+            write_packed_uint64(&mut os, FIELD_EDGES, vec![0, 1000].into_iter())?;
+            os.flush()?;
+        }
+
+        assert!(decode(&bytes).is_err());
+
+        Ok(())
+    }
+}
@@ -0,0 +1,291 @@
+//! Precompressed representations of immutable response bodies.
+//!
+//! Graph responses are served many times without changing, hence they are
+//! compressed once when they are produced instead of on every request.
+
+use actix_web::http::{header, HeaderMap};
+use actix_web::web::Bytes;
+use actix_web::HttpResponse;
+use std::io::Write;
+
+/// Brotli quality level, the maximum of 11 is several times slower on graph-sized bodies.
+pub static BROTLI_QUALITY: u32 = 9;
+
+/// Content-codings which bodies are precompressed with.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Encoding {
+    /// No compression.
+    Identity,
+    /// Brotli compression.
+    Brotli,
+    /// Gzip compression.
+    Gzip,
+}
+
+impl Encoding {
+    /// Content-codings in order of preference.
+    const PREFERRED: [Encoding; 2] = [Encoding::Brotli, Encoding::Gzip];
+
+    /// Returns the content-coding token for this encoding.
+    pub fn as_str(self) -> &'static str {
+        match self {
+            Encoding::Identity => "identity",
+            Encoding::Brotli => "br",
+            Encoding::Gzip => "gzip",
+        }
+    }
+
+    fn matches(self, coding: &str) -> bool {
+        coding.eq_ignore_ascii_case(self.as_str())
+            || (self == Encoding::Gzip && coding.eq_ignore_ascii_case("x-gzip"))
+    }
+
+    /// Pick the preferred encoding which is acceptable according to the `Accept-Encoding` header.
+    pub fn negotiate(headers: &HeaderMap) -> Self {
+        let accepted: Vec<(&str, f32)> = headers
+            .get_all(header::ACCEPT_ENCODING)
+            .filter_map(|value| value.to_str().ok())
+            .flat_map(|value| value.split(','))
+            .filter_map(|item| {
+                let mut parts = item.split(';').map(str::trim);
+                let coding = parts.next().filter(|coding| !coding.is_empty())?;
+                let quality = parts
+                    .find_map(|param| param.strip_prefix("q="))
+                    .map_or(Some(1.0), |q| q.parse::<f32>().ok())?;
+                Some((coding, quality))
+            })
+            .collect();
+
+        let quality = |encoding: Encoding| {
+            accepted
+                .iter()
+                .find(|(coding, _)| encoding.matches(coding))
+                .or_else(|| accepted.iter().find(|(coding, _)| *coding == "*"))
+                .map_or(0.0, |(_, quality)| *quality)
+        };
+
+        // Only an explicitly listed identity is preferred over a compressed variant.
+        let identity = accepted
+            .iter()
+            .find(|(coding, _)| Encoding::Identity.matches(coding))
+            .map_or(0.0, |(_, quality)| *quality);
+
+        let mut best = (Encoding::Identity, identity);
+        for encoding in Self::PREFERRED.iter().copied() {
+            let q = quality(encoding);
+            if q > 0.0 && q > best.1 {
+                best = (encoding, q);
+            }
+        }
+        best.0
+    }
+}
+
+/// One representation of a body.
+#[derive(Debug, Clone, PartialEq)]
+struct Variant {
+    body: Bytes,
+    etag: String,
+}
+
+/// An immutable response body along with its entity-tag and compressed variants.
+#[derive(Debug, Default, Clone, PartialEq)]
+pub struct EncodedBody {
+    identity: Bytes,
+    etag: String,
+    brotli: Option<Variant>,
+    gzip: Option<Variant>,
+}
+
+impl EncodedBody {
+    /// Wraps the given body, computes its entity-tag and compresses it.
+    pub fn new(body: Bytes) -> Self {
+        let etag = crate::compute_etag(&body);
+        Self::with_etag(body, etag)
+    }
+
+    /// Wraps the given body with an already computed entity-tag and compresses it.
+    pub fn with_etag(body: Bytes, etag: String) -> Self {
+        let brotli = compress(&body, &etag, Encoding::Brotli);
+        let gzip = compress(&body, &etag, Encoding::Gzip);
+
+        Self {
+            identity: body,
+            etag,
+            brotli,
+            gzip,
+        }
+    }
+
+    /// Wraps the given body and computes its entity-tag, without compressed variants.
+    pub fn uncompressed(body: Bytes) -> Self {
+        let etag = crate::compute_etag(&body);
+        Self {
+            identity: body,
+            etag,
+            brotli: None,
+            gzip: None,
+        }
+    }
+
+    /// Returns the uncompressed body.
+    pub fn body(&self) -> &Bytes {
+        &self.identity
+    }
+
+    /// Returns the entity-tag of the uncompressed body, empty for the default value.
+    pub fn etag(&self) -> &str {
+        &self.etag
+    }
+
+    /// Returns the body and entity-tag for the given encoding, if available.
+    fn variant(&self, encoding: Encoding) -> Option<(&Bytes, &str)> {
+        let variant = match encoding {
+            Encoding::Identity => return Some((&self.identity, &self.etag)),
+            Encoding::Brotli => self.brotli.as_ref(),
+            Encoding::Gzip => self.gzip.as_ref(),
+        }?;
+        Some((&variant.body, &variant.etag))
+    }
+
+    /// Build the response for the given request headers.
+    ///
+    /// This picks the representation according to `Accept-Encoding` and honours `If-None-Match`.
+    pub fn respond(&self, headers: &HeaderMap, content_type: &str) -> HttpResponse {
+        let encoding = Encoding::negotiate(headers);
+        let (encoding, (body, etag)) = match self.variant(encoding) {
+            Some(variant) => (encoding, variant),
+            None => (Encoding::Identity, (&self.identity, self.etag.as_str())),
+        };
+
+        if crate::if_none_match(headers, etag) {
+            return HttpResponse::NotModified()
+                .insert_header((header::ETAG, etag))
+                .insert_header((header::VARY, "accept-encoding"))
+                .finish();
+        }
+
+        let mut resp = HttpResponse::Ok();
+        resp.content_type(content_type)
+            .insert_header((header::VARY, "accept-encoding"));
+        if !etag.is_empty() {
+            resp.insert_header((header::ETAG, etag));
+        }
+        if encoding != Encoding::Identity {
+            // This also keeps the compression middleware from encoding the body again.
+            resp.insert_header((header::CONTENT_ENCODING, encoding.as_str()));
+        }
+        resp.body(body.clone())
+    }
+}
+
+/// Compress the body, deriving the entity-tag of the variant from the one of the body.
+fn compress(body: &[u8], etag: &str, encoding: Encoding) -> Option<Variant> {
+    if body.is_empty() {
+        return None;
+    }
+
+    let compressed = match encoding {
+        Encoding::Identity => return None,
+        Encoding::Brotli => {
+            let mut encoder = brotli2::write::BrotliEncoder::new(Vec::new(), BROTLI_QUALITY);
+            encoder.write_all(body).and_then(|_| encoder.finish())
+        }
+        Encoding::Gzip => {
+            let mut encoder =
+                flate2::write::GzEncoder::new(Vec::new(), flate2::Compression::default());
+            encoder.write_all(body).and_then(|_| encoder.finish())
+        }
+    }
+    .ok()?;
+
+    let etag = match etag.strip_suffix('"') {
+        Some(unquoted) => format!("{}-{}\"", unquoted, encoding.as_str()),
+        None => format!("{}-{}", etag, encoding.as_str()),
+    };
+
+    Some(Variant {
+        body: Bytes::from(compressed),
+        etag,
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use actix_web::http::{HeaderValue, StatusCode};
+    use std::io::Read;
+
+    fn accept_encoding(value: &'static str) -> HeaderMap {
+        let mut headers = HeaderMap::new();
+        headers.insert(header::ACCEPT_ENCODING, HeaderValue::from_static(value));
+        headers
+    }
+
+    #[test]
+    fn negotiate_encoding() {
+        assert_eq!(Encoding::negotiate(&HeaderMap::new()), Encoding::Identity);
+        assert_eq!(
+            Encoding::negotiate(&accept_encoding("gzip, deflate, br")),
+            Encoding::Brotli
+        );
+        assert_eq!(
+            Encoding::negotiate(&accept_encoding("gzip;q=1.0, br;q=0.5")),
+            Encoding::Gzip
+        );
+        assert_eq!(
+            Encoding::negotiate(&accept_encoding("br;q=0, x-gzip")),
+            Encoding::Gzip
+        );
+        assert_eq!(
+            Encoding::negotiate(&accept_encoding("identity, gzip;q=0.5")),
+            Encoding::Identity
+        );
+        assert_eq!(Encoding::negotiate(&accept_encoding("*")), Encoding::Brotli);
+        assert_eq!(
+            Encoding::negotiate(&accept_encoding("deflate")),
+            Encoding::Identity
+        );
+    }
+
+    #[test]
+    fn respond_with_precompressed_variant() {
+        let json = br#"{"nodes":[],"edges":[]}"#;
+        let body = EncodedBody::new(Bytes::from_static(json));
+
+        let resp = body.respond(&accept_encoding("gzip"), "application/json");
+        assert_eq!(resp.status(), StatusCode::OK);
+        assert_eq!(
+            resp.headers().get(header::CONTENT_ENCODING).unwrap(),
+            "gzip"
+        );
+        let etag = resp.headers().get(header::ETAG).unwrap().clone();
+        assert_ne!(etag, body.etag());
+
+        let gzip = &body.gzip.as_ref().unwrap().body;
+        let mut decoded = Vec::new();
+        flate2::read::GzDecoder::new(&gzip[..])
+            .read_to_end(&mut decoded)
+            .unwrap();
+        assert_eq!(decoded, &json[..]);
+
+        let mut headers = accept_encoding("gzip");
+        headers.insert(header::IF_NONE_MATCH, etag);
+        let resp = body.respond(&headers, "application/json");
+        assert_eq!(resp.status(), StatusCode::NOT_MODIFIED);
+
+        let resp = body.respond(&HeaderMap::new(), "application/json");
+        assert_eq!(resp.status(), StatusCode::OK);
+        assert!(resp.headers().get(header::CONTENT_ENCODING).is_none());
+        assert_eq!(resp.headers().get(header::ETAG).unwrap(), body.etag());
+    }
+
+    #[test]
+    fn uncompressed_falls_back_to_identity() {
+        let body = EncodedBody::uncompressed(Bytes::from_static(b"{}"));
+
+        let resp = body.respond(&accept_encoding("br, gzip"), "application/json");
+        assert_eq!(resp.status(), StatusCode::OK);
+        assert!(resp.headers().get(header::CONTENT_ENCODING).is_none());
+    }
+}
@@ -77,6 +77,14 @@ pub enum GraphError {
     /// Failed to parse as Semantic Version
     #[error("failed to process version: {}", _0)]
     ArchVersionError(String),
+
+    /// Requested graph generation is not available.
+    #[error("unknown graph generation: {}", _0)]
+    UnknownGeneration(u64),
+
+    /// Requested release version is not in the graph.
+    #[error("unknown version: {}", _0)]
+    UnknownVersion(String),
 }
 
 impl actix_web::error::ResponseError for GraphError {
@@ -119,6 +127,8 @@ impl GraphError {
             GraphError::MissingParams(_) => http::StatusCode::BAD_REQUEST,
             GraphError::InvalidParams(_) => http::StatusCode::BAD_REQUEST,
             GraphError::ArchVersionError(_) => http::StatusCode::INTERNAL_SERVER_ERROR,
+            GraphError::UnknownGeneration(_) => http::StatusCode::NOT_FOUND,
+            GraphError::UnknownVersion(_) => http::StatusCode::NOT_FOUND,
         }
     }
 
@@ -134,6 +144,8 @@ impl GraphError {
             GraphError::MissingParams(_) => "missing_params",
             GraphError::InvalidParams(_) => "invalid_params",
             GraphError::ArchVersionError(_) => "arch_version_error",
+            GraphError::UnknownGeneration(_) => "unknown_generation",
+            GraphError::UnknownVersion(_) => "unknown_version",
         };
         kind.to_string()
     }
@@ -12,6 +12,7 @@ mod config;
 pub use crate::config::MergeOptions;
 
 pub mod de;
+pub mod encoding;
 pub mod metrics;
 pub mod testing;
 pub mod tracing;
@@ -25,7 +26,10 @@ pub mod prelude_errors {
 }
 
 use actix_web::http::{header, HeaderMap};
+use actix_web::web::{BufMut, Bytes, BytesMut};
+use sha2::{Digest, Sha256};
 use std::collections::HashSet;
+use std::sync::atomic::{AtomicUsize, Ordering};
 use url::form_urlencoded;
 
 /// Strip all but one leading slash and all trailing slashes
@@ -96,37 +100,121 @@ pub fn validate_content_type(
     headers: &HeaderMap,
     content_type: &'static str,
 ) -> Result<(), GraphError> {
-    let header_value = match headers.get(header::ACCEPT) {
-        None => return Ok(()),
-        Some(v) => v,
-    };
-
-    let full_type = header::HeaderValue::from_static(content_type);
-    let wildcard = header::HeaderValue::from_static("*");
-    let double_wildcard = header::HeaderValue::from_static("*/*");
-    let top_type = content_type.split("/").next().unwrap_or("");
-    let top_type_wildcard = header::HeaderValue::from_str(&format!("{}/*", top_type));
-    assert!(
-        top_type_wildcard.is_ok(),
-        "could not form top-type wildcard from {}",
-        top_type
-    );
-
-    let acceptable_content_types: Vec<actix_web::http::HeaderValue> = vec![
-        full_type,
-        wildcard,
-        double_wildcard,
-        top_type_wildcard.unwrap(),
-    ];
-
-    // FIXME: this is not a full-blown Accept parser
-    if acceptable_content_types.iter().any(|c| c == header_value) {
+    if headers.get(header::ACCEPT).is_none() || accepts_media_type(headers, content_type) {
         Ok(())
     } else {
         Err(GraphError::InvalidContentType)
     }
 }
 
+/// Returns true if the `Accept` header lists the given media type with a non-zero quality.
+///
+/// Wildcards are taken into account. A missing `Accept` header doesn't accept anything,
+/// so that callers can tell an explicit request for the media type apart.
+pub fn accepts_media_type(headers: &HeaderMap, media_type: &str) -> bool {
+    media_type_quality(headers, media_type, true) > 0.0
+}
+
+/// Returns true if the client explicitly prefers `media_type` over `fallback`.
+///
+/// This only holds if the `Accept` header lists `media_type` itself, not through a
+/// wildcard, with a quality at least as high as the one `fallback` is accepted with.
+/// Clients sending `*/*` or no `Accept` header at all thus keep getting `fallback`.
+pub fn prefers_media_type(headers: &HeaderMap, media_type: &str, fallback: &str) -> bool {
+    let quality = media_type_quality(headers, media_type, false);
+    quality > 0.0 && quality >= media_type_quality(headers, fallback, true)
+}
+
+/// Returns the quality the `Accept` header assigns to the given media type.
+///
+/// The most specific matching range determines the quality, wildcards are only considered
+/// if requested. Returns zero if no range matches.
+fn media_type_quality(headers: &HeaderMap, media_type: &str, wildcards: bool) -> f32 {
+    let top_type = media_type.split('/').next().unwrap_or("");
+
+    headers
+        .get_all(header::ACCEPT)
+        .filter_map(|value| value.to_str().ok())
+        .flat_map(|value| value.split(','))
+        .filter_map(|item| {
+            let mut parts = item.split(';').map(str::trim);
+            let range = parts.next().unwrap_or("");
+            let quality = parts
+                .find_map(|param| param.strip_prefix("q="))
+                .map_or(1.0, |q| q.parse::<f32>().unwrap_or(0.0));
+
+            let specificity = if range.eq_ignore_ascii_case(media_type) {
+                2
+            } else if !wildcards {
+                return None;
+            } else if range
+                .strip_suffix("/*")
+                .map_or(false, |range_top| range_top.eq_ignore_ascii_case(top_type))
+            {
+                1
+            } else if range == "*" || range == "*/*" {
+                0
+            } else {
+                return None;
+            };
+
+            Some((specificity, quality))
+        })
+        .max_by(|(a, a_quality), (b, b_quality)| {
+            a.cmp(b).then(
+                a_quality
+                    .partial_cmp(b_quality)
+                    .unwrap_or(std::cmp::Ordering::Equal),
+            )
+        })
+        .map_or(0.0, |(_, quality)| quality)
+}
+
+/// Compute a strong entity-tag for the given response body.
+///
+/// The returned value is already quoted and can be used as is for the `ETag` header.
+pub fn compute_etag(body: &[u8]) -> String {
+    format!("\"{}\"", hex::encode(Sha256::digest(body)))
+}
+
+/// Check whether the `If-None-Match` header matches the given entity-tag.
+///
+/// As mandated for `If-None-Match`, this uses the weak comparison function,
+/// i.e. a `W/` prefix on the client side is ignored.
+pub fn if_none_match(headers: &HeaderMap, etag: &str) -> bool {
+    if etag.is_empty() {
+        return false;
+    }
+
+    headers
+        .get_all(header::IF_NONE_MATCH)
+        .filter_map(|value| value.to_str().ok())
+        .flat_map(|value| value.split(','))
+        .map(str::trim)
+        .any(|candidate| {
+            candidate == "*" || candidate.strip_prefix("W/").unwrap_or(candidate) == etag
+        })
+}
+
+/// Serialize `value` as JSON into a shareable buffer.
+///
+/// The buffer is pre-sized from `size_hint`, which is then updated with the length
+/// of the result, so that repeatedly serializing similarly sized values doesn't need
+/// to grow the buffer. The buffer is frozen in place without copying.
+pub fn to_json_bytes<T>(value: &T, size_hint: &AtomicUsize) -> Result<Bytes, serde_json::Error>
+where
+    T: serde::Serialize + ?Sized,
+{
+    let hint = size_hint.load(Ordering::Relaxed);
+    let mut writer = BytesMut::with_capacity(hint + hint / 8).writer();
+    serde_json::to_writer(&mut writer, value)?;
+
+    let body = writer.into_inner().freeze();
+    size_hint.store(body.len(), Ordering::Relaxed);
+
+    Ok(body)
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -139,6 +227,15 @@ mod tests {
         assert_eq!(parse_path_prefix("a/b/c"), "/a/b/c");
     }
 
+    #[test]
+    fn test_to_json_bytes() {
+        let size_hint = AtomicUsize::new(0);
+
+        let body = to_json_bytes(&vec!["a", "b"], &size_hint).unwrap();
+        assert_eq!(body, Bytes::from_static(br#"["a","b"]"#));
+        assert_eq!(size_hint.load(Ordering::Relaxed), body.len());
+    }
+
     #[test]
     fn test_parse_params_set() {
         assert_eq!(parse_params_set(""), HashSet::new());
@@ -175,16 +272,92 @@ mod tests {
         validate_content_type(&headers, "application/json").unwrap(); // if the request leaves Accept empty, we can return whatever we want
         headers.insert(
             header::ACCEPT,
-            //"application/json, text/*; q=0.2".parse().unwrap(), // prefer JSON, but also accept any text/* after an 80% markdown in quality.  FIXME: needs a smarter parser in validate_content_type
-            "application/json".parse().unwrap(),
+            "application/json, text/*; q=0.2".parse().unwrap(), // prefer JSON, but also accept any text/* after an 80% markdown in quality.
         );
         validate_content_type(&headers, "application/json").unwrap();
+        validate_content_type(&headers, "text/plain").unwrap();
+        validate_content_type(&headers, "image/png").unwrap_err();
+        headers.insert(header::ACCEPT, "text/*;q=0".parse().unwrap());
+        validate_content_type(&headers, "text/plain").unwrap_err();
+    }
+
+    #[test]
+    fn test_accepts_media_type() {
+        let mut headers = actix_web::http::HeaderMap::new();
+        assert!(!accepts_media_type(&headers, "application/json"));
+
         headers.insert(
-            // FIXME: drop once validate_content_type gets a smarter parser and the previous insert can include the text/* entry
             header::ACCEPT,
-            "text/*".parse().unwrap(),
+            "application/vnd.example+protobuf, application/json;q=0.5"
+                .parse()
+                .unwrap(),
         );
-        validate_content_type(&headers, "text/plain").unwrap();
-        validate_content_type(&headers, "image/png").unwrap_err();
+        assert!(accepts_media_type(
+            &headers,
+            "application/vnd.example+protobuf"
+        ));
+        assert!(accepts_media_type(&headers, "application/json"));
+        assert!(!accepts_media_type(&headers, "text/plain"));
+
+        headers.insert(header::ACCEPT, "*/*".parse().unwrap());
+        assert!(accepts_media_type(&headers, "text/plain"));
+    }
+
+    #[test]
+    fn test_prefers_media_type() {
+        let protobuf = "application/vnd.example+protobuf";
+        let json = "application/json";
+        let prefers = |accept: Option<&str>| {
+            let mut headers = actix_web::http::HeaderMap::new();
+            if let Some(accept) = accept {
+                headers.insert(header::ACCEPT, accept.parse().unwrap());
+            }
+            prefers_media_type(&headers, protobuf, json)
+        };
+
+        assert!(!prefers(None));
+        assert!(!prefers(Some("*/*")));
+        assert!(!prefers(Some("application/*")));
+        assert!(!prefers(Some("application/json, */*;q=0.1")));
+        assert!(prefers(Some("application/vnd.example+protobuf")));
+        assert!(prefers(Some(
+            "application/vnd.example+protobuf, application/json;q=0.5"
+        )));
+        assert!(prefers(Some("application/vnd.example+protobuf, */*")));
+        assert!(!prefers(Some(
+            "application/vnd.example+protobuf;q=0.5, application/json"
+        )));
+        assert!(!prefers(Some(
+            "application/vnd.example+protobuf;q=0.5, application/*"
+        )));
+        assert!(!prefers(Some("application/vnd.example+protobuf;q=0")));
+    }
+
+    #[test]
+    fn test_compute_etag() {
+        let etag = compute_etag(b"{}");
+        assert!(etag.starts_with('"') && etag.ends_with('"'));
+        assert_eq!(etag, compute_etag(b"{}"));
+        assert_ne!(etag, compute_etag(b"[]"));
+    }
+
+    #[test]
+    fn test_if_none_match() {
+        let etag = compute_etag(b"{}");
+        let mut headers = actix_web::http::HeaderMap::new();
+        assert!(!if_none_match(&headers, &etag));
+
+        headers.insert(header::IF_NONE_MATCH, "\"other\"".parse().unwrap());
+        assert!(!if_none_match(&headers, &etag));
+
+        headers.insert(
+            header::IF_NONE_MATCH,
+            format!("\"other\", W/{}", etag).parse().unwrap(),
+        );
+        assert!(if_none_match(&headers, &etag));
+
+        headers.insert(header::IF_NONE_MATCH, "*".parse().unwrap());
+        assert!(if_none_match(&headers, &etag));
+        assert!(!if_none_match(&headers, ""));
     }
 }
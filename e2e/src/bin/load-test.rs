@@ -0,0 +1,479 @@
+//! Load generator for the policy-engine.
+//!
+//! This replays the requests of a vegeta targets file at a fixed rate against
+//! a running graph-builder and policy-engine pair. It reports latency
+//! percentiles, throughput and the memory usage of the given processes, and
+//! fails if any latency threshold is exceeded.
+//!
+//! Thresholds are rounded up to the next bucket of the policy-engine's
+//! `v1_graph_serve_duration_seconds` histogram. If the metrics endpoint is
+//! given, the histogram is scraped before and after the run, and the
+//! server-side percentiles are checked against the same bounds as the
+//! client-side ones.
+
+use anyhow::{bail, ensure, format_err, Context, Result};
+use reqwest::header::{HeaderMap, HeaderName, HeaderValue};
+use reqwest::Method;
+use std::path::PathBuf;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use structopt::StructOpt;
+
+/// Placeholder for the graph endpoint in the targets file.
+static GRAPH_URL_PLACEHOLDER: &str = "GRAPH_URL";
+
+/// Name of the policy-engine serve latency histogram, without the metrics prefix.
+static SERVE_DURATION_METRIC: &str = "v1_graph_serve_duration_seconds";
+
+/// Buckets of the serve latency histogram, used if its metrics are not scraped.
+static SERVE_DURATION_BUCKETS: &[f64] = &[
+    0.005, 0.01, 0.025, 0.05, 0.075, 0.1, 0.25, 0.5, 0.75, 1.0, 5.0,
+];
+
+/// Checked percentiles, by name.
+static PERCENTILES: &[(&str, f64)] = &[("p50", 0.5), ("p99", 0.99), ("p999", 0.999)];
+
+/// Command-line options.
+#[derive(Debug, StructOpt)]
+#[structopt(name = "load-test")]
+struct Options {
+    /// URL of the policy-engine graph endpoint
+    #[structopt(long = "graph-url", default_value = "http://localhost:8081/v1/graph")]
+    graph_url: String,
+
+    /// URL of the policy-engine metrics endpoint
+    #[structopt(long = "metrics-url")]
+    metrics_url: Option<String>,
+
+    /// Path to the vegeta targets file to replay
+    #[structopt(long = "targets", default_value = "hack/vegeta.targets")]
+    targets: PathBuf,
+
+    /// Requests per second
+    #[structopt(long = "rate", default_value = "100")]
+    rate: u32,
+
+    /// Maximum number of requests in flight
+    #[structopt(long = "workers", default_value = "50")]
+    workers: usize,
+
+    /// Duration of the run in seconds
+    #[structopt(long = "duration", default_value = "30")]
+    duration_secs: u64,
+
+    /// Request timeout in seconds
+    #[structopt(long = "timeout", default_value = "10")]
+    timeout_secs: u64,
+
+    /// PIDs of the processes whose memory usage to report
+    #[structopt(long = "pid")]
+    pids: Vec<u32>,
+
+    /// Maximum median latency in seconds
+    #[structopt(long = "max-p50")]
+    max_p50: Option<f64>,
+
+    /// Maximum 99th percentile latency in seconds
+    #[structopt(long = "max-p99", default_value = "0.5")]
+    max_p99: f64,
+
+    /// Maximum 99.9th percentile latency in seconds
+    #[structopt(long = "max-p999")]
+    max_p999: Option<f64>,
+
+    /// Maximum ratio of failed requests
+    #[structopt(long = "max-error-ratio", default_value = "0")]
+    max_error_ratio: f64,
+}
+
+impl Options {
+    /// Latency thresholds by percentile name.
+    fn thresholds(&self) -> Vec<(&'static str, f64, f64)> {
+        PERCENTILES
+            .iter()
+            .zip(&[self.max_p50, Some(self.max_p99), self.max_p999])
+            .filter_map(|((name, quantile), max)| max.map(|max| (*name, *quantile, max)))
+            .collect()
+    }
+}
+
+/// A request from the targets file.
+#[derive(Debug, Clone)]
+struct Target {
+    method: Method,
+    url: String,
+    headers: HeaderMap,
+}
+
+/// Parse the requests of a vegeta targets file in the HTTP format.
+///
+/// Requests are separated by empty lines, and `GRAPH_URL` is replaced by the given URL.
+fn parse_targets(content: &str, graph_url: &str) -> Result<Vec<Target>> {
+    let mut targets = Vec::new();
+    let mut current: Option<Target> = None;
+
+    for (number, line) in content.lines().enumerate() {
+        let line = line.trim();
+        if line.starts_with('#') {
+            continue;
+        }
+        if line.is_empty() {
+            targets.extend(current.take());
+            continue;
+        }
+
+        let context = || format!("line {}: '{}'", number + 1, line);
+        match &mut current {
+            None => {
+                let mut parts = line.split_whitespace();
+                let (method, url) = match (parts.next(), parts.next(), parts.next()) {
+                    (Some(method), Some(url), None) => (method, url),
+                    _ => bail!("expected method and URL on {}", context()),
+                };
+                current = Some(Target {
+                    method: method.parse().with_context(context)?,
+                    url: url.replace(GRAPH_URL_PLACEHOLDER, graph_url),
+                    headers: HeaderMap::new(),
+                });
+            }
+            Some(_) if line.starts_with('@') => {
+                bail!("request bodies are not supported on {}", context())
+            }
+            Some(target) => {
+                let (name, value) = line
+                    .split_once(':')
+                    .ok_or_else(|| format_err!("expected header on {}", context()))?;
+                target.headers.append(
+                    HeaderName::from_bytes(name.trim().as_bytes()).with_context(context)?,
+                    HeaderValue::from_str(value.trim()).with_context(context)?,
+                );
+            }
+        }
+    }
+    targets.extend(current);
+
+    ensure!(!targets.is_empty(), "no targets found");
+    Ok(targets)
+}
+
+/// Outcome of a single request.
+#[derive(Debug, Clone, Copy)]
+struct Sample {
+    latency: Duration,
+    success: bool,
+}
+
+/// Send the targets in turn at the configured rate until the duration is over.
+///
+/// No more than `workers` requests are in flight, further requests wait for a free worker.
+/// Latency is measured from the time a request was scheduled to be sent, so the time it
+/// waited for a worker behind slow responses is included instead of omitted.
+async fn attack(options: &Options, targets: Vec<Target>) -> Result<(Vec<Sample>, Duration)> {
+    let client = reqwest::Client::builder()
+        .timeout(Duration::from_secs(options.timeout_secs))
+        .build()
+        .context("Building reqwest client")?;
+    let workers = Arc::new(tokio::sync::Semaphore::new(options.workers));
+    let mut interval = tokio::time::interval(Duration::from_secs_f64(1.0 / options.rate as f64));
+
+    let started = Instant::now();
+    let deadline = started + Duration::from_secs(options.duration_secs);
+    let mut requests = Vec::new();
+
+    for target in targets.iter().cycle() {
+        let scheduled = interval.tick().await.into_std();
+        let worker = workers.clone().acquire_owned().await?;
+        if Instant::now() >= deadline {
+            break;
+        }
+
+        let request = client
+            .request(target.method.clone(), &target.url)
+            .headers(target.headers.clone());
+        requests.push(tokio::spawn(async move {
+            let _worker = worker;
+            let success = match request.send().await {
+                Ok(response) => {
+                    let status = response.status();
+                    response.bytes().await.is_ok() && status.is_success()
+                }
+                Err(_) => false,
+            };
+            Sample {
+                latency: scheduled.elapsed(),
+                success,
+            }
+        }));
+    }
+
+    let mut samples = Vec::with_capacity(requests.len());
+    for request in requests {
+        samples.push(request.await?);
+    }
+
+    Ok((samples, started.elapsed()))
+}
+
+/// Nearest-rank percentile of the sorted latencies.
+fn percentile(sorted: &[Duration], quantile: f64) -> Duration {
+    if sorted.is_empty() {
+        return Duration::from_secs(0);
+    }
+    let rank = (quantile * sorted.len() as f64).ceil() as usize;
+    sorted[rank.clamp(1, sorted.len()) - 1]
+}
+
+/// Cumulative counts of a histogram, by bucket upper bound.
+type Buckets = Vec<(f64, f64)>;
+
+/// Parse the serve latency histogram buckets from a Prometheus text exposition.
+fn parse_buckets(metrics: &str) -> Buckets {
+    let bucket = format!("{}_bucket{{", SERVE_DURATION_METRIC);
+
+    let mut buckets: Buckets = metrics
+        .lines()
+        .filter(|line| !line.starts_with('#'))
+        .filter_map(|line| {
+            let labels = &line[line.find(&bucket)? + bucket.len()..];
+            let (labels, value) = labels.split_once('}')?;
+            let le = labels
+                .split(',')
+                .find_map(|label| label.trim().strip_prefix("le=\""))?
+                .trim_end_matches('"');
+            let le = if le == "+Inf" {
+                f64::INFINITY
+            } else {
+                le.parse().ok()?
+            };
+            Some((le, value.trim().parse().ok()?))
+        })
+        .collect();
+    buckets.sort_by(|a, b| a.0.partial_cmp(&b.0).unwrap_or(std::cmp::Ordering::Equal));
+    buckets
+}
+
+/// Counts observed between two scrapes of the same histogram.
+fn bucket_delta(before: &[(f64, f64)], after: &[(f64, f64)]) -> Buckets {
+    after
+        .iter()
+        .map(|(le, count)| {
+            let previous = before
+                .iter()
+                .find(|(previous_le, _)| previous_le == le)
+                .map_or(0.0, |(_, count)| *count);
+            (*le, count - previous)
+        })
+        .collect()
+}
+
+/// Upper bound of the bucket which contains the given quantile.
+fn bucket_quantile(buckets: &[(f64, f64)], quantile: f64) -> Option<f64> {
+    let total = buckets.last()?.1;
+    if total <= 0.0 {
+        return None;
+    }
+    buckets
+        .iter()
+        .find(|(_, count)| *count >= quantile * total)
+        .map(|(le, _)| *le)
+}
+
+/// Round the threshold up to the next bucket upper bound.
+fn snap_to_bucket(threshold: f64, bounds: &[f64]) -> f64 {
+    bounds
+        .iter()
+        .copied()
+        .find(|bound| *bound >= threshold)
+        .unwrap_or(threshold)
+}
+
+/// Current and peak resident set size of the process in kB, from procfs.
+fn memory_usage(pid: u32) -> Result<(u64, u64)> {
+    let path = format!("/proc/{}/status", pid);
+    let status = std::fs::read_to_string(&path).context(format!("Reading {}", path))?;
+    let field = |name: &str| -> Result<u64> {
+        status
+            .lines()
+            .find_map(|line| line.strip_prefix(name))
+            .and_then(|value| value.trim().trim_end_matches("kB").trim().parse().ok())
+            .ok_or_else(|| format_err!("missing {} in {}", name, path))
+    };
+    Ok((field("VmRSS:")?, field("VmHWM:")?))
+}
+
+fn scrape(runtime: &tokio::runtime::Runtime, url: &str) -> Result<Buckets> {
+    let metrics = runtime
+        .block_on(async { reqwest::get(url).await?.error_for_status()?.text().await })
+        .context(format!("Scraping {}", url))?;
+    let buckets = parse_buckets(&metrics);
+    ensure!(
+        !buckets.is_empty(),
+        "no {} histogram at {}",
+        SERVE_DURATION_METRIC,
+        url
+    );
+    Ok(buckets)
+}
+
+fn main() -> Result<()> {
+    env_logger::init();
+    let options = Options::from_args();
+    ensure!(options.rate > 0, "rate must be positive");
+    ensure!(options.workers > 0, "workers must be positive");
+
+    let content = std::fs::read_to_string(&options.targets)
+        .context(format!("Reading {:?}", options.targets))?;
+    let targets = parse_targets(&content, &options.graph_url)?;
+
+    let runtime = tokio::runtime::Builder::new_multi_thread()
+        .enable_all()
+        .build()?;
+
+    let before = match &options.metrics_url {
+        Some(url) => Some(scrape(&runtime, url)?),
+        None => None,
+    };
+
+    println!(
+        "Replaying {} targets at {}/s with {} workers for {}s",
+        targets.len(),
+        options.rate,
+        options.workers,
+        options.duration_secs
+    );
+    let (samples, elapsed) = runtime.block_on(attack(&options, targets))?;
+
+    let server_buckets = match (&options.metrics_url, before) {
+        (Some(url), Some(before)) => Some(bucket_delta(&before, &scrape(&runtime, url)?)),
+        _ => None,
+    };
+
+    let failed = samples.iter().filter(|sample| !sample.success).count();
+    let mut latencies: Vec<Duration> = samples.iter().map(|sample| sample.latency).collect();
+    latencies.sort_unstable();
+
+    println!(
+        "Requests: {} ({} failed), throughput: {:.1}/s",
+        samples.len(),
+        failed,
+        (samples.len() - failed) as f64 / elapsed.as_secs_f64()
+    );
+    for (name, quantile) in PERCENTILES {
+        println!(
+            "Latency {}: {:.2}ms",
+            name,
+            percentile(&latencies, *quantile).as_secs_f64() * 1000.0
+        );
+    }
+    for pid in &options.pids {
+        match memory_usage(*pid) {
+            Ok((rss, peak)) => println!("RSS of {}: {} kB (peak {} kB)", pid, rss, peak),
+            Err(e) => eprintln!("{:#}", e),
+        }
+    }
+
+    let bounds: Vec<f64> = match &server_buckets {
+        Some(buckets) => buckets.iter().map(|(le, _)| *le).collect(),
+        None => SERVE_DURATION_BUCKETS.to_vec(),
+    };
+
+    let mut violations = Vec::new();
+    let error_ratio = failed as f64 / samples.len().max(1) as f64;
+    if error_ratio > options.max_error_ratio {
+        violations.push(format!(
+            "error ratio {:.4} exceeds {}",
+            error_ratio, options.max_error_ratio
+        ));
+    }
+    for (name, quantile, max) in options.thresholds() {
+        let bound = snap_to_bucket(max, &bounds);
+
+        let client = percentile(&latencies, quantile).as_secs_f64();
+        if client > bound {
+            violations.push(format!(
+                "client {} latency {:.4}s exceeds {}s",
+                name, client, bound
+            ));
+        }
+
+        let server = server_buckets
+            .as_ref()
+            .and_then(|buckets| bucket_quantile(buckets, quantile));
+        if let Some(server) = server {
+            println!("Server {} latency bucket: <= {}s", name, server);
+            if server > bound {
+                violations.push(format!(
+                    "server {} latency bucket {}s exceeds {}s",
+                    name, server, bound
+                ));
+            }
+        }
+    }
+
+    if !violations.is_empty() {
+        bail!("SLO violated:\n{}", violations.join("\n"));
+    }
+    println!("All thresholds met");
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parse_vegeta_targets() -> Result<()> {
+        let targets = parse_targets(
+            "# comment\nGET GRAPH_URL?channel=a\nAccept: application/json\n\n\nGET GRAPH_URL?channel=b\n",
+            "http://localhost/v1/graph",
+        )?;
+
+        assert_eq!(targets.len(), 2);
+        assert_eq!(targets[0].url, "http://localhost/v1/graph?channel=a");
+        assert_eq!(targets[0].headers["accept"], "application/json");
+        assert_eq!(targets[1].url, "http://localhost/v1/graph?channel=b");
+        assert!(targets[1].headers.is_empty());
+
+        assert!(parse_targets("# only a comment\n", "").is_err());
+        assert!(parse_targets("GET\n", "").is_err());
+        assert!(parse_targets("POST url\n@body.json\n", "").is_err());
+
+        Ok(())
+    }
+
+    #[test]
+    fn percentiles_and_buckets() {
+        let latencies: Vec<Duration> = (1..=1000).map(Duration::from_millis).collect();
+        assert_eq!(percentile(&latencies, 0.5), Duration::from_millis(500));
+        assert_eq!(percentile(&latencies, 0.999), Duration::from_millis(999));
+        assert_eq!(percentile(&[], 0.5), Duration::from_secs(0));
+
+        let before = parse_buckets(
+            "# TYPE cincinnati_pe_v1_graph_serve_duration_seconds histogram\n\
+             cincinnati_pe_v1_graph_serve_duration_seconds_bucket{le=\"0.01\"} 5\n\
+             cincinnati_pe_v1_graph_serve_duration_seconds_bucket{le=\"0.1\"} 5\n\
+             cincinnati_pe_v1_graph_serve_duration_seconds_bucket{le=\"+Inf\"} 5\n\
+             cincinnati_pe_v1_graph_serve_duration_seconds_count 5\n",
+        );
+        let after = parse_buckets(
+            "cincinnati_pe_v1_graph_serve_duration_seconds_bucket{le=\"0.01\"} 95\n\
+             cincinnati_pe_v1_graph_serve_duration_seconds_bucket{le=\"0.1\"} 104\n\
+             cincinnati_pe_v1_graph_serve_duration_seconds_bucket{le=\"+Inf\"} 105\n",
+        );
+        assert_eq!(before.len(), 3);
+
+        let delta = bucket_delta(&before, &after);
+        assert_eq!(
+            delta,
+            vec![(0.01, 90.0), (0.1, 99.0), (f64::INFINITY, 100.0)]
+        );
+        assert_eq!(bucket_quantile(&delta, 0.5), Some(0.01));
+        assert_eq!(bucket_quantile(&delta, 0.99), Some(0.1));
+        assert_eq!(bucket_quantile(&delta, 0.999), Some(f64::INFINITY));
+
+        assert_eq!(snap_to_bucket(0.3, SERVE_DURATION_BUCKETS), 0.5);
+        assert_eq!(snap_to_bucket(0.5, SERVE_DURATION_BUCKETS), 0.5);
+        assert_eq!(snap_to_bucket(10.0, SERVE_DURATION_BUCKETS), 10.0);
+    }
+}
@@ -42,6 +42,10 @@ pub struct ServiceOptions {
     #[serde(default = "Option::default", deserialize_with = "de_duration_secs")]
     pub scrape_timeout_secs: Option<Duration>,
 
+    /// Number of previous graphs which deltas are served for
+    #[structopt(long = "service.delta_history")]
+    pub delta_history: Option<usize>,
+
     /// Address on which the server will listen
     #[structopt(name = "service_address", long = "service.address", alias = "address")]
     pub address: Option<IpAddr>,
@@ -99,6 +103,7 @@ impl MergeOptions<Option<ServiceOptions>> for AppSettings {
         if let Some(service) = opts {
             assign_if_some!(self.pause_secs, service.pause_secs);
             assign_if_some!(self.scrape_timeout_secs, service.scrape_timeout_secs);
+            assign_if_some!(self.delta_history, service.delta_history);
             assign_if_some!(self.address, service.address);
             assign_if_some!(self.port, service.port);
             assign_if_some!(self.path_prefix, service.path_prefix);
@@ -38,6 +38,10 @@ pub struct AppSettings {
     /// Timeout (in seconds) per registry scrape.
     pub scrape_timeout_secs: Option<time::Duration>,
 
+    /// Number of previous graphs which deltas are served for.
+    #[default(crate::graph::DEFAULT_DELTA_HISTORY)]
+    pub delta_history: usize,
+
     /// Listening port for the main service.
     #[default(8080)]
     pub port: u16,
@@ -14,9 +14,12 @@
 
 use crate::built_info;
 use crate::config;
+use actix_web::http::{header, HeaderValue};
 use actix_web::{HttpRequest, HttpResponse};
+use cincinnati::delta::{self, GraphDelta};
 use cincinnati::plugins::prelude::*;
-use cincinnati::CONTENT_TYPE;
+use cincinnati::{transport, CONTENT_TYPE};
+use commons::encoding::EncodedBody;
 use commons::metrics::HasRegistry;
 use commons::tracing::get_tracer;
 use commons::{Fallible, GraphError};
@@ -24,8 +27,8 @@ use lazy_static;
 use opentelemetry::trace::{mark_span_as_active, Tracer};
 pub use parking_lot::RwLock;
 use prometheus::{self, histogram_opts, labels, opts, Counter, Gauge, Histogram, IntGauge};
-use serde_json;
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::sync::atomic::AtomicUsize;
 use std::sync::Arc;
 use std::thread;
 
@@ -67,6 +70,11 @@ lazy_static! {
         "Total number of incoming HTTP client request to /v1/graph"
     )
     .unwrap();
+    static ref V1_GRAPH_DELTA_INCOMING_REQS: Counter = Counter::new(
+        "v1_graph_delta_incoming_requests_total",
+        "Total number of incoming HTTP client request to /v1/graph/delta"
+    )
+    .unwrap();
     static ref BUILD_INFO: Counter = Counter::with_opts(opts!(
         "build_info",
         "Build information",
@@ -83,6 +91,7 @@ lazy_static! {
 /// Register relevant metrics to a prometheus registry.
 pub fn register_metrics(registry: &prometheus::Registry) -> Fallible<()> {
     commons::register_metrics(&registry)?;
+    cincinnati::plugins::register_metrics(&registry)?;
     registry.register(Box::new(GRAPH_FINAL_RELEASES.clone()))?;
     registry.register(Box::new(GRAPH_LAST_SUCCESSFUL_REFRESH.clone()))?;
     registry.register(Box::new(UPSTREAM_ERRORS.clone()))?;
@@ -90,6 +99,7 @@ pub fn register_metrics(registry: &prometheus::Registry) -> Fallible<()> {
     registry.register(Box::new(GRAPH_UPSTREAM_INITIAL_SCRAPE.clone()))?;
     registry.register(Box::new(UPSTREAM_SCRAPES_DURATION.clone()))?;
     registry.register(Box::new(V1_GRAPH_INCOMING_REQS.clone()))?;
+    registry.register(Box::new(V1_GRAPH_DELTA_INCOMING_REQS.clone()))?;
     registry.register(Box::new(BUILD_INFO.clone()))?;
     Ok(())
 }
@@ -104,22 +114,117 @@ pub async fn index(
 
     V1_GRAPH_INCOMING_REQS.inc();
 
+    // Check for required client parameters.
+    let mandatory_params = &app_data.mandatory_params;
+    commons::ensure_query_params(mandatory_params, req.query_string())?;
+
+    // The representations are only replaced along with their generation.
+    // Cloning is cheap as all representations are reference-counted.
+    let (generation, protobuf, json) = {
+        let deltas = app_data.deltas.read();
+        (
+            deltas.generation,
+            app_data.protobuf.read().clone(),
+            app_data.json.read().clone(),
+        )
+    };
+
+    // Clients only get the binary representation if they explicitly ask for it.
+    if commons::prefers_media_type(req.headers(), transport::CONTENT_TYPE, CONTENT_TYPE)
+        && !protobuf.etag().is_empty()
+    {
+        let resp = protobuf.respond(req.headers(), transport::CONTENT_TYPE);
+        return Ok(with_generation(vary_on_accept(resp), generation));
+    }
+
     // Check that the client can accept JSON media type.
     commons::validate_content_type(req.headers(), CONTENT_TYPE)?;
 
+    let resp = json.respond(req.headers(), CONTENT_TYPE);
+    Ok(with_generation(vary_on_accept(resp), generation))
+}
+
+/// Serve the delta from a previous generation of the graph to the current one.
+pub async fn delta(
+    req: HttpRequest,
+    app_data: actix_web::web::Data<State>,
+) -> Result<HttpResponse, GraphError> {
+    let span = get_tracer().start("delta");
+    let _active_span = mark_span_as_active(span);
+
+    V1_GRAPH_DELTA_INCOMING_REQS.inc();
+
     // Check for required client parameters.
     let mandatory_params = &app_data.mandatory_params;
     commons::ensure_query_params(mandatory_params, req.query_string())?;
 
-    let resp = HttpResponse::Ok()
-        .content_type(CONTENT_TYPE)
-        .body(app_data.json.read().clone());
-    Ok(resp)
+    // Check that the client can accept the delta media type.
+    commons::validate_content_type(req.headers(), delta::CONTENT_TYPE)?;
+
+    let since = url::form_urlencoded::parse(req.query_string().as_bytes())
+        .find(|(key, _)| key == delta::SINCE_PARAM)
+        .ok_or_else(|| GraphError::MissingParams(vec![delta::SINCE_PARAM.to_string()]))?
+        .1
+        .parse::<u64>()
+        .map_err(|e| GraphError::InvalidParams(format!("{}: {}", delta::SINCE_PARAM, e)))?;
+
+    let (generation, body) = {
+        let deltas = app_data.deltas.read();
+        if since != 0 && since == deltas.generation {
+            return Ok(with_generation(HttpResponse::NotModified().finish(), since));
+        }
+        let body = deltas
+            .bodies
+            .get(&since)
+            .cloned()
+            .ok_or(GraphError::UnknownGeneration(since))?;
+        (deltas.generation, body)
+    };
+
+    let resp = body.respond(req.headers(), delta::CONTENT_TYPE);
+    Ok(with_generation(resp, generation))
+}
+
+/// Add the generation of the served graph to the response, if one has been published.
+fn with_generation(mut resp: HttpResponse, generation: u64) -> HttpResponse {
+    if generation != 0 {
+        resp.headers_mut().insert(
+            header::HeaderName::from_static(delta::GENERATION_HEADER),
+            HeaderValue::from(generation),
+        );
+    }
+    resp
+}
+
+/// Mark the response as depending on the requested media type.
+fn vary_on_accept(mut resp: HttpResponse) -> HttpResponse {
+    resp.headers_mut().insert(
+        header::VARY,
+        HeaderValue::from_static("accept, accept-encoding"),
+    );
+    resp
+}
+
+/// Default number of previous graphs which deltas are served for.
+pub static DEFAULT_DELTA_HISTORY: usize = 4;
+
+/// Generation of the published graph along with the deltas to it.
+#[derive(Debug, Default)]
+pub struct Deltas {
+    /// Generation of the published graph, zero until the first successful scrape.
+    generation: u64,
+    /// Serialized deltas to the published graph, by the generation they apply to.
+    bodies: HashMap<u64, EncodedBody>,
 }
 
 #[derive(Clone)]
 pub struct State {
-    json: Arc<RwLock<String>>,
+    /// Serialized graph and its precompressed variants, empty until the first successful scrape.
+    json: Arc<RwLock<EncodedBody>>,
+    /// Compact binary representation of the same graph, empty until the first successful scrape.
+    protobuf: Arc<RwLock<EncodedBody>>,
+    /// Generation of the graph and deltas to it, the other representations are only replaced while holding its lock.
+    deltas: Arc<RwLock<Deltas>>,
     /// Query parameters that must be present in all client requests.
     mandatory_params: HashSet<String>,
     live: Arc<RwLock<bool>>,
@@ -131,7 +236,7 @@ pub struct State {
 impl State {
     /// Creates a new State with the given arguments
     pub fn new(
-        json: Arc<RwLock<String>>,
+        json: Arc<RwLock<EncodedBody>>,
         mandatory_params: HashSet<String>,
         live: Arc<RwLock<bool>>,
         ready: Arc<RwLock<bool>>,
@@ -140,6 +245,8 @@ impl State {
     ) -> State {
         State {
             json,
+            protobuf: Default::default(),
+            deltas: Default::default(),
             mandatory_params,
             live,
             ready,
@@ -179,6 +286,21 @@ pub fn run(settings: &config::AppSettings, state: &State) -> ! {
     let mut first_iteration = true;
     let mut first_success = true;
 
+    // Size of the last serialized graph, used to pre-size the next buffer
+    let json_size_hint = AtomicUsize::new(0);
+
+    // Input revision of the last published graph
+    let mut published_revision: Option<String> = None;
+
+    // Previously published graphs which deltas are served for, oldest first
+    let mut history: VecDeque<(u64, cincinnati::Graph)> =
+        VecDeque::with_capacity(settings.delta_history);
+    let mut generation = initial_generation();
+
+    // Runtime for all scrapes, timed out scrapes are aborted on it
+    let mut plugin_runner =
+        cincinnati::plugins::PluginRunner::try_new().expect("failed to create plugin runtime");
+
     BUILD_INFO.inc();
 
     // Store amount of nodes in the graph for metrics
@@ -198,7 +320,7 @@ pub fn run(settings: &config::AppSettings, state: &State) -> ! {
         debug!("graph update triggered");
         let scrape_timer = UPSTREAM_SCRAPES_DURATION.start_timer();
 
-        let scrape = cincinnati::plugins::process_blocking(
+        let scrape = plugin_runner.process_blocking(
             state.plugins.iter(),
             cincinnati::plugins::PluginIO::InternalIO(cincinnati::plugins::InternalIO {
                 // the first plugin will produce the initial graph
@@ -220,17 +342,56 @@ pub fn run(settings: &config::AppSettings, state: &State) -> ! {
                 }
             };
 
-            let json_graph = match serde_json::to_string(&internal_io.graph) {
-                Ok(json) => json,
-                Err(err) => {
-                    UPSTREAM_ERRORS.inc();
-                    error!("Failed to serialize graph: {}", err);
-                    continue;
-                }
-            };
-
-            *state.json.write() = json_graph;
             nodes_count = internal_io.graph.releases_count() as i64;
+
+            let revision = internal_io.input_revision();
+            if revision.is_some() && revision == published_revision {
+                debug!("inputs unchanged since the last scrape");
+            } else {
+                let json_graph = match commons::to_json_bytes(&internal_io.graph, &json_size_hint) {
+                    Ok(json) => json,
+                    Err(err) => {
+                        UPSTREAM_ERRORS.inc();
+                        error!("Failed to serialize graph: {}", err);
+                        continue;
+                    }
+                };
+
+                // Only compress the graph if it changed.
+                let etag = commons::compute_etag(&json_graph);
+                if etag != state.json.read().etag() {
+                    let protobuf = match transport::encode(&internal_io.graph) {
+                        Ok(protobuf) => EncodedBody::new(protobuf.into()),
+                        Err(err) => {
+                            // Clients fall back to JSON.
+                            error!("Failed to encode graph: {}", err);
+                            EncodedBody::default()
+                        }
+                    };
+                    let json = EncodedBody::with_etag(json_graph, etag);
+
+                    generation += 1;
+                    let bodies = delta_bodies(&history, &internal_io.graph, generation);
+
+                    {
+                        let mut deltas = state.deltas.write();
+                        *state.protobuf.write() = protobuf;
+                        *state.json.write() = json;
+                        deltas.generation = generation;
+                        deltas.bodies = bodies;
+                    }
+
+                    if settings.delta_history > 0 {
+                        if history.len() >= settings.delta_history {
+                            history.pop_front();
+                        }
+                        history.push_back((generation, internal_io.graph));
+                    }
+                } else {
+                    debug!("graph unchanged since the last scrape");
+                }
+                published_revision = revision;
+            }
         }
 
         // Record scrape duration
@@ -250,3 +411,109 @@ pub fn run(settings: &config::AppSettings, state: &State) -> ! {
         debug!("graph update completed, {} valid releases", nodes_count);
     }
 }
+
+/// Returns a random number to start counting generations from.
+///
+/// Generations are only meaningful to the instance which published them, this
+/// keeps clients which move to another replica or outlive a restart from being
+/// served a delta for a different graph.
+fn initial_generation() -> u64 {
+    use std::hash::{BuildHasher, Hasher};
+
+    // The hasher keys are randomly seeded, leave plenty of room for incrementing.
+    std::collections::hash_map::RandomState::new()
+        .build_hasher()
+        .finish()
+        >> 1
+}
+
+/// Serialize the deltas from the previously published graphs to the given one.
+fn delta_bodies(
+    history: &VecDeque<(u64, cincinnati::Graph)>,
+    graph: &cincinnati::Graph,
+    generation: u64,
+) -> HashMap<u64, EncodedBody> {
+    history
+        .iter()
+        .filter_map(|(base_generation, base)| {
+            let delta = GraphDelta::between(base, *base_generation, graph, generation)
+                .and_then(|delta| serde_json::to_vec(&delta).map_err(Into::into));
+            match delta {
+                Ok(delta) => Some((*base_generation, EncodedBody::new(delta.into()))),
+                Err(err) => {
+                    error!(
+                        "Failed to compute delta from generation {}: {}",
+                        base_generation, err
+                    );
+                    None
+                }
+            }
+        })
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use actix_web::web::Bytes;
+
+    fn content_type(accept: Option<&str>) -> Fallible<String> {
+        let rt = commons::testing::init_runtime()?;
+
+        let registry: &'static prometheus::Registry =
+            Box::leak(Box::new(prometheus::Registry::new()));
+        let graph = cincinnati::Graph::default();
+        let json = EncodedBody::new(Bytes::from(serde_json::to_vec(&graph)?));
+        let state = State::new(
+            Arc::new(RwLock::new(json)),
+            HashSet::new(),
+            Arc::new(RwLock::new(true)),
+            Arc::new(RwLock::new(true)),
+            Box::leak(Box::new([])),
+            registry,
+        );
+        *state.protobuf.write() = EncodedBody::new(Bytes::from(transport::encode(&graph)?));
+
+        let mut req = actix_web::test::TestRequest::get();
+        if let Some(accept) = accept {
+            req = req.insert_header((header::ACCEPT, accept));
+        }
+        let resp = rt.block_on(index(
+            req.to_http_request(),
+            actix_web::web::Data::new(state),
+        ))?;
+
+        let content_type = resp
+            .headers()
+            .get(header::CONTENT_TYPE)
+            .ok_or_else(|| format_err!("missing content type"))?;
+        Ok(content_type.to_str()?.to_string())
+    }
+
+    #[test]
+    fn index_serves_protobuf_only_if_preferred() -> Fallible<()> {
+        assert_eq!(content_type(None)?, CONTENT_TYPE);
+        assert_eq!(content_type(Some("*/*"))?, CONTENT_TYPE);
+        assert_eq!(
+            content_type(Some("application/json, */*;q=0.1"))?,
+            CONTENT_TYPE
+        );
+        assert_eq!(
+            content_type(Some(&format!(
+                "{};q=0.5, {}",
+                transport::CONTENT_TYPE,
+                CONTENT_TYPE
+            )))?,
+            CONTENT_TYPE
+        );
+        assert_eq!(
+            content_type(Some(&format!(
+                "{}, {};q=0.5",
+                transport::CONTENT_TYPE,
+                CONTENT_TYPE
+            )))?,
+            transport::CONTENT_TYPE
+        );
+        Ok(())
+    }
+}
@@ -58,7 +58,7 @@ async fn main() -> Result<(), Error> {
 
     // Shared state.
     let state = {
-        let json_graph = Arc::new(RwLock::new(String::new()));
+        let json_graph = Arc::new(RwLock::new(commons::encoding::EncodedBody::default()));
         let live = Arc::new(RwLock::new(false));
         let ready = Arc::new(RwLock::new(false));
 
@@ -121,6 +121,10 @@ async fn main() -> Result<(), Error> {
                 actix_web::web::resource(&format!("{}/v1/graph", app_prefix.clone()))
                     .route(actix_web::web::get().to(graph::index)),
             )
+            .service(
+                actix_web::web::resource(&format!("{}/v1/graph/delta", app_prefix.clone()))
+                    .route(actix_web::web::get().to(graph::delta)),
+            )
     })
     .keep_alive(10)
     .bind(service_addr)?
@@ -170,7 +174,7 @@ mod tests {
     use std::sync::Arc;
 
     fn mock_state(is_live: bool, is_ready: bool) -> State {
-        let json_graph = Arc::new(RwLock::new(String::new()));
+        let json_graph = Arc::new(RwLock::new(commons::encoding::EncodedBody::default()));
         let live = Arc::new(RwLock::new(is_live));
         let ready = Arc::new(RwLock::new(is_ready));
 
@@ -254,4 +258,57 @@ mod tests {
 
         Ok(())
     }
+
+    #[test]
+    fn serve_graph_conditional() -> Fallible<()> {
+        use actix_web::http::{header, StatusCode};
+
+        let rt = testing::init_runtime()?;
+
+        let json_graph = commons::encoding::EncodedBody::new(actix_web::web::Bytes::from_static(
+            br#"{"nodes":[],"edges":[]}"#,
+        ));
+        let etag = json_graph.etag().to_string();
+        let registry: &'static Registry = Box::leak(Box::new(
+            metrics::new_registry(Some(config::METRICS_PREFIX.to_string())).unwrap(),
+        ));
+        let state = State::new(
+            Arc::new(RwLock::new(json_graph)),
+            HashSet::new(),
+            Arc::new(RwLock::new(true)),
+            Arc::new(RwLock::new(true)),
+            Box::leak(Box::new([])),
+            registry,
+        );
+
+        let resp = rt.block_on(graph::index(
+            actix_web::test::TestRequest::default().to_http_request(),
+            actix_web::web::Data::new(state.clone()),
+        ))?;
+        assert_eq!(resp.status(), StatusCode::OK);
+        assert_eq!(
+            resp.headers()
+                .get(header::ETAG)
+                .and_then(|value| value.to_str().ok()),
+            Some(etag.as_str())
+        );
+
+        let resp = rt.block_on(graph::index(
+            actix_web::test::TestRequest::default()
+                .insert_header((header::IF_NONE_MATCH, etag.clone()))
+                .to_http_request(),
+            actix_web::web::Data::new(state.clone()),
+        ))?;
+        assert_eq!(resp.status(), StatusCode::NOT_MODIFIED);
+
+        let resp = rt.block_on(graph::index(
+            actix_web::test::TestRequest::default()
+                .insert_header((header::IF_NONE_MATCH, "\"outdated\""))
+                .to_http_request(),
+            actix_web::web::Data::new(state),
+        ))?;
+        assert_eq!(resp.status(), StatusCode::OK);
+
+        Ok(())
+    }
 }
@@ -0,0 +1,231 @@
+//! Cache for serialized graph responses.
+//!
+//! The result of the plugin chain only depends on the client parameters
+//! which are consumed by the plugins and on the upstream graph. Responses
+//! are therefore stored as final JSON bytes along with their entity-tag,
+//! keyed by the normalized parameters. Precompressed variants are added in
+//! the background. Every entry records the revision of the upstream graph it
+//! was produced from, and is only served as long as it hasn't expired and no
+//! other revision has been fetched since.
+
+use commons::encoding::EncodedBody;
+use std::collections::{BTreeMap, HashMap, HashSet};
+use std::sync::RwLock;
+use std::time::{Duration, Instant};
+
+/// Default lifetime of a cached response.
+pub static DEFAULT_CACHE_TTL: Duration = Duration::from_secs(30);
+
+/// Default client parameters which don't influence the plugin output.
+pub static DEFAULT_CACHE_IGNORED_PARAMS: &[&str] = &["id", "version"];
+
+/// Upper bound for the number of cached responses.
+///
+/// This protects against unbounded growth for clients requesting many
+/// distinct (but valid) parameter combinations.
+pub static MAX_CACHE_ENTRIES: usize = 1024;
+
+/// Encode the given client parameters in a canonical order, leaving out the ignored ones.
+pub fn normalize_params(params: &HashMap<String, String>, ignored: &HashSet<String>) -> String {
+    let sorted: BTreeMap<&str, &str> = params
+        .iter()
+        .filter(|(key, _)| !ignored.contains(key.as_str()))
+        .map(|(key, value)| (key.as_str(), value.as_str()))
+        .collect();
+
+    url::form_urlencoded::Serializer::new(String::new())
+        .extend_pairs(sorted)
+        .finish()
+}
+
+/// Cached response along with the upstream revision it was produced from.
+#[derive(Debug, Clone)]
+pub struct CacheEntry {
+    pub response: EncodedBody,
+    /// Upstream revision of the graph, if the plugins track one.
+    pub revision: Option<String>,
+    created: Instant,
+}
+
+/// Time-bounded cache for serialized graph responses.
+#[derive(Debug, Default)]
+pub struct ResponseCache {
+    /// Lifetime of an entry. A zero duration disables the cache.
+    ttl: Duration,
+    /// Client parameters which are not part of the cache key.
+    ignored_params: HashSet<String>,
+    entries: RwLock<HashMap<String, CacheEntry>>,
+}
+
+impl ResponseCache {
+    /// Create a new cache with the given entry lifetime and ignored parameters.
+    pub fn new(ttl: Duration, ignored_params: HashSet<String>) -> Self {
+        Self {
+            ttl,
+            ignored_params,
+            entries: Default::default(),
+        }
+    }
+
+    /// Returns true if the cache stores responses at all.
+    pub fn is_enabled(&self) -> bool {
+        self.ttl > Duration::from_secs(0)
+    }
+
+    /// Build the normalized cache key for the given client parameters.
+    ///
+    /// Returns `None` if the cache is disabled.
+    pub fn key(&self, params: &HashMap<String, String>) -> Option<String> {
+        if !self.is_enabled() {
+            return None;
+        }
+
+        Some(normalize_params(params, &self.ignored_params))
+    }
+
+    /// Look up a non-expired entry for the given key.
+    ///
+    /// Its revision still needs to be checked against the current upstream revision.
+    pub fn get(&self, key: &str) -> Option<CacheEntry> {
+        let entries = self.entries.read().ok()?;
+
+        entries
+            .get(key)
+            .filter(|entry| entry.created.elapsed() < self.ttl)
+            .cloned()
+    }
+
+    /// Store a response produced from the given upstream revision for the given key.
+    pub fn insert(&self, key: String, revision: Option<String>, response: EncodedBody) {
+        let mut entries = match self.entries.write() {
+            Ok(entries) => entries,
+            Err(_) => return,
+        };
+
+        if entries.len() >= MAX_CACHE_ENTRIES {
+            let ttl = self.ttl;
+            entries.retain(|_, entry| entry.created.elapsed() < ttl);
+        }
+
+        if entries.len() >= MAX_CACHE_ENTRIES && !entries.contains_key(&key) {
+            debug!("response cache is full, not caching '{}'", key);
+            return;
+        }
+
+        entries.insert(
+            key,
+            CacheEntry {
+                response,
+                revision,
+                created: Instant::now(),
+            },
+        );
+    }
+
+    /// Replace the stored response for the given key by an equivalent one, e.g. one with
+    /// precompressed variants.
+    ///
+    /// Nothing is replaced if the entry has been replaced by a different response meanwhile.
+    pub fn replace(&self, key: &str, response: EncodedBody) {
+        let mut entries = match self.entries.write() {
+            Ok(entries) => entries,
+            Err(_) => return,
+        };
+
+        if let Some(entry) = entries
+            .get_mut(key)
+            .filter(|entry| entry.response.etag() == response.etag())
+        {
+            entry.response = response;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use actix_web::web::Bytes;
+
+    fn params(pairs: &[(&str, &str)]) -> HashMap<String, String> {
+        pairs
+            .iter()
+            .map(|(k, v)| (k.to_string(), v.to_string()))
+            .collect()
+    }
+
+    #[test]
+    fn key_is_normalized() {
+        let cache = ResponseCache::new(
+            DEFAULT_CACHE_TTL,
+            DEFAULT_CACHE_IGNORED_PARAMS
+                .iter()
+                .map(ToString::to_string)
+                .collect(),
+        );
+
+        let a = cache.key(&params(&[
+            ("channel", "stable-4.8"),
+            ("arch", "amd64"),
+            ("id", "a"),
+        ]));
+        let b = cache.key(&params(&[
+            ("id", "b"),
+            ("arch", "amd64"),
+            ("channel", "stable-4.8"),
+            ("version", "4.8.1"),
+        ]));
+        let c = cache.key(&params(&[("channel", "fast-4.8"), ("arch", "amd64")]));
+
+        assert!(a.is_some());
+        assert_eq!(a, b);
+        assert_ne!(a, c);
+    }
+
+    #[test]
+    fn disabled_cache_has_no_keys() {
+        let cache = ResponseCache::default();
+
+        assert!(!cache.is_enabled());
+        assert_eq!(cache.key(&params(&[("channel", "a")])), None);
+    }
+
+    #[test]
+    fn entries_expire() {
+        let cache = ResponseCache::new(Duration::from_millis(50), HashSet::new());
+        let key = cache.key(&params(&[("channel", "a")])).unwrap();
+
+        let response = EncodedBody::new(Bytes::from_static(b"{}"));
+
+        assert_eq!(cache.get(&key), None);
+        cache.insert(key.clone(), Some("1".to_string()), response.clone());
+        let entry = cache.get(&key).unwrap();
+        assert_eq!(entry.response, response);
+        assert_eq!(entry.revision.as_deref(), Some("1"));
+
+        std::thread::sleep(Duration::from_millis(100));
+        assert_eq!(cache.get(&key), None);
+    }
+
+    #[test]
+    fn replacements_keep_the_entity_tag() {
+        let cache = ResponseCache::new(DEFAULT_CACHE_TTL, HashSet::new());
+        let key = cache.key(&params(&[("channel", "a")])).unwrap();
+
+        let body = Bytes::from_static(b"{}");
+        cache.replace(&key, EncodedBody::new(body.clone()));
+        assert!(
+            cache.get(&key).is_none(),
+            "only existing entries are replaced"
+        );
+
+        cache.insert(key.clone(), None, EncodedBody::uncompressed(body.clone()));
+        cache.replace(&key, EncodedBody::new(Bytes::from_static(b"[]")));
+        assert_eq!(
+            cache.get(&key).unwrap().response,
+            EncodedBody::uncompressed(body.clone())
+        );
+
+        cache.replace(&key, EncodedBody::new(body.clone()));
+        assert_eq!(cache.get(&key).unwrap().response, EncodedBody::new(body));
+    }
+}
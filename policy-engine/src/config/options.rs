@@ -54,6 +54,17 @@ pub struct ServiceOptions {
     /// Optional tracing endpoint
     #[structopt(name = "tracing_endpoint", long = "service.tracing_endpoint")]
     pub tracing_endpoint: Option<String>,
+
+    /// Lifetime (in seconds) of cached graph responses, 0 disables the cache
+    #[structopt(long = "service.cache_ttl_secs")]
+    pub cache_ttl_secs: Option<u64>,
+
+    /// Comma-separated set of client parameters which are ignored by the response cache
+    #[structopt(
+        long = "service.cache_ignored_parameters",
+        parse(from_str = parse_params_set)
+    )]
+    pub cache_ignored_parameters: Option<HashSet<String>>,
 }
 
 impl MergeOptions<Option<ServiceOptions>> for AppSettings {
@@ -63,6 +74,14 @@ impl MergeOptions<Option<ServiceOptions>> for AppSettings {
             assign_if_some!(self.port, service.port);
             assign_if_some!(self.path_prefix, service.path_prefix);
             assign_if_some!(self.tracing_endpoint, service.tracing_endpoint);
+            assign_if_some!(
+                self.cache_ttl,
+                service.cache_ttl_secs.map(std::time::Duration::from_secs)
+            );
+            assign_if_some!(
+                self.cache_ignored_parameters,
+                service.cache_ignored_parameters
+            );
             if let Some(params) = service.mandatory_client_parameters {
                 self.mandatory_client_parameters.extend(params);
             }
@@ -8,6 +8,7 @@ use custom_debug_derive::Debug as CustomDebug;
 use hyper::Uri;
 use std::collections::HashSet;
 use std::net::{IpAddr, Ipv4Addr};
+use std::time::Duration;
 use structopt::StructOpt;
 
 /// Default URL to upstream graph provider.
@@ -51,6 +52,14 @@ pub struct AppSettings {
 
     /// Jaeger host and port for tracing support
     pub tracing_endpoint: Option<String>,
+
+    /// Lifetime of cached graph responses, zero disables the cache.
+    #[default(crate::cache::DEFAULT_CACHE_TTL)]
+    pub cache_ttl: Duration,
+
+    /// Client parameters which are not considered for the response cache key.
+    #[default(crate::cache::DEFAULT_CACHE_IGNORED_PARAMS.iter().map(ToString::to_string).collect())]
+    pub cache_ignored_parameters: HashSet<String>,
 }
 
 impl AppSettings {
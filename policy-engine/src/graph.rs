@@ -2,10 +2,12 @@
 
 use crate::AppState;
 use actix_web::http::HeaderValue;
-use actix_web::web::Query;
+use actix_web::web::{Bytes, Query};
 use actix_web::{HttpRequest, HttpResponse};
-use cincinnati::plugins::BoxedPlugin;
+use cincinnati::plugins::internal::cincinnati_graph_fetch::UPSTREAM_REVISION_PARAM_KEY;
+use cincinnati::plugins::{BoxedPlugin, InternalIO};
 use cincinnati::CONTENT_TYPE;
+use commons::encoding::EncodedBody;
 use commons::tracing::get_tracer;
 use commons::{self, Fallible, GraphError};
 use opentelemetry::{
@@ -13,8 +15,8 @@ use opentelemetry::{
     Context as ot_context,
 };
 use prometheus::{histogram_opts, Counter, Histogram, Registry};
-use serde_json;
 use std::collections::HashMap;
+use std::sync::atomic::AtomicUsize;
 
 lazy_static! {
     static ref V1_GRAPH_INCOMING_REQS: Counter = Counter::new(
@@ -29,13 +31,29 @@ lazy_static! {
         vec![0.005, 0.01, 0.025, 0.05, 0.075, 0.1, 0.25, 0.5, 0.75, 1.0, 5.0]
     ))
     .unwrap();
+    static ref V1_GRAPH_CACHE_HITS: Counter = Counter::new(
+        "v1_graph_response_cache_hits_total",
+        "Total number of /v1/graph requests served from the response cache"
+    )
+    .unwrap();
+    static ref V1_GRAPH_CACHE_MISSES: Counter = Counter::new(
+        "v1_graph_response_cache_misses_total",
+        "Total number of /v1/graph requests which missed the response cache"
+    )
+    .unwrap();
 }
 
+/// Size of the last serialized graph response, used to pre-size the next buffer.
+static GRAPH_RESPONSE_SIZE_HINT: AtomicUsize = AtomicUsize::new(0);
+
 /// Register relevant metrics to a prometheus registry.
 pub(crate) fn register_metrics(registry: &Registry) -> Fallible<()> {
     commons::register_metrics(&registry)?;
+    cincinnati::plugins::register_metrics(&registry)?;
     registry.register(Box::new(V1_GRAPH_INCOMING_REQS.clone()))?;
     registry.register(Box::new(V1_GRAPH_SERVE_HIST.clone()))?;
+    registry.register(Box::new(V1_GRAPH_CACHE_HITS.clone()))?;
+    registry.register(Box::new(V1_GRAPH_CACHE_MISSES.clone()))?;
     Ok(())
 }
 
@@ -71,17 +89,49 @@ async fn _index(
 
     let timer = V1_GRAPH_SERVE_HIST.start_timer();
 
+    let cache = &app_data.response_cache;
+    let cache_key = cache.key(&plugin_params);
+    if let Some(key) = &cache_key {
+        if let Some(entry) = cache.get(key) {
+            // An upstream change invalidates the entry before it expires.
+            match cincinnati::plugins::upstream_revision(app_data.plugins.iter()).await {
+                Ok(revision) if revision == entry.revision => {
+                    V1_GRAPH_CACHE_HITS.inc();
+                    timer.observe_duration();
+                    return Ok(entry.response.respond(req.headers(), CONTENT_TYPE));
+                }
+                Ok(_) => {}
+                Err(e) => warn!("failed to check the upstream revision: {:#}", e),
+            }
+        }
+        V1_GRAPH_CACHE_MISSES.inc();
+    }
+
     let cx = ot_context::current();
-    let response = process_plugins(app_data.plugins.iter(), plugin_params)
+    let processed = process_plugins(app_data.plugins.iter(), plugin_params)
         .with_context(cx)
         .await;
 
     timer.observe_duration();
-    response
+
+    let (body, revision) = processed?;
+    let response = EncodedBody::uncompressed(body);
+    if let Some(key) = cache_key {
+        cache.insert(key.clone(), revision, response.clone());
+
+        // Compressing only pays off if the response is served again from the cache.
+        // It is done off the worker threads, until then the response is served uncompressed.
+        let cache = cache.clone();
+        let (body, etag) = (response.body().clone(), response.etag().to_string());
+        actix_web::rt::task::spawn_blocking(move || {
+            cache.replace(&key, EncodedBody::with_etag(body, etag))
+        });
+    }
+    Ok(response.respond(req.headers(), CONTENT_TYPE))
 }
 
 // logs api request error
-fn api_response_error(req: &HttpRequest, e: GraphError) -> GraphError {
+pub(crate) fn api_response_error(req: &HttpRequest, e: GraphError) -> GraphError {
     error!(
         "Error serving request \"{}\" from '{}': {:?}",
         format_request(req),
@@ -118,15 +168,36 @@ pub fn format_request(req: &HttpRequest) -> String {
     )
 }
 
+/// Run the plugins and serialize the resulting graph, along with its upstream revision.
 async fn process_plugins<P>(
     plugins: P,
     plugin_params: HashMap<String, String>,
-) -> Result<HttpResponse, GraphError>
+) -> Result<(Bytes, Option<String>), GraphError>
+where
+    P: std::iter::Iterator<Item = &'static BoxedPlugin>,
+    P: 'static + Sync + Send,
+{
+    let internal_io = run_plugins(plugins, plugin_params).await?;
+    let revision = internal_io
+        .parameters
+        .get(UPSTREAM_REVISION_PARAM_KEY)
+        .cloned();
+
+    let body = commons::to_json_bytes(&internal_io.graph, &GRAPH_RESPONSE_SIZE_HINT)
+        .map_err(|e| GraphError::FailedJsonOut(e.to_string()))?;
+    Ok((body, revision))
+}
+
+/// Run the plugins on an empty graph with the given client parameters.
+pub(crate) async fn run_plugins<P>(
+    plugins: P,
+    plugin_params: HashMap<String, String>,
+) -> Result<InternalIO, GraphError>
 where
     P: std::iter::Iterator<Item = &'static BoxedPlugin>,
     P: 'static + Sync + Send,
 {
-    let internal_io = cincinnati::plugins::process(
+    cincinnati::plugins::process(
         plugins,
         cincinnati::plugins::PluginIO::InternalIO(cincinnati::plugins::InternalIO {
             graph: Default::default(),
@@ -137,14 +208,7 @@ where
     .map_err(|e| match e.downcast::<GraphError>() {
         Ok(graph_error) => graph_error,
         Err(other_error) => GraphError::FailedPluginExecution(other_error.to_string()),
-    })?;
-
-    let graph_json = serde_json::to_string(&internal_io.graph)
-        .map_err(|e| GraphError::FailedJsonOut(e.to_string()))?;
-
-    Ok(HttpResponse::Ok()
-        .content_type(CONTENT_TYPE)
-        .body(graph_json))
+    })
 }
 
 #[cfg(test)]
@@ -235,6 +299,115 @@ pub(crate) mod tests {
         }
     }
 
+    fn cached_state() -> Result<actix_web::web::Data<AppState>, Error> {
+        let plugins = cincinnati::plugins::catalog::build_plugins(
+            &[plugin_config!(
+                ("name", CincinnatiGraphFetchPlugin::PLUGIN_NAME),
+                ("upstream", &mockito::server_url())
+            )?],
+            None,
+        )?;
+
+        let state = AppState {
+            plugins: Box::leak(Box::new(plugins)),
+            response_cache: std::sync::Arc::new(crate::cache::ResponseCache::new(
+                std::time::Duration::from_secs(60),
+                Default::default(),
+            )),
+            ..Default::default()
+        };
+        Ok(actix_web::web::Data::new(state))
+    }
+
+    fn cached_request(
+        rt: &Runtime,
+        app_data: &actix_web::web::Data<AppState>,
+        channel: &str,
+    ) -> Result<cincinnati::Graph, Error> {
+        let http_req = actix_web::test::TestRequest::get()
+            .uri(&format!("http://unused.test?channel={}", channel))
+            .insert_header((
+                http::header::ACCEPT,
+                http::header::HeaderValue::from_static(cincinnati::CONTENT_TYPE),
+            ))
+            .to_http_request();
+
+        let resp = rt.block_on(graph::index(http_req, app_data.clone()))?;
+        ensure!(resp.status() == http::StatusCode::OK, "{}", resp.status());
+        match resp.body() {
+            actix_web::dev::ResponseBody::Body(actix_web::dev::Body::Bytes(bytes)) => {
+                Ok(serde_json::from_slice(bytes)?)
+            }
+            unknown => bail!("expected byte body, got '{:?}'", unknown),
+        }
+    }
+
+    #[test]
+    fn cached_response_skips_plugins() -> Result<(), Error> {
+        let rt = common_init();
+        let app_data = cached_state()?;
+
+        let upstream = mockito::mock("GET", "/")
+            .match_header("if-none-match", mockito::Matcher::Missing)
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_header("etag", r#""a""#)
+            .with_body(r#"{"nodes":[],"edges":[]}"#)
+            .expect(1)
+            .create();
+
+        // Hits are checked against the last known upstream revision without contacting upstream.
+        for _ in 0..3 {
+            cached_request(&rt, &app_data, "a")?;
+        }
+
+        upstream.assert();
+        Ok(())
+    }
+
+    #[test]
+    fn cached_response_is_invalidated_by_upstream_change() -> Result<(), Error> {
+        let rt = common_init();
+        let app_data = cached_state()?;
+
+        let metadata = vec![(0, Default::default())];
+        let changed = cincinnati::testing::generate_custom_graph("image", metadata, None);
+
+        let upstream = mockito::mock("GET", "/")
+            .match_header("if-none-match", mockito::Matcher::Missing)
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_header("etag", r#""a""#)
+            .with_body(r#"{"nodes":[],"edges":[]}"#)
+            .expect(1)
+            .create();
+        let modified = mockito::mock("GET", "/")
+            .match_header("if-none-match", r#""a""#)
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_header("etag", r#""b""#)
+            .with_body(serde_json::to_string(&changed)?)
+            .expect(1)
+            .create();
+        let not_modified = mockito::mock("GET", "/")
+            .match_header("if-none-match", r#""b""#)
+            .with_status(304)
+            .expect(1)
+            .create();
+
+        assert_eq!(cached_request(&rt, &app_data, "a")?.releases_count(), 0);
+        // Another key misses the cache and fetches the changed graph.
+        assert_eq!(cached_request(&rt, &app_data, "b")?, changed);
+        // The entry produced from the previous revision is not served anymore.
+        assert_eq!(cached_request(&rt, &app_data, "a")?, changed);
+        assert_eq!(cached_request(&rt, &app_data, "a")?, changed);
+
+        upstream.assert();
+        modified.assert();
+        not_modified.assert();
+        Ok(())
+    }
+
     #[test]
     fn webservice_graph_json_response() -> Result<(), Error> {
         let _ = common_init();
@@ -19,9 +19,11 @@ extern crate structopt;
 #[macro_use]
 extern crate custom_debug_derive;
 
+mod cache;
 mod config;
 mod graph;
 mod openapi;
+mod upgrade_path;
 
 use actix_cors::Cors;
 use actix_service::Service;
@@ -38,6 +40,7 @@ use opentelemetry::{
 };
 use prometheus::{labels, opts, Counter, Registry};
 use std::collections::HashSet;
+use std::sync::Arc;
 
 #[allow(dead_code)]
 /// Build info
@@ -76,6 +79,7 @@ async fn main() -> Result<(), Error> {
         METRICS_PREFIX.to_string(),
     ))?));
     graph::register_metrics(registry)?;
+    upgrade_path::register_metrics(registry)?;
     registry.register(Box::new(BUILD_INFO.clone()))?;
     let metrics_server = HttpServer::new(move || {
         App::new()
@@ -98,6 +102,14 @@ async fn main() -> Result<(), Error> {
         mandatory_params: settings.mandatory_client_parameters.clone(),
         path_prefix: settings.path_prefix.clone(),
         plugins: Box::leak(Box::new(plugins)),
+        response_cache: Arc::new(cache::ResponseCache::new(
+            settings.cache_ttl,
+            settings.cache_ignored_parameters.clone(),
+        )),
+        path_indices: Arc::new(upgrade_path::PathIndexCache::new(
+            settings.cache_ttl,
+            settings.cache_ignored_parameters.clone(),
+        )),
     };
 
     let main_server = HttpServer::new(move || {
@@ -120,6 +132,10 @@ async fn main() -> Result<(), Error> {
                 actix_web::web::resource(&format!("{}/v1/graph", app_prefix))
                     .route(actix_web::web::get().to(graph::index)),
             )
+            .service(
+                actix_web::web::resource(&format!("{}/v1/upgrade-path", app_prefix))
+                    .route(actix_web::web::get().to(upgrade_path::index)),
+            )
             .service(
                 actix_web::web::resource(&format!("{}/v1/openapi", app_prefix))
                     .route(actix_web::web::get().to(openapi::index)),
@@ -157,6 +173,10 @@ struct AppState {
     pub path_prefix: String,
     /// Policy plugins.
     pub plugins: &'static [BoxedPlugin],
+    /// Serialized responses, shared by all workers.
+    pub response_cache: Arc<cache::ResponseCache>,
+    /// Upgrade path indices, shared by all workers.
+    pub path_indices: Arc<upgrade_path::PathIndexCache>,
 }
 
 impl Default for AppState {
@@ -165,6 +185,8 @@ impl Default for AppState {
             plugins: Box::leak(Box::new([])),
             mandatory_params: HashSet::new(),
             path_prefix: String::new(),
+            response_cache: Default::default(),
+            path_indices: Default::default(),
         }
     }
 }
@@ -19,9 +19,11 @@ pub(crate) fn index(app_data: actix_web::web::Data<AppState>) -> HttpResponse {
             }
         };
 
-    // Add mandatory parameters to the `graph` endpoint.
-    if let Some(path) = spec_object.paths.get_mut("/v1/graph") {
-        add_mandatory_params(path, &app_data.mandatory_params);
+    // Add mandatory parameters to the `graph` and `upgrade-path` endpoints.
+    for endpoint in &["/v1/graph", "/v1/upgrade-path"] {
+        if let Some(path) = spec_object.paths.get_mut(*endpoint) {
+            add_mandatory_params(path, &app_data.mandatory_params);
+        }
     }
 
     // Prefix all paths with `path_prefix`
@@ -157,6 +159,7 @@ mod tests {
             mandatory_params: mandatory_params.clone(),
             path_prefix: path_prefix.clone(),
             plugins: Box::leak(Box::new([])),
+            ..Default::default()
         });
         let resource =
             actix_web::web::resource(service_uri).route(actix_web::web::get().to(super::index));
@@ -0,0 +1,321 @@
+//! Upgrade path service.
+//!
+//! Instead of the whole graph, `/v1/upgrade-path` returns the releases a client
+//! can update to directly from the version in `from`, or the releases and edges
+//! of a shortest path to the version in `to`. An empty graph means there's no
+//! such path. Both are answered from an index of the graph which the plugins
+//! produce for the remaining client parameters. Indices are shared by all
+//! requests and only rebuilt once the upstream graph has changed.
+
+use crate::cache::{normalize_params, MAX_CACHE_ENTRIES};
+use crate::AppState;
+use actix_web::web::Query;
+use actix_web::{HttpRequest, HttpResponse};
+use cincinnati::paths::PathIndex;
+use cincinnati::plugins::internal::cincinnati_graph_fetch::UPSTREAM_REVISION_PARAM_KEY;
+use cincinnati::CONTENT_TYPE;
+use commons::encoding::EncodedBody;
+use commons::tracing::get_tracer;
+use commons::{self, Fallible, GraphError};
+use opentelemetry::{
+    trace::{mark_span_as_active, FutureExt, Tracer},
+    Context as ot_context,
+};
+use prometheus::{Counter, Registry};
+use std::collections::{HashMap, HashSet};
+use std::sync::atomic::AtomicUsize;
+use std::sync::{Arc, RwLock};
+use std::time::{Duration, Instant};
+
+/// Client parameter with the version to update from.
+pub static FROM_PARAM: &str = "from";
+
+/// Optional client parameter with the version to update to.
+pub static TO_PARAM: &str = "to";
+
+lazy_static! {
+    static ref V1_UPGRADE_PATH_INCOMING_REQS: Counter = Counter::new(
+        "v1_upgrade_path_incoming_requests_total",
+        "Total number of incoming HTTP client request to /v1/upgrade-path"
+    )
+    .unwrap();
+    static ref V1_UPGRADE_PATH_INDEX_BUILDS: Counter = Counter::new(
+        "v1_upgrade_path_index_builds_total",
+        "Total number of upgrade path indices built"
+    )
+    .unwrap();
+}
+
+/// Size of the last serialized upgrade path response, used to pre-size the next buffer.
+static UPGRADE_PATH_RESPONSE_SIZE_HINT: AtomicUsize = AtomicUsize::new(0);
+
+/// Register relevant metrics to a prometheus registry.
+pub(crate) fn register_metrics(registry: &Registry) -> Fallible<()> {
+    registry.register(Box::new(V1_UPGRADE_PATH_INCOMING_REQS.clone()))?;
+    registry.register(Box::new(V1_UPGRADE_PATH_INDEX_BUILDS.clone()))?;
+    Ok(())
+}
+
+#[derive(Debug)]
+struct IndexEntry {
+    /// Revision of the upstream graph the index was built from, if known.
+    revision: Option<String>,
+    index: Arc<PathIndex>,
+    checked: Instant,
+}
+
+/// Upgrade path indices, keyed by the normalized client parameters.
+#[derive(Debug, Default)]
+pub struct PathIndexCache {
+    /// Duration for which an index is used without checking for upstream changes.
+    ttl: Duration,
+    /// Client parameters which are not part of the key.
+    ignored_params: HashSet<String>,
+    entries: RwLock<HashMap<String, IndexEntry>>,
+}
+
+impl PathIndexCache {
+    /// Create a new cache with the given revalidation interval and ignored parameters.
+    pub fn new(ttl: Duration, ignored_params: HashSet<String>) -> Self {
+        Self {
+            ttl,
+            ignored_params,
+            entries: Default::default(),
+        }
+    }
+
+    /// Build the normalized key for the given client parameters.
+    pub fn key(&self, params: &HashMap<String, String>) -> String {
+        normalize_params(params, &self.ignored_params)
+    }
+
+    /// Look up an index which doesn't need to be revalidated yet.
+    fn get(&self, key: &str) -> Option<Arc<PathIndex>> {
+        let entries = self.entries.read().ok()?;
+
+        entries
+            .get(key)
+            .filter(|entry| entry.checked.elapsed() < self.ttl)
+            .map(|entry| entry.index.clone())
+    }
+
+    /// Return the index for the graph produced from the given upstream revision.
+    ///
+    /// The stored index is reused if it was built from the same revision, otherwise
+    /// the graph is indexed and replaces it.
+    fn update(
+        &self,
+        key: String,
+        revision: Option<String>,
+        graph: cincinnati::Graph,
+    ) -> Arc<PathIndex> {
+        if revision.is_some() {
+            if let Ok(mut entries) = self.entries.write() {
+                if let Some(entry) = entries
+                    .get_mut(&key)
+                    .filter(|entry| entry.revision == revision)
+                {
+                    entry.checked = Instant::now();
+                    return entry.index.clone();
+                }
+            }
+        }
+
+        V1_UPGRADE_PATH_INDEX_BUILDS.inc();
+        let index = Arc::new(PathIndex::new(graph));
+
+        let mut entries = match self.entries.write() {
+            Ok(entries) => entries,
+            Err(_) => return index,
+        };
+
+        if entries.len() >= MAX_CACHE_ENTRIES {
+            let ttl = self.ttl;
+            entries.retain(|_, entry| entry.checked.elapsed() < ttl);
+        }
+
+        if entries.len() >= MAX_CACHE_ENTRIES && !entries.contains_key(&key) {
+            debug!("upgrade path cache is full, not caching '{}'", key);
+            return index;
+        }
+
+        entries.insert(
+            key,
+            IndexEntry {
+                revision,
+                index: index.clone(),
+                checked: Instant::now(),
+            },
+        );
+        index
+    }
+}
+
+/// Serve upgrade path requests.
+pub(crate) async fn index(
+    req: HttpRequest,
+    app_data: actix_web::web::Data<AppState>,
+) -> Result<HttpResponse, GraphError> {
+    _index(&req, app_data)
+        .await
+        .map_err(|e| crate::graph::api_response_error(&req, e))
+}
+
+async fn _index(
+    req: &HttpRequest,
+    app_data: actix_web::web::Data<AppState>,
+) -> Result<HttpResponse, GraphError> {
+    let span = get_tracer().start("upgrade_path");
+    let _active_span = mark_span_as_active(span);
+
+    V1_UPGRADE_PATH_INCOMING_REQS.inc();
+
+    // Check that the client can accept JSON media type.
+    commons::validate_content_type(req.headers(), CONTENT_TYPE)?;
+
+    // Check for required client parameters.
+    commons::ensure_query_params(&app_data.mandatory_params, req.query_string())?;
+
+    let mut plugin_params = Query::<HashMap<String, String>>::from_query(req.query_string())
+        .map(|query| query.into_inner())
+        .map_err(|e| GraphError::InvalidParams(e.to_string()))?;
+    let from = plugin_params
+        .remove(FROM_PARAM)
+        .ok_or_else(|| GraphError::MissingParams(vec![FROM_PARAM.to_string()]))?;
+    let to = plugin_params.remove(TO_PARAM);
+
+    let indices = &app_data.path_indices;
+    let key = indices.key(&plugin_params);
+    let index = match indices.get(&key) {
+        Some(index) => index,
+        None => {
+            let cx = ot_context::current();
+            let internal_io = crate::graph::run_plugins(app_data.plugins.iter(), plugin_params)
+                .with_context(cx)
+                .await?;
+            let revision = internal_io
+                .parameters
+                .get(UPSTREAM_REVISION_PARAM_KEY)
+                .cloned();
+            indices.update(key, revision, internal_io.graph)
+        }
+    };
+
+    let find = |version: &str| {
+        index
+            .graph()
+            .find_by_version(version)
+            .ok_or_else(|| GraphError::UnknownVersion(version.to_string()))
+    };
+    let from = find(&from)?;
+    let path = match to {
+        Some(to) => index.shortest_path(&from, &find(&to)?).unwrap_or_default(),
+        None => index.next_hops(&from),
+    };
+
+    let body = commons::to_json_bytes(&path, &UPGRADE_PATH_RESPONSE_SIZE_HINT)
+        .map_err(|e| GraphError::FailedJsonOut(e.to_string()))?;
+    Ok(EncodedBody::uncompressed(body).respond(req.headers(), CONTENT_TYPE))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::graph::tests::common_init;
+    use actix_web::http;
+    use cincinnati::plugins::prelude::*;
+    use cincinnati::testing::generate_custom_graph;
+
+    fn request(query: &str) -> HttpRequest {
+        actix_web::test::TestRequest::get()
+            .uri(&format!("http://unused.test/v1/upgrade-path?{}", query))
+            .insert_header((
+                http::header::ACCEPT,
+                http::header::HeaderValue::from_static(cincinnati::CONTENT_TYPE),
+            ))
+            .to_http_request()
+    }
+
+    #[test]
+    fn paths_are_served_from_shared_index() -> Result<(), Error> {
+        let rt = common_init();
+
+        let plugins = cincinnati::plugins::catalog::build_plugins(
+            &[plugin_config!(
+                ("name", CincinnatiGraphFetchPlugin::PLUGIN_NAME),
+                ("upstream", &mockito::server_url())
+            )?],
+            None,
+        )?;
+
+        let state = AppState {
+            plugins: Box::leak(Box::new(plugins)),
+            path_indices: Arc::new(PathIndexCache::new(
+                Duration::from_secs(60),
+                Default::default(),
+            )),
+            ..Default::default()
+        };
+        let app_data = actix_web::web::Data::new(state);
+
+        let metadata = (0..4).map(|i| (i, Default::default())).collect();
+        let graph = generate_custom_graph(
+            "image",
+            metadata,
+            Some(vec![(0, 1), (1, 2), (0, 2), (2, 3)]),
+        );
+        let upstream = mockito::mock("GET", "/")
+            .with_status(200)
+            .with_header("content-type", "application/json")
+            .with_body(serde_json::to_string(&graph)?)
+            .expect(1)
+            .create();
+
+        let body = |query: &str| -> Result<cincinnati::Graph, Error> {
+            let resp = rt.block_on(index(request(query), app_data.clone()))?;
+            ensure!(resp.status() == http::StatusCode::OK, "{}", resp.status());
+            match resp.body() {
+                actix_web::dev::ResponseBody::Body(actix_web::dev::Body::Bytes(bytes)) => {
+                    Ok(serde_json::from_slice(bytes)?)
+                }
+                unknown => bail!("expected byte body, got '{:?}'", unknown),
+            }
+        };
+        let versions = |graph: &cincinnati::Graph| -> Vec<String> {
+            graph
+                .view()
+                .releases()
+                .map(|(_, release)| release.version().to_string())
+                .collect()
+        };
+
+        let next = body("from=0.0.0")?;
+        assert_eq!(versions(&next), vec!["0.0.0", "1.0.0", "2.0.0"]);
+        assert_eq!(next.edges_count(), 2);
+
+        let path = body("from=0.0.0&to=3.0.0")?;
+        assert_eq!(versions(&path), vec!["0.0.0", "2.0.0", "3.0.0"]);
+        assert_eq!(path.edges_count(), 2);
+
+        let none = body("from=3.0.0&to=0.0.0")?;
+        assert_eq!(none.releases_count(), 0);
+
+        match rt.block_on(index(request("from=9.0.0"), app_data.clone())) {
+            Err(GraphError::UnknownVersion(version)) => assert_eq!(version, "9.0.0"),
+            res => bail!("expected UnknownVersion error, got: {:?}", res),
+        };
+        match rt.block_on(index(request("to=1.0.0"), app_data.clone())) {
+            Err(GraphError::MissingParams(params)) => assert_eq!(params, vec![FROM_PARAM]),
+            res => bail!("expected MissingParams error, got: {:?}", res),
+        };
+
+        upstream.assert();
+        assert_eq!(
+            app_data.path_indices.entries.read().unwrap().len(),
+            1,
+            "all queries share one index"
+        );
+
+        Ok(())
+    }
+}